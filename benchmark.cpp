@@ -0,0 +1,885 @@
+#include "benchmark.h"
+#include "esp8266.h"
+#include "espsimulator.h"
+#include "compressor.h"
+#include "slip.h"
+#include "checksum.h"
+#include "serial.h"
+#include "version.h"
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <thread>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <cstring> //provides strerror
+#include <fcntl.h> //provides O_RDWR
+#include <unistd.h> //provides read, close
+#ifdef BENCH_COUNT_ALLOCATIONS
+#include <new>
+#include <cstdlib> //provides malloc for counting allocator
+
+static thread_local unsigned long g_nAllocations = 0; //Heap allocations made by current thread
+
+/*  Global allocator replacement counts allocations per thread so the benchmark can report allocations per frame in the sending thread.
+    The simulator runs in its own thread and does not contribute.
+    Only built into the Benchmark target (BENCH_COUNT_ALLOCATIONS) so normal builds keep the standard allocator.
+*/
+void* operator new(size_t nSize)
+{
+    ++g_nAllocations;
+    void* pMemory = malloc(nSize ? nSize : 1);
+    if(!pMemory)
+        throw bad_alloc();
+    return pMemory;
+}
+
+void* operator new[](size_t nSize)
+{
+    return operator new(nSize);
+}
+
+void operator delete(void* pMemory) noexcept
+{
+    free(pMemory);
+}
+
+void operator delete[](void* pMemory) noexcept
+{
+    free(pMemory);
+}
+
+#if defined(__cpp_sized_deallocation)
+void operator delete(void* pMemory, size_t nSize) noexcept
+{
+    free(pMemory);
+}
+
+void operator delete[](void* pMemory, size_t nSize) noexcept
+{
+    free(pMemory);
+}
+#endif // __cpp_sized_deallocation
+
+#if defined(__cpp_aligned_new)
+void* operator new(size_t nSize, align_val_t nAlignment)
+{
+    ++g_nAllocations;
+    //aligned_alloc requires size to be a multiple of alignment
+    size_t nAlign = static_cast<size_t>(nAlignment);
+    void* pMemory = aligned_alloc(nAlign, (nSize + nAlign - 1) / nAlign * nAlign + (nSize ? 0 : nAlign));
+    if(!pMemory)
+        throw bad_alloc();
+    return pMemory;
+}
+
+void* operator new[](size_t nSize, align_val_t nAlignment)
+{
+    return operator new(nSize, nAlignment);
+}
+
+void operator delete(void* pMemory, align_val_t nAlignment) noexcept
+{
+    free(pMemory);
+}
+
+void operator delete[](void* pMemory, align_val_t nAlignment) noexcept
+{
+    free(pMemory);
+}
+
+void operator delete(void* pMemory, size_t nSize, align_val_t nAlignment) noexcept
+{
+    free(pMemory);
+}
+
+void operator delete[](void* pMemory, size_t nSize, align_val_t nAlignment) noexcept
+{
+    free(pMemory);
+}
+#endif // __cpp_aligned_new
+
+const static bool BENCH_ALLOCATIONS = true; //True if allocations are counted
+
+/*  Get quantity of heap allocations made by current thread */
+static unsigned long GetAllocations()
+{
+    return g_nAllocations;
+}
+#else
+const static bool BENCH_ALLOCATIONS = false; //True if allocations are counted
+
+/*  Allocations are not counted without the counting allocator */
+static unsigned long GetAllocations()
+{
+    return 0;
+}
+#endif // BENCH_COUNT_ALLOCATIONS
+
+const static uint32_t BENCH_STUB_ADDRESS = 0x4010E000; //RAM address of dummy flasher stub
+const static size_t BENCH_STUB_SIZE = 0x100; //Size of dummy flasher stub segment
+const static uint32_t BENCH_LATENCY_REGISTER = 0x3FF00050; //Register read to measure command latency (OTP MAC0)
+
+/*  Reference SLIP encoder which handles one byte at a time
+    Used by SLIP codec microbenchmark as the baseline for SlipEncode
+*/
+static size_t NaiveSlipEncode(const unsigned char* pData, size_t nSize, unsigned char* pOutput)
+{
+    unsigned char* pOut = pOutput;
+    for(size_t nPos = 0; nPos < nSize; ++nPos)
+    {
+        if(pData[nPos] == SLIP_END)
+        {
+            *pOut++ = SLIP_ESC;
+            *pOut++ = SLIP_ESC_END;
+        }
+        else if(pData[nPos] == SLIP_ESC)
+        {
+            *pOut++ = SLIP_ESC;
+            *pOut++ = SLIP_ESC_ESC;
+        }
+        else
+            *pOut++ = pData[nPos];
+    }
+    return pOut - pOutput;
+}
+
+/*  Reference SLIP decoder which handles one byte at a time
+    Used by SLIP codec microbenchmark as the baseline for SlipDecoder. Frames are concatenated without checking.
+*/
+static size_t NaiveSlipDecode(const unsigned char* pData, size_t nSize, unsigned char* pOutput)
+{
+    unsigned char* pOut = pOutput;
+    bool bEscape = false;
+    for(size_t nPos = 0; nPos < nSize; ++nPos)
+    {
+        unsigned char cData = pData[nPos];
+        if(bEscape)
+        {
+            *pOut++ = (cData == SLIP_ESC_END) ? SLIP_END : SLIP_ESC;
+            bEscape = false;
+        }
+        else if(cData == SLIP_ESC)
+            bEscape = true;
+        else if(cData != SLIP_END)
+            *pOut++ = cData;
+    }
+    return pOut - pOutput;
+}
+
+/*  Reference checksum which handles one byte at a time
+    Used by checksum microbenchmark as the baseline for XorChecksum
+*/
+static unsigned char ByteLoopChecksum(const unsigned char* pData, size_t nSize, unsigned char nSeed)
+{
+    unsigned char nChecksum = nSeed;
+    for(size_t nPos = 0; nPos < nSize; ++nPos)
+        nChecksum ^= pData[nPos];
+    return nChecksum;
+}
+
+Benchmark::Benchmark() :
+    m_nImageSize(BENCH_IMAGE_SIZE),
+    m_vBlockSizes({0x400, 0x1000, 0x4000}),
+    m_vBauds({921600, 3000000, 0}),
+    m_vDepths({1, 2, 4}),
+    m_vCompress({false, true}),
+    m_nSimLatency(0),
+    m_bVerbose(false)
+{
+}
+
+Benchmark::~Benchmark()
+{
+}
+
+void Benchmark::MakeImages()
+{
+    //Firmware is a mix of code-like (poorly compressible) and table / padding (highly compressible) content
+    m_vImage.resize(m_nImageSize);
+    mt19937 random(1);
+    for(size_t nPos = 0; nPos < m_nImageSize; ++nPos)
+    {
+        if((nPos / 0x1000) % 2)
+            m_vImage[nPos] = random() & 0xFF;
+        else
+            m_vImage[nPos] = (nPos / 0x100) & 0x0F;
+    }
+    Compressor compressor;
+    compressor.Add(m_vImage.data(), m_vImage.size());
+    compressor.Get(m_vCompressed);
+    //Dummy stub: one segment loaded to RAM then jump to it. The simulator starts its stub on any entry point.
+    m_vStub.assign(ESP_IMAGE_HEADER_SIZE + ESP_IMAGE_SEGMENT_HEADER + BENCH_STUB_SIZE, 0);
+    m_vStub[0] = ESP_IMAGE_MAGIC;
+    m_vStub[ESP_IMAGE_SEGMENTS] = 1;
+    PutLe32(m_vStub.data() + ESP_IMAGE_ENTRY, BENCH_STUB_ADDRESS);
+    PutLe32(m_vStub.data() + ESP_IMAGE_HEADER_SIZE, BENCH_STUB_ADDRESS);
+    PutLe32(m_vStub.data() + ESP_IMAGE_HEADER_SIZE + 4, BENCH_STUB_SIZE);
+}
+
+bool Benchmark::Run()
+{
+    m_vResults.clear();
+    m_vSlipResults.clear();
+    m_vChecksumResults.clear();
+    m_vWriteResults.clear();
+    m_vLatencyResults.clear();
+    m_vRegResults.clear();
+    bool bSuccess = true;
+    for(unsigned int nEscapePercent : m_vSlipEscapes)
+    {
+        SlipBenchResult result = {};
+        result.nEscapePercent = min(nEscapePercent, 100u);
+        if(m_bVerbose)
+            cout << "SLIP benchmark " << result.nEscapePercent << "% escapes" << endl;
+        bSuccess &= RunSlip(result);
+        m_vSlipResults.push_back(result);
+    }
+    if(!m_vChecksumBlocks.empty())
+    {
+        string sKernel = XorChecksumKernel();
+        for(const string& sName : XorChecksumKernels())
+        {
+            XorChecksumSetKernel(sName);
+            for(unsigned int nBlockSize : m_vChecksumBlocks)
+            {
+                ChecksumBenchResult result = {};
+                result.sKernel = sName;
+                result.nBlockSize = max(nBlockSize, 1u);
+                if(m_bVerbose)
+                    cout << "Checksum benchmark " << sName << " block " << result.nBlockSize << endl;
+                bSuccess &= RunChecksum(result);
+                m_vChecksumResults.push_back(result);
+            }
+        }
+        XorChecksumSetKernel(sKernel);
+    }
+    if(!m_vWriteChunks.empty())
+        bSuccess &= RunWrite();
+    if(!m_vLatencyModes.empty())
+        MakeImages();
+    for(bool bLowLatency : m_vLatencyModes)
+    {
+        if(m_bVerbose)
+            cout << "Latency benchmark" << (bLowLatency ? " low latency" : "") << endl;
+        bSuccess &= RunLatency(bLowLatency);
+    }
+    if(!m_vRegCounts.empty())
+        bSuccess &= RunRegs();
+    if(!m_vSlipEscapes.empty() || !m_vChecksumBlocks.empty() || !m_vWriteChunks.empty() || !m_vLatencyModes.empty() || !m_vRegCounts.empty())
+        return bSuccess;
+    MakeImages();
+    for(unsigned int nBaud : m_vBauds)
+        for(bool bCompress : m_vCompress)
+            for(unsigned int nBlockSize : m_vBlockSizes)
+                for(unsigned int nDepth : m_vDepths)
+                {
+                    BenchResult result = {};
+                    result.nBlockSize = nBlockSize;
+                    result.nBaud = nBaud;
+                    result.bCompress = bCompress;
+                    result.nDepth = nDepth;
+                    if(m_bVerbose)
+                        cout << "Benchmark block " << nBlockSize << " baud " << nBaud << (bCompress ? " compressed" : " uncompressed") << " depth " << nDepth << endl;
+                    bSuccess &= RunOne(result);
+                    m_vResults.push_back(result);
+                }
+    return bSuccess;
+}
+
+bool Benchmark::RunOne(BenchResult& result)
+{
+    EspSimulator simulator(max(m_nImageSize, SIM_FLASH_SIZE));
+    simulator.SetBaud(result.nBaud);
+    simulator.SetLatency(m_nSimLatency);
+    if(!simulator.Open())
+        return false;
+    thread threadSimulator(&EspSimulator::Run, &simulator);
+    //Pseudo terminal ignores baud but serial port must be configured with a valid rate
+    ESP8266 esp(simulator.GetPath(), result.nBaud ? result.nBaud : 115200);
+    esp.SetSilent(true);
+    esp.SetResetSequence("none");
+    esp.GetSerial()->SetLowLatency(false);
+    bool bSuccess = esp.Open() && esp.Connect() && esp.RunStub(m_vStub);
+
+    //Command latency: time individual READ_REG round trips
+    vector<unsigned int> vLatency;
+    for(unsigned int nSample = 0; bSuccess && nSample < BENCH_LATENCY_SAMPLES; ++nSample)
+    {
+        unsigned char* pPayload = esp.GetPayload(EspReadReg::SIZE);
+        PutLe32(pPayload, BENCH_LATENCY_REGISTER);
+        chrono::steady_clock::time_point tStart = chrono::steady_clock::now();
+        bSuccess = esp.SendCommand(ESP_OP_READ_REG, pPayload, EspReadReg::SIZE);
+        vLatency.push_back(chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - tStart).count());
+    }
+    if(bSuccess)
+    {
+        sort(vLatency.begin(), vLatency.end());
+        result.nLatencyP50 = vLatency[vLatency.size() / 2];
+        result.nLatencyP99 = vLatency[vLatency.size() * 99 / 100];
+    }
+
+    //Throughput: write whole image, counting frames, system calls and allocations made by this thread
+    if(bSuccess)
+    {
+        esp.SetBlockSize(result.nBlockSize);
+        esp.SetPipelineDepth(result.nDepth);
+        Serial* pSerial = esp.GetSerial();
+        pSerial->ResetCounters();
+        unsigned long nFrames = esp.GetFramesSent();
+        unsigned long nAllocations = GetAllocations();
+        chrono::steady_clock::time_point tStart = chrono::steady_clock::now();
+        if(result.bCompress)
+            bSuccess = esp.WriteFlashDeflated(0, m_vCompressed.data(), m_vCompressed.size(), m_vImage.size());
+        else
+            bSuccess = esp.WriteFlash(0, m_vImage.data(), m_vImage.size());
+        double dSeconds = chrono::duration<double>(chrono::steady_clock::now() - tStart).count();
+        nAllocations = GetAllocations() - nAllocations;
+        nFrames = esp.GetFramesSent() - nFrames;
+        unsigned long nSyscalls = pSerial->GetWriteCalls() + pSerial->GetReadCalls() + pSerial->GetPollCalls();
+        if(bSuccess && nFrames)
+        {
+            result.dBytesPerSecond = m_vImage.size() / dSeconds;
+            result.dFramesPerSecond = nFrames / dSeconds;
+            result.dSyscallsPerFrame = (double)nSyscalls / nFrames;
+            result.dAllocsPerFrame = BENCH_ALLOCATIONS ? (double)nAllocations / nFrames : -1;
+        }
+    }
+    esp.GetSerial()->Close();
+    simulator.Stop();
+    threadSimulator.join();
+    //Success requires flash to hold the image
+    result.bSuccess = bSuccess && equal(m_vImage.begin(), m_vImage.end(), simulator.GetFlash().begin());
+    if(!result.bSuccess)
+        cerr << "Benchmark failed for block " << result.nBlockSize << " baud " << result.nBaud
+            << (result.bCompress ? " compressed" : " uncompressed") << " depth " << result.nDepth << endl;
+    return result.bSuccess;
+}
+
+bool Benchmark::RunSlip(SlipBenchResult& result)
+{
+    //Random payload with the requested proportion of special bytes, split into frames as sent to the device
+    vector<unsigned char> vPayload(BENCH_SLIP_SIZE);
+    mt19937 random(1);
+    for(size_t nPos = 0; nPos < vPayload.size(); ++nPos)
+    {
+        if(random() % 100 < result.nEscapePercent)
+            vPayload[nPos] = (random() & 1) ? SLIP_END : SLIP_ESC;
+        else
+        {
+            do
+                vPayload[nPos] = random() & 0xFF;
+            while(vPayload[nPos] == SLIP_END || vPayload[nPos] == SLIP_ESC);
+        }
+    }
+    vector<unsigned char> vEncoded(2 * vPayload.size() + 2 * (vPayload.size() / BENCH_SLIP_FRAME + 1));
+    vector<unsigned char> vNaiveEncoded(vEncoded.size());
+    vector<unsigned char> vDecoded(vPayload.size());
+    vector<unsigned char> vNaiveDecoded(vPayload.size());
+    size_t nEncoded = 0;
+    size_t nNaiveEncoded = 0;
+    size_t nDecoded = 0;
+    size_t nNaiveDecoded = 0;
+    double dEncode = 0, dNaiveEncode = 0, dDecode = 0, dNaiveDecode = 0; //Fastest pass in seconds
+    for(unsigned int nPass = 0; nPass < BENCH_SLIP_PASSES; ++nPass)
+    {
+        chrono::steady_clock::time_point tStart = chrono::steady_clock::now();
+        nEncoded = 0;
+        for(size_t nPos = 0; nPos < vPayload.size(); nPos += BENCH_SLIP_FRAME)
+        {
+            vEncoded[nEncoded++] = SLIP_END;
+            nEncoded += SlipEncode(vPayload.data() + nPos, min(BENCH_SLIP_FRAME, vPayload.size() - nPos), vEncoded.data() + nEncoded);
+            vEncoded[nEncoded++] = SLIP_END;
+        }
+        double dSeconds = chrono::duration<double>(chrono::steady_clock::now() - tStart).count();
+        dEncode = nPass ? min(dEncode, dSeconds) : dSeconds;
+
+        tStart = chrono::steady_clock::now();
+        nNaiveEncoded = 0;
+        for(size_t nPos = 0; nPos < vPayload.size(); nPos += BENCH_SLIP_FRAME)
+        {
+            vNaiveEncoded[nNaiveEncoded++] = SLIP_END;
+            nNaiveEncoded += NaiveSlipEncode(vPayload.data() + nPos, min(BENCH_SLIP_FRAME, vPayload.size() - nPos), vNaiveEncoded.data() + nNaiveEncoded);
+            vNaiveEncoded[nNaiveEncoded++] = SLIP_END;
+        }
+        dSeconds = chrono::duration<double>(chrono::steady_clock::now() - tStart).count();
+        dNaiveEncode = nPass ? min(dNaiveEncode, dSeconds) : dSeconds;
+
+        //Decode each frame into the next part of the output as the ESP8266 class does with its receive buffer
+        tStart = chrono::steady_clock::now();
+        SlipDecoder decoder;
+        nDecoded = 0;
+        decoder.SetBuffer(vDecoded.data(), vDecoded.size());
+        for(size_t nPos = 0; nPos < nEncoded;)
+        {
+            nPos += decoder.Decode(vEncoded.data() + nPos, nEncoded - nPos);
+            if(!decoder.IsComplete())
+                continue;
+            nDecoded += decoder.GetSize();
+            decoder.SetBuffer(vDecoded.data() + nDecoded, vDecoded.size() - nDecoded);
+        }
+        dSeconds = chrono::duration<double>(chrono::steady_clock::now() - tStart).count();
+        dDecode = nPass ? min(dDecode, dSeconds) : dSeconds;
+
+        tStart = chrono::steady_clock::now();
+        nNaiveDecoded = NaiveSlipDecode(vEncoded.data(), nEncoded, vNaiveDecoded.data());
+        dSeconds = chrono::duration<double>(chrono::steady_clock::now() - tStart).count();
+        dNaiveDecode = nPass ? min(dNaiveDecode, dSeconds) : dSeconds;
+    }
+    result.dEncode = vPayload.size() / dEncode;
+    result.dNaiveEncode = vPayload.size() / dNaiveEncode;
+    result.dDecode = vPayload.size() / dDecode;
+    result.dNaiveDecode = vPayload.size() / dNaiveDecode;
+    result.bSuccess = nEncoded == nNaiveEncoded && equal(vEncoded.begin(), vEncoded.begin() + nEncoded, vNaiveEncoded.begin())
+        && nDecoded == vPayload.size() && vDecoded == vPayload
+        && nNaiveDecoded == vPayload.size() && vNaiveDecoded == vPayload;
+    if(!result.bSuccess)
+        cerr << "SLIP benchmark failed for " << result.nEscapePercent << "% escapes" << endl;
+    return result.bSuccess;
+}
+
+bool Benchmark::RunChecksum(ChecksumBenchResult& result)
+{
+    vector<unsigned char> vData(BENCH_CHECKSUM_SIZE);
+    mt19937 random(1);
+    for(size_t nPos = 0; nPos < vData.size(); ++nPos)
+        vData[nPos] = random() & 0xFF;
+    size_t nBlocks = (vData.size() + result.nBlockSize - 1) / result.nBlockSize;
+    vector<unsigned char> vChecksum(nBlocks), vBlocks(nBlocks), vByteLoop(nBlocks);
+    double dChecksum = 0, dBlocks = 0, dByteLoop = 0; //Fastest pass in seconds
+    for(unsigned int nPass = 0; nPass < BENCH_CHECKSUM_PASSES; ++nPass)
+    {
+        chrono::steady_clock::time_point tStart = chrono::steady_clock::now();
+        for(size_t nBlock = 0; nBlock < nBlocks; ++nBlock)
+        {
+            size_t nStart = nBlock * result.nBlockSize;
+            vChecksum[nBlock] = XorChecksum(vData.data() + nStart, min((size_t)result.nBlockSize, vData.size() - nStart), ESP_CHECKSUM_MAGIC);
+        }
+        double dSeconds = chrono::duration<double>(chrono::steady_clock::now() - tStart).count();
+        dChecksum = nPass ? min(dChecksum, dSeconds) : dSeconds;
+
+        tStart = chrono::steady_clock::now();
+        XorChecksumBlocks(vData.data(), vData.size(), result.nBlockSize, ESP_CHECKSUM_MAGIC, vBlocks.data());
+        dSeconds = chrono::duration<double>(chrono::steady_clock::now() - tStart).count();
+        dBlocks = nPass ? min(dBlocks, dSeconds) : dSeconds;
+
+        tStart = chrono::steady_clock::now();
+        for(size_t nBlock = 0; nBlock < nBlocks; ++nBlock)
+        {
+            size_t nStart = nBlock * result.nBlockSize;
+            vByteLoop[nBlock] = ByteLoopChecksum(vData.data() + nStart, min((size_t)result.nBlockSize, vData.size() - nStart), ESP_CHECKSUM_MAGIC);
+        }
+        dSeconds = chrono::duration<double>(chrono::steady_clock::now() - tStart).count();
+        dByteLoop = nPass ? min(dByteLoop, dSeconds) : dSeconds;
+    }
+    result.dChecksum = vData.size() / dChecksum;
+    result.dBlocks = vData.size() / dBlocks;
+    result.dByteLoop = vData.size() / dByteLoop;
+    result.bSuccess = vChecksum == vByteLoop && vBlocks == vByteLoop;
+    if(!result.bSuccess)
+        cerr << "Checksum benchmark failed for " << result.sKernel << " block " << result.nBlockSize << endl;
+    return result.bSuccess;
+}
+
+bool Benchmark::RunWrite()
+{
+    int nMaster = posix_openpt(O_RDWR | O_NOCTTY);
+    if(nMaster < 0 || grantpt(nMaster) < 0 || unlockpt(nMaster) < 0)
+    {
+        cerr << "Failed to create pseudo terminal - " << strerror(errno) << endl;
+        if(nMaster >= 0)
+            close(nMaster);
+        return false;
+    }
+    Serial serial;
+    if(!serial.Open(ptsname(nMaster), 115200))
+    {
+        close(nMaster);
+        return false;
+    }
+    vector<unsigned char> vData(BENCH_WRITE_SIZE);
+    mt19937 random(1);
+    for(size_t nPos = 0; nPos < vData.size(); ++nPos)
+        vData[nPos] = random() & 0xFF;
+    bool bSuccess = true;
+    for(unsigned int nChunk : m_vWriteChunks)
+    {
+        WriteBenchResult result = {};
+        result.nChunk = max(nChunk, 1u);
+        if(m_bVerbose)
+            cout << "Write benchmark " << result.nChunk << " byte chunks" << endl;
+        //Reader drains the master side as a USB adapter drains the driver
+        vector<unsigned char> vReceived(vData.size());
+        thread threadReader([&]()
+        {
+            size_t nReceived = 0;
+            while(nReceived < vReceived.size())
+            {
+                ssize_t nRead = read(nMaster, vReceived.data() + nReceived, vReceived.size() - nReceived);
+                if(nRead <= 0)
+                    break;
+                nReceived += nRead;
+            }
+        });
+        serial.ResetCounters();
+        chrono::steady_clock::time_point tStart = chrono::steady_clock::now();
+        bool bWritten = true;
+        for(size_t nPos = 0; bWritten && nPos < vData.size(); nPos += result.nChunk)
+            bWritten = serial.Write(vData.data() + nPos, min((size_t)result.nChunk, vData.size() - nPos));
+        if(!bWritten)
+            serial.Close(); //Closing slave ends reader
+        threadReader.join();
+        double dSeconds = chrono::duration<double>(chrono::steady_clock::now() - tStart).count();
+        result.bSuccess = bWritten && serial.GetBytesWritten() == vData.size() && vReceived == vData;
+        result.dBytesPerSecond = vData.size() / dSeconds;
+        result.dCallsPerMB = serial.GetWriteCalls() * (double)0x100000 / vData.size();
+        if(!result.bSuccess)
+            cerr << "Write benchmark failed for " << result.nChunk << " byte chunks" << endl;
+        bSuccess &= result.bSuccess;
+        m_vWriteResults.push_back(result);
+    }
+    serial.Close();
+    close(nMaster);
+    return bSuccess;
+}
+
+bool Benchmark::RunLatency(bool bLowLatency)
+{
+    EspSimulator simulator;
+    simulator.SetLatency(m_nSimLatency);
+    if(!simulator.Open())
+        return false;
+    thread threadSimulator(&EspSimulator::Run, &simulator);
+    ESP8266 esp(simulator.GetPath(), 115200);
+    esp.SetSilent(true);
+    esp.SetResetSequence("none");
+    esp.GetSerial()->SetLowLatency(bLowLatency);
+    bool bSuccess = esp.Open() && esp.Connect() && esp.RunStub(m_vStub);
+    vector<string> vCommands = {"READ_REG", "WRITE_REG", "SPI_FLASH_MD5"};
+    for(size_t nCommand = 0; nCommand < vCommands.size(); ++nCommand)
+    {
+        LatencyBenchResult result = {};
+        result.bLowLatency = bLowLatency;
+        result.sCommand = vCommands[nCommand];
+        result.bSuccess = bSuccess;
+        vector<unsigned int> vLatency;
+        vector<EspRegAccess> vAccess(1);
+        vector<Md5Digest> vDigests;
+        for(unsigned int nSample = 0; result.bSuccess && nSample < BENCH_LATENCY_SAMPLES; ++nSample)
+        {
+            chrono::steady_clock::time_point tStart = chrono::steady_clock::now();
+            if(nCommand == 2)
+                result.bSuccess = esp.FlashMd5(0, ESP_FLASH_SECTOR, ESP_FLASH_SECTOR, vDigests);
+            else
+            {
+                vAccess[0] = {nCommand == 1, BENCH_LATENCY_REGISTER, nSample, 0xFFFFFFFF, 0, false};
+                result.bSuccess = esp.AccessRegs(vAccess);
+            }
+            vLatency.push_back(chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - tStart).count());
+        }
+        if(result.bSuccess)
+        {
+            sort(vLatency.begin(), vLatency.end());
+            result.nP50 = vLatency[vLatency.size() / 2];
+            result.nP99 = vLatency[vLatency.size() * 99 / 100];
+        }
+        else
+            cerr << "Latency benchmark failed for " << result.sCommand << (bLowLatency ? " low latency" : "") << endl;
+        bSuccess &= result.bSuccess;
+        m_vLatencyResults.push_back(result);
+    }
+    esp.GetSerial()->Close();
+    simulator.Stop();
+    threadSimulator.join();
+    return bSuccess;
+}
+
+bool Benchmark::RunRegs()
+{
+    EspSimulator simulator;
+    simulator.SetLatency(m_nSimLatency);
+    if(!simulator.Open())
+        return false;
+    thread threadSimulator(&EspSimulator::Run, &simulator);
+    ESP8266 esp(simulator.GetPath(), 115200);
+    esp.SetSilent(true);
+    esp.SetResetSequence("none");
+    bool bSuccess = esp.Open() && esp.Connect();
+    for(unsigned int nRegisters : m_vRegCounts)
+    {
+        RegBenchResult result = {};
+        result.nRegisters = nRegisters;
+        if(m_bVerbose)
+            cout << "Register benchmark " << nRegisters << " registers" << endl;
+        //Write a distinct value to each register so reads can be checked
+        vector<uint32_t> vAddresses, vExpected;
+        vector<EspRegAccess> vWrite;
+        for(unsigned int nRegister = 0; nRegister < nRegisters; ++nRegister)
+        {
+            vAddresses.push_back(BENCH_LATENCY_REGISTER + 4 * nRegister);
+            vExpected.push_back(0x5A000000 + nRegister);
+            vWrite.push_back({true, vAddresses.back(), vExpected.back(), 0xFFFFFFFF, 0, false});
+        }
+        result.bSuccess = bSuccess && esp.AccessRegs(vWrite);
+        vector<unsigned int> vSequential, vBatched;
+        vector<uint32_t> vValues, vValue;
+        for(unsigned int nSample = 0; result.bSuccess && nSample < BENCH_REG_SAMPLES; ++nSample)
+        {
+            //One round trip per register
+            chrono::steady_clock::time_point tStart = chrono::steady_clock::now();
+            vValues.clear();
+            for(unsigned int nRegister = 0; result.bSuccess && nRegister < nRegisters; ++nRegister)
+            {
+                result.bSuccess = esp.ReadRegs({vAddresses[nRegister]}, vValue);
+                vValues.push_back(vValue.empty() ? 0 : vValue[0]);
+            }
+            vSequential.push_back(chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - tStart).count());
+            result.bSuccess &= vValues == vExpected;
+            //All requests sent back-to-back
+            tStart = chrono::steady_clock::now();
+            result.bSuccess &= esp.ReadRegs(vAddresses, vValues);
+            vBatched.push_back(chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - tStart).count());
+            result.bSuccess &= vValues == vExpected;
+        }
+        if(result.bSuccess)
+        {
+            sort(vSequential.begin(), vSequential.end());
+            sort(vBatched.begin(), vBatched.end());
+            result.nSequential = vSequential[vSequential.size() / 2];
+            result.nBatched = vBatched[vBatched.size() / 2];
+        }
+        else
+            cerr << "Register benchmark failed for " << nRegisters << " registers" << endl;
+        bSuccess &= result.bSuccess;
+        m_vRegResults.push_back(result);
+    }
+    esp.GetSerial()->Close();
+    simulator.Stop();
+    threadSimulator.join();
+    return bSuccess;
+}
+
+void Benchmark::ShowResults()
+{
+    if(!m_vSlipResults.empty())
+    {
+        cout << "SLIP codec, " << BENCH_SLIP_SIZE << " byte payload in " << BENCH_SLIP_FRAME << " byte frames (MB/s of payload)" << endl
+            << setw(8) << "escapes" << setw(9) << "encode" << setw(9) << "naive" << setw(9) << "decode" << setw(9) << "naive" << endl;
+        for(const SlipBenchResult& result : m_vSlipResults)
+        {
+            cout << setw(7) << result.nEscapePercent << "%";
+            if(!result.bSuccess)
+            {
+                cout << "  FAILED" << endl;
+                continue;
+            }
+            cout << fixed << setprecision(0) << setw(9) << result.dEncode / 1e6 << setw(9) << result.dNaiveEncode / 1e6
+                << setw(9) << result.dDecode / 1e6 << setw(9) << result.dNaiveDecode / 1e6 << endl;
+        }
+        cout.unsetf(ios::floatfield);
+    }
+    if(!m_vChecksumResults.empty())
+    {
+        cout << "Checksum, " << BENCH_CHECKSUM_SIZE << " bytes (MB/s)" << endl
+            << setw(9) << "kernel" << setw(7) << "block" << setw(9) << "checksum" << setw(9) << "blocks" << setw(10) << "byte loop" << endl;
+        for(const ChecksumBenchResult& result : m_vChecksumResults)
+        {
+            cout << setw(9) << result.sKernel << setw(7) << result.nBlockSize;
+            if(!result.bSuccess)
+            {
+                cout << "  FAILED" << endl;
+                continue;
+            }
+            cout << fixed << setprecision(0) << setw(9) << result.dChecksum / 1e6 << setw(9) << result.dBlocks / 1e6
+                << setw(10) << result.dByteLoop / 1e6 << endl;
+        }
+        cout.unsetf(ios::floatfield);
+    }
+    if(!m_vWriteResults.empty())
+    {
+        cout << "Serial::Write to pseudo terminal, " << BENCH_WRITE_SIZE << " bytes" << endl
+            << setw(7) << "chunk" << setw(8) << "MB/s" << setw(13) << "writes/MB" << endl;
+        for(const WriteBenchResult& result : m_vWriteResults)
+        {
+            cout << setw(7) << result.nChunk;
+            if(!result.bSuccess)
+            {
+                cout << "  FAILED" << endl;
+                continue;
+            }
+            cout << fixed << setprecision(1) << setw(8) << result.dBytesPerSecond / 1e6 << setprecision(0) << setw(13) << result.dCallsPerMB << endl;
+        }
+        cout.unsetf(ios::floatfield);
+    }
+    if(!m_vLatencyResults.empty())
+    {
+        cout << "Command latency, " << m_nSimLatency << "us simulated latency (us)" << endl
+            << setw(12) << "low latency" << setw(15) << "command" << setw(8) << "p50" << setw(8) << "p99" << endl;
+        for(const LatencyBenchResult& result : m_vLatencyResults)
+        {
+            cout << setw(12) << (result.bLowLatency ? "yes" : "no") << setw(15) << result.sCommand;
+            if(!result.bSuccess)
+            {
+                cout << "  FAILED" << endl;
+                continue;
+            }
+            cout << setw(8) << result.nP50 << setw(8) << result.nP99 << endl;
+        }
+    }
+    if(!m_vRegResults.empty())
+    {
+        cout << "Register reads, " << m_nSimLatency << "us simulated latency (median us)" << endl
+            << setw(10) << "registers" << setw(11) << "sequential" << setw(9) << "batched" << setw(9) << "speed-up" << endl;
+        for(const RegBenchResult& result : m_vRegResults)
+        {
+            cout << setw(10) << result.nRegisters;
+            if(!result.bSuccess)
+            {
+                cout << "  FAILED" << endl;
+                continue;
+            }
+            cout << setw(11) << result.nSequential << setw(9) << result.nBatched
+                << fixed << setprecision(1) << setw(8) << (result.nBatched ? (double)result.nSequential / result.nBatched : 0) << "x" << endl;
+        }
+        cout.unsetf(ios::floatfield);
+    }
+    if(m_vResults.empty())
+        return;
+    cout << "Image " << m_nImageSize << " bytes (" << m_vCompressed.size() << " compressed)" << endl
+        << setw(6) << "block" << setw(9) << "baud" << setw(5) << "z" << setw(6) << "depth"
+        << setw(11) << "bytes/s" << setw(9) << "frames/s" << setw(10) << "sys/frame" << setw(12) << "alloc/frame"
+        << setw(8) << "p50 us" << setw(8) << "p99 us" << endl;
+    for(const BenchResult& result : m_vResults)
+    {
+        cout << setw(6) << result.nBlockSize << setw(9) << (result.nBaud ? to_string(result.nBaud) : string("max"))
+            << setw(5) << (result.bCompress ? "yes" : "no") << setw(6) << result.nDepth;
+        if(!result.bSuccess)
+        {
+            cout << "  FAILED" << endl;
+            continue;
+        }
+        cout << fixed << setprecision(0) << setw(11) << result.dBytesPerSecond << setw(9) << result.dFramesPerSecond
+            << setprecision(2) << setw(10) << result.dSyscallsPerFrame;
+        if(result.dAllocsPerFrame < 0)
+            cout << setw(12) << "n/a";
+        else
+            cout << setw(12) << result.dAllocsPerFrame;
+        cout << setw(8) << result.nLatencyP50 << setw(8) << result.nLatencyP99 << endl;
+    }
+    cout.unsetf(ios::floatfield);
+}
+
+bool Benchmark::WriteJson(string sFilename)
+{
+    if(sFilename == "-")
+    {
+        WriteJson(cout);
+        return cout.good();
+    }
+    ofstream fileJson(sFilename.c_str());
+    if(!fileJson)
+        return false;
+    WriteJson(fileJson);
+    return fileJson.good();
+}
+
+void Benchmark::WriteJson(ostream& output)
+{
+    output << "{\"tool\":\"ribanEspTool\",\"version\":\"" << AutoVersion::FULLVERSION_STRING << "\"";
+    if(!m_vSlipResults.empty())
+    {
+        output << ",\"slip_size\":" << BENCH_SLIP_SIZE << ",\"slip_frame\":" << BENCH_SLIP_FRAME
+            << ",\"slip_results\":[";
+        for(size_t nIndex = 0; nIndex < m_vSlipResults.size(); ++nIndex)
+        {
+            const SlipBenchResult& result = m_vSlipResults[nIndex];
+            output << (nIndex ? "," : "") << endl
+                << "{\"escape_percent\":" << result.nEscapePercent
+                << ",\"ok\":" << (result.bSuccess ? "true" : "false")
+                << fixed << setprecision(0) << ",\"encode_bytes_per_s\":" << result.dEncode << ",\"naive_encode_bytes_per_s\":" << result.dNaiveEncode
+                << ",\"decode_bytes_per_s\":" << result.dDecode << ",\"naive_decode_bytes_per_s\":" << result.dNaiveDecode << "}";
+        }
+        output.unsetf(ios::floatfield);
+        output << endl << "]";
+    }
+    if(!m_vChecksumResults.empty())
+    {
+        output << ",\"checksum_size\":" << BENCH_CHECKSUM_SIZE << ",\"checksum_results\":[";
+        for(size_t nIndex = 0; nIndex < m_vChecksumResults.size(); ++nIndex)
+        {
+            const ChecksumBenchResult& result = m_vChecksumResults[nIndex];
+            output << (nIndex ? "," : "") << endl
+                << "{\"kernel\":\"" << result.sKernel << "\",\"block_size\":" << result.nBlockSize
+                << ",\"ok\":" << (result.bSuccess ? "true" : "false")
+                << fixed << setprecision(0) << ",\"checksum_bytes_per_s\":" << result.dChecksum << ",\"blocks_bytes_per_s\":" << result.dBlocks
+                << ",\"byte_loop_bytes_per_s\":" << result.dByteLoop << "}";
+        }
+        output.unsetf(ios::floatfield);
+        output << endl << "]";
+    }
+    if(!m_vWriteResults.empty())
+    {
+        output << ",\"write_size\":" << BENCH_WRITE_SIZE << ",\"write_results\":[";
+        for(size_t nIndex = 0; nIndex < m_vWriteResults.size(); ++nIndex)
+        {
+            const WriteBenchResult& result = m_vWriteResults[nIndex];
+            output << (nIndex ? "," : "") << endl
+                << "{\"chunk\":" << result.nChunk << ",\"ok\":" << (result.bSuccess ? "true" : "false")
+                << fixed << setprecision(0) << ",\"bytes_per_s\":" << result.dBytesPerSecond
+                << setprecision(1) << ",\"write_calls_per_mb\":" << result.dCallsPerMB << "}";
+        }
+        output.unsetf(ios::floatfield);
+        output << endl << "]";
+    }
+    if(!m_vLatencyResults.empty() || !m_vRegResults.empty())
+        output << ",\"sim_latency_us\":" << m_nSimLatency;
+    if(!m_vLatencyResults.empty())
+    {
+        output << ",\"latency_results\":[";
+        for(size_t nIndex = 0; nIndex < m_vLatencyResults.size(); ++nIndex)
+        {
+            const LatencyBenchResult& result = m_vLatencyResults[nIndex];
+            output << (nIndex ? "," : "") << endl
+                << "{\"low_latency\":" << (result.bLowLatency ? "true" : "false") << ",\"command\":\"" << result.sCommand << "\""
+                << ",\"ok\":" << (result.bSuccess ? "true" : "false")
+                << ",\"latency_p50_us\":" << result.nP50 << ",\"latency_p99_us\":" << result.nP99 << "}";
+        }
+        output << endl << "]";
+    }
+    if(!m_vRegResults.empty())
+    {
+        output << ",\"reg_results\":[";
+        for(size_t nIndex = 0; nIndex < m_vRegResults.size(); ++nIndex)
+        {
+            const RegBenchResult& result = m_vRegResults[nIndex];
+            output << (nIndex ? "," : "") << endl
+                << "{\"registers\":" << result.nRegisters << ",\"ok\":" << (result.bSuccess ? "true" : "false")
+                << ",\"sequential_us\":" << result.nSequential << ",\"batched_us\":" << result.nBatched << "}";
+        }
+        output << endl << "]";
+    }
+    if(!m_vResults.empty())
+    {
+        output << ",\"image_size\":" << m_nImageSize << ",\"compressed_size\":" << m_vCompressed.size()
+            << ",\"results\":[";
+        for(size_t nIndex = 0; nIndex < m_vResults.size(); ++nIndex)
+        {
+            const BenchResult& result = m_vResults[nIndex];
+            output << (nIndex ? "," : "") << endl
+                << "{\"block_size\":" << result.nBlockSize << ",\"baud\":" << result.nBaud
+                << ",\"compress\":" << (result.bCompress ? "true" : "false") << ",\"depth\":" << result.nDepth
+                << ",\"ok\":" << (result.bSuccess ? "true" : "false")
+                << fixed << setprecision(0) << ",\"bytes_per_s\":" << result.dBytesPerSecond << ",\"frames_per_s\":" << result.dFramesPerSecond
+                << setprecision(3) << ",\"syscalls_per_frame\":" << result.dSyscallsPerFrame << ",\"allocs_per_frame\":";
+            if(result.dAllocsPerFrame < 0)
+                output << "null";
+            else
+                output << result.dAllocsPerFrame;
+            output << ",\"latency_p50_us\":" << result.nLatencyP50 << ",\"latency_p99_us\":" << result.nLatencyP99 << "}";
+        }
+        output.unsetf(ios::floatfield);
+        output << endl << "]";
+    }
+    output << "}" << endl;
+}
@@ -0,0 +1,234 @@
+/** Protocol throughput benchmark
+*   Author: agent
+*   Date: 2026-10-17
+*   License: LGPL
+*/
+
+#pragma once
+#include <string>
+#include <vector>
+#include <ostream>
+#include <cstddef> //provides size_t
+
+using namespace std;
+
+const static size_t BENCH_IMAGE_SIZE = 0x40000; //Default size of image written for each configuration (256KB)
+const static unsigned int BENCH_LATENCY_SAMPLES = 200; //Quantity of READ_REG commands timed for each configuration
+const static size_t BENCH_SLIP_SIZE = 0x400000; //Payload encoded and decoded by each pass of SLIP codec microbenchmark (4MB)
+const static size_t BENCH_SLIP_FRAME = 0x1000; //Payload of each frame in SLIP codec microbenchmark
+const static unsigned int BENCH_SLIP_PASSES = 5; //Quantity of passes of SLIP codec microbenchmark, fastest is reported
+const static size_t BENCH_CHECKSUM_SIZE = 0x400000; //Data checksummed by each pass of checksum microbenchmark (4MB)
+const static unsigned int BENCH_CHECKSUM_PASSES = 5; //Quantity of passes of checksum microbenchmark, fastest is reported
+const static size_t BENCH_WRITE_SIZE = 0x100000; //Data written to pseudo terminal for each chunk size by bulk write microbenchmark (1MB)
+const static unsigned int BENCH_REG_SAMPLES = 50; //Quantity of times each register read microbenchmark is repeated, median is reported
+
+struct BenchResult
+{
+    unsigned int nBlockSize; //Flash write block size
+    unsigned int nBaud; //Simulated line rate or zero for unlimited
+    bool bCompress; //True if image was sent compressed
+    unsigned int nDepth; //Quantity of blocks in flight
+    bool bSuccess; //True if image was written and read back correctly
+    double dBytesPerSecond; //Uncompressed image bytes written per second
+    double dFramesPerSecond; //Command frames sent per second during write
+    double dSyscallsPerFrame; //Serial read, write and poll calls per frame during write
+    double dAllocsPerFrame; //Heap allocations by the sending thread per frame during write, -1 if not counted (build with BENCH_COUNT_ALLOCATIONS)
+    unsigned int nLatencyP50; //Median READ_REG round trip in microseconds
+    unsigned int nLatencyP99; //99th percentile READ_REG round trip in microseconds
+};
+
+struct SlipBenchResult
+{
+    unsigned int nEscapePercent; //Proportion of payload bytes which need escaping
+    bool bSuccess; //True if every decoder reproduced the payload
+    double dEncode; //SlipEncode payload bytes per second
+    double dNaiveEncode; //Byte at a time encoder payload bytes per second
+    double dDecode; //SlipDecoder payload bytes per second
+    double dNaiveDecode; //Byte at a time decoder payload bytes per second
+};
+
+struct ChecksumBenchResult
+{
+    string sKernel; //Checksum implementation (see XorChecksumKernels)
+    unsigned int nBlockSize; //Size of each checksummed block
+    bool bSuccess; //True if every method gave the same checksums
+    double dChecksum; //XorChecksum called for each block, bytes per second
+    double dBlocks; //XorChecksumBlocks over whole buffer, bytes per second
+    double dByteLoop; //Byte at a time loop for each block, bytes per second
+};
+
+struct WriteBenchResult
+{
+    unsigned int nChunk; //Quantity of bytes passed to each Serial::Write call (1 is the one byte per write() of the original driver)
+    bool bSuccess; //True if the reader received all data intact
+    double dBytesPerSecond; //Bytes written per second
+    double dCallsPerMB; //write() / writev() system calls per MB
+};
+
+struct LatencyBenchResult
+{
+    bool bLowLatency; //True if serial port was tuned for low latency (see Serial::SetLowLatency)
+    string sCommand; //Command timed
+    bool bSuccess; //True if every command succeeded
+    unsigned int nP50; //Median round trip in microseconds
+    unsigned int nP99; //99th percentile round trip in microseconds
+};
+
+struct RegBenchResult
+{
+    unsigned int nRegisters; //Quantity of registers read
+    bool bSuccess; //True if both methods read the expected values
+    unsigned int nSequential; //Median time to read registers one round trip at a time in microseconds
+    unsigned int nBatched; //Median time to read registers with one ReadRegs batch in microseconds
+};
+
+class Benchmark
+{
+    public:
+        Benchmark();
+        virtual ~Benchmark();
+
+        /** @brief  Set size of image written for each configuration
+        *   @param  nSize Quantity of bytes (Default: BENCH_IMAGE_SIZE)
+        */
+        void SetImageSize(size_t nSize) {m_nImageSize = nSize;};
+
+        /** @brief  Set block sizes to sweep
+        *   @param  vBlockSizes List of flash write block sizes in bytes
+        */
+        void SetBlockSizes(const vector<unsigned int>& vBlockSizes) {m_vBlockSizes = vBlockSizes;};
+
+        /** @brief  Set bauds to sweep
+        *   @param  vBauds List of simulated line rates. Zero for unlimited rate.
+        */
+        void SetBauds(const vector<unsigned int>& vBauds) {m_vBauds = vBauds;};
+
+        /** @brief  Set pipeline depths to sweep
+        *   @param  vDepths List of quantities of blocks in flight
+        */
+        void SetDepths(const vector<unsigned int>& vDepths) {m_vDepths = vDepths;};
+
+        /** @brief  Set compression modes to sweep
+        *   @param  vCompress List of compression modes (false for uncompressed, true for compressed)
+        */
+        void SetCompression(const vector<bool>& vCompress) {m_vCompress = vCompress;};
+
+        /** @brief  Set simulated response latency
+        *   @param  nLatency Delay before simulator responds to each command in microseconds (Default: 0)
+        */
+        void SetSimLatency(unsigned int nLatency) {m_nSimLatency = nLatency;};
+
+        /** @brief  Select SLIP codec microbenchmark instead of protocol sweep
+        *   @param  vEscapePercents List of proportions of payload bytes which need escaping, 0..100. Empty to run protocol sweep.
+        */
+        void SetSlipEscapes(const vector<unsigned int>& vEscapePercents) {m_vSlipEscapes = vEscapePercents;};
+
+        /** @brief  Select checksum microbenchmark instead of protocol sweep
+        *   @param  vBlockSizes List of sizes of checksummed blocks. Empty to run protocol sweep.
+        */
+        void SetChecksumBlocks(const vector<unsigned int>& vBlockSizes) {m_vChecksumBlocks = vBlockSizes;};
+
+        /** @brief  Select bulk write microbenchmark instead of protocol sweep
+        *   @param  vChunks List of quantities of bytes passed to each Serial::Write call, 1 for the original one byte per write(). Empty to run protocol sweep.
+        */
+        void SetWriteChunks(const vector<unsigned int>& vChunks) {m_vWriteChunks = vChunks;};
+
+        /** @brief  Select command latency microbenchmark instead of protocol sweep
+        *   @param  vModes List of serial port latency modes (false for default, true for low latency). Empty to run protocol sweep.
+        */
+        void SetLatencyModes(const vector<bool>& vModes) {m_vLatencyModes = vModes;};
+
+        /** @brief  Select register read microbenchmark instead of protocol sweep
+        *   @param  vRegisters List of quantities of registers to read. Empty to run protocol sweep.
+        */
+        void SetRegCounts(const vector<unsigned int>& vRegisters) {m_vRegCounts = vRegisters;};
+
+        /** @brief  Set verbose mode
+        *   @param  bVerbose True to report progress of each configuration
+        */
+        void SetVerbose(bool bVerbose) {m_bVerbose = bVerbose;};
+
+        /** @brief  Run every combination of the configured parameters
+        *   @retval bool True if every configuration succeeded
+        *   @note   Each configuration uses a fresh simulator and ESP8266 instance so results are independent
+        *   @note   If SLIP escapes are set, times SlipEncode and SlipDecoder against byte at a time loops instead (no simulator)
+        *   @note   If checksum block sizes are set, times XorChecksum and XorChecksumBlocks against a byte at a time loop with each kernel instead (no simulator)
+        *   @note   If write chunks are set, times Serial::Write to a pseudo terminal for each chunk size instead (no simulator)
+        *   @note   If latency modes are set, times READ_REG, WRITE_REG and SPI_FLASH_MD5 round trips over the simulator in each mode instead
+        *   @note   If register counts are set, times sequential READ_REG round trips against one ReadRegs batch over the simulator instead
+        *   @note   Microbenchmarks may be combined. The protocol sweep only runs if no microbenchmark is selected.
+        */
+        bool Run();
+
+        /** @brief  Get results of last run
+        *   @retval const vector<BenchResult>& List of results in the order run
+        */
+        const vector<BenchResult>& GetResults() {return m_vResults;};
+
+        /** @brief  Get results of last SLIP codec microbenchmark
+        *   @retval const vector<SlipBenchResult>& List of results in the order run
+        */
+        const vector<SlipBenchResult>& GetSlipResults() {return m_vSlipResults;};
+
+        /** @brief  Get results of last checksum microbenchmark
+        *   @retval const vector<ChecksumBenchResult>& List of results in the order run
+        */
+        const vector<ChecksumBenchResult>& GetChecksumResults() {return m_vChecksumResults;};
+
+        /** @brief  Get results of last bulk write microbenchmark
+        *   @retval const vector<WriteBenchResult>& List of results in the order run
+        */
+        const vector<WriteBenchResult>& GetWriteResults() {return m_vWriteResults;};
+
+        /** @brief  Get results of last command latency microbenchmark
+        *   @retval const vector<LatencyBenchResult>& List of results in the order run
+        */
+        const vector<LatencyBenchResult>& GetLatencyResults() {return m_vLatencyResults;};
+
+        /** @brief  Get results of last register read microbenchmark
+        *   @retval const vector<RegBenchResult>& List of results in the order run
+        */
+        const vector<RegBenchResult>& GetRegResults() {return m_vRegResults;};
+
+        /** @brief  Print results as a table to stdout
+        */
+        void ShowResults();
+
+        /** @brief  Write results as JSON
+        *   @param  sFilename Name of file or "-" for stdout
+        *   @retval bool True on success
+        */
+        bool WriteJson(string sFilename);
+
+    private:
+        bool RunOne(BenchResult& result); // Run a single configuration, populating result
+        bool RunSlip(SlipBenchResult& result); // Time SLIP codec for one escape density, populating result
+        bool RunChecksum(ChecksumBenchResult& result); // Time checksum methods for one kernel and block size, populating result
+        bool RunWrite(); // Time writes to a pseudo terminal for each chunk size, populating m_vWriteResults
+        bool RunLatency(bool bLowLatency); // Time each command in one serial latency mode, populating m_vLatencyResults
+        bool RunRegs(); // Time sequential and batched register reads for each register count, populating m_vRegResults
+        void MakeImages(); // Create test image, its compressed form and flasher stub
+        void WriteJson(ostream& output); // Write results as JSON to stream
+
+        size_t m_nImageSize; //Size of test image
+        vector<unsigned int> m_vBlockSizes; //Block sizes to sweep
+        vector<unsigned int> m_vBauds; //Bauds to sweep
+        vector<unsigned int> m_vDepths; //Pipeline depths to sweep
+        vector<bool> m_vCompress; //Compression modes to sweep
+        unsigned int m_nSimLatency; //Simulated response latency in microseconds
+        vector<unsigned int> m_vSlipEscapes; //Escape densities for SLIP codec microbenchmark
+        vector<unsigned int> m_vChecksumBlocks; //Block sizes for checksum microbenchmark
+        vector<unsigned int> m_vWriteChunks; //Chunk sizes for bulk write microbenchmark
+        vector<bool> m_vLatencyModes; //Serial latency modes for command latency microbenchmark
+        vector<unsigned int> m_vRegCounts; //Register counts for register read microbenchmark
+        bool m_bVerbose; //True for progress output
+        vector<unsigned char> m_vImage; //Test image
+        vector<unsigned char> m_vCompressed; //Test image deflated
+        vector<unsigned char> m_vStub; //Flasher stub image which starts simulated stub
+        vector<BenchResult> m_vResults; //Results of last run
+        vector<SlipBenchResult> m_vSlipResults; //Results of last SLIP codec microbenchmark
+        vector<ChecksumBenchResult> m_vChecksumResults; //Results of last checksum microbenchmark
+        vector<WriteBenchResult> m_vWriteResults; //Results of last bulk write microbenchmark
+        vector<LatencyBenchResult> m_vLatencyResults; //Results of last command latency microbenchmark
+        vector<RegBenchResult> m_vRegResults; //Results of last register read microbenchmark
+};
@@ -0,0 +1,138 @@
+#include "checksum.h"
+#include <string.h> //provides memcpy
+#include <stdint.h> //provides fixed width integers
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CHECKSUM_X86
+#include <immintrin.h> //provides SSE2 / AVX2 intrinsics
+#endif // x86
+
+typedef unsigned char (*XorKernel)(const unsigned char*, size_t);
+
+/*  Fold the bytes of a 64-bit word into a single byte by XOR */
+static inline unsigned char Fold(uint64_t nWord)
+{
+    nWord ^= nWord >> 32;
+    nWord ^= nWord >> 16;
+    nWord ^= nWord >> 8;
+    return nWord & 0xFF;
+}
+
+static unsigned char XorPortable(const unsigned char* pData, size_t nSize)
+{
+    uint64_t nAccumulator = 0;
+    size_t nIndex = 0;
+    for(; nIndex + 8 <= nSize; nIndex += 8)
+    {
+        uint64_t nWord;
+        memcpy(&nWord, pData + nIndex, 8);
+        nAccumulator ^= nWord;
+    }
+    unsigned char nResult = Fold(nAccumulator);
+    for(; nIndex < nSize; ++nIndex)
+        nResult ^= pData[nIndex];
+    return nResult;
+}
+
+#ifdef CHECKSUM_X86
+__attribute__((target("sse2")))
+static unsigned char XorSse2(const unsigned char* pData, size_t nSize)
+{
+    __m128i vAccumulator0 = _mm_setzero_si128();
+    __m128i vAccumulator1 = _mm_setzero_si128();
+    size_t nIndex = 0;
+    for(; nIndex + 32 <= nSize; nIndex += 32)
+    {
+        vAccumulator0 = _mm_xor_si128(vAccumulator0, _mm_loadu_si128(reinterpret_cast<const __m128i*>(pData + nIndex)));
+        vAccumulator1 = _mm_xor_si128(vAccumulator1, _mm_loadu_si128(reinterpret_cast<const __m128i*>(pData + nIndex + 16)));
+    }
+    uint64_t aWords[2];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(aWords), _mm_xor_si128(vAccumulator0, vAccumulator1));
+    return Fold(aWords[0] ^ aWords[1]) ^ XorPortable(pData + nIndex, nSize - nIndex);
+}
+
+__attribute__((target("avx2")))
+static unsigned char XorAvx2(const unsigned char* pData, size_t nSize)
+{
+    __m256i vAccumulator0 = _mm256_setzero_si256();
+    __m256i vAccumulator1 = _mm256_setzero_si256();
+    size_t nIndex = 0;
+    for(; nIndex + 64 <= nSize; nIndex += 64)
+    {
+        vAccumulator0 = _mm256_xor_si256(vAccumulator0, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pData + nIndex)));
+        vAccumulator1 = _mm256_xor_si256(vAccumulator1, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pData + nIndex + 32)));
+    }
+    uint64_t aWords[4];
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(aWords), _mm256_xor_si256(vAccumulator0, vAccumulator1));
+    return Fold(aWords[0] ^ aWords[1] ^ aWords[2] ^ aWords[3]) ^ XorPortable(pData + nIndex, nSize - nIndex);
+}
+#endif // CHECKSUM_X86
+
+/*  Checksum kernel with its name for reporting */
+struct KernelSelection
+{
+    XorKernel pKernel;
+    const char* pName;
+};
+
+/*  Get kernels supported by this CPU, fastest first */
+static vector<KernelSelection> GetKernels()
+{
+    vector<KernelSelection> vKernels;
+#ifdef CHECKSUM_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2"))
+        vKernels.push_back({XorAvx2, "avx2"});
+    if(__builtin_cpu_supports("sse2"))
+        vKernels.push_back({XorSse2, "sse2"});
+#endif // CHECKSUM_X86
+    vKernels.push_back({XorPortable, "portable"});
+    return vKernels;
+}
+
+/*  Get kernel selected for this CPU. Initialised once with the fastest kernel - initialisation of the local static is thread safe. */
+static KernelSelection& GetSelection()
+{
+    static KernelSelection selection = GetKernels().front();
+    return selection;
+}
+
+unsigned char XorChecksum(const unsigned char* pData, size_t nSize, unsigned char nSeed)
+{
+    return nSeed ^ GetSelection().pKernel(pData, nSize);
+}
+
+void XorChecksumBlocks(const unsigned char* pData, size_t nSize, size_t nBlockSize, unsigned char nSeed, unsigned char* pChecksums)
+{
+    XorKernel pKernel = GetSelection().pKernel;
+    for(size_t nOffset = 0; nOffset < nSize; nOffset += nBlockSize)
+    {
+        size_t nBlock = (nSize - nOffset < nBlockSize) ? nSize - nOffset : nBlockSize;
+        *pChecksums++ = nSeed ^ pKernel(pData + nOffset, nBlock);
+    }
+}
+
+const char* XorChecksumKernel()
+{
+    return GetSelection().pName;
+}
+
+vector<string> XorChecksumKernels()
+{
+    vector<string> vNames;
+    for(const KernelSelection& kernel : GetKernels())
+        vNames.push_back(kernel.pName);
+    return vNames;
+}
+
+bool XorChecksumSetKernel(string sName)
+{
+    for(const KernelSelection& kernel : GetKernels())
+    {
+        if(sName != kernel.pName)
+            continue;
+        GetSelection() = kernel;
+        return true;
+    }
+    return false;
+}
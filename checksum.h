@@ -0,0 +1,46 @@
+/** ESP8266 ROM loader data checksum
+*   Author: agent
+*   Date: 2026-10-17
+*   License: LGPL
+*/
+
+#pragma once
+#include <cstddef> //provides size_t
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/** @brief  Calculate XOR checksum of a block of data
+*   @param  pData Pointer to data
+*   @param  nSize Quantity of bytes in data
+*   @param  nSeed Initial checksum value
+*   @retval unsigned char Checksum
+*/
+unsigned char XorChecksum(const unsigned char* pData, size_t nSize, unsigned char nSeed);
+
+/** @brief  Calculate XOR checksum of each block within a larger buffer in a single pass
+*   @param  pData Pointer to data, e.g. a memory mapped firmware image
+*   @param  nSize Quantity of bytes in data
+*   @param  nBlockSize Size of each block. Last block may be shorter.
+*   @param  nSeed Initial checksum value of each block
+*   @param  pChecksums Pointer to buffer to populate with one checksum per block - must hold (nSize + nBlockSize - 1) / nBlockSize bytes
+*/
+void XorChecksumBlocks(const unsigned char* pData, size_t nSize, size_t nBlockSize, unsigned char nSeed, unsigned char* pChecksums);
+
+/** @brief  Get the name of the checksum implementation selected for this CPU
+*   @retval const char* Name of implementation (avx2|sse2|portable)
+*/
+const char* XorChecksumKernel();
+
+/** @brief  Get the names of the checksum implementations supported by this CPU
+*   @retval vector<string> Names of implementations, fastest first
+*/
+vector<string> XorChecksumKernels();
+
+/** @brief  Select checksum implementation, e.g. to compare them
+*   @param  sName Name of implementation (see XorChecksumKernels)
+*   @retval bool True if implementation is supported by this CPU
+*   @note   Not thread safe. Only for benchmarking, before other threads calculate checksums.
+*/
+bool XorChecksumSetKernel(string sName);
@@ -0,0 +1,128 @@
+#include "compressor.h"
+#include <zlib.h> //provides deflate compression
+#include <algorithm> //provides min
+
+Compressor::Compressor() :
+    m_nNext(0),
+    m_bStop(false)
+{
+}
+
+Compressor::~Compressor()
+{
+    if(!m_thread.joinable())
+        return;
+    {
+        lock_guard<mutex> lock(m_mutex);
+        m_bStop = true;
+    }
+    m_condition.notify_all();
+    m_thread.join();
+}
+
+void Compressor::Add(const unsigned char* pData, size_t nSize)
+{
+    {
+        lock_guard<mutex> lock(m_mutex);
+        m_qJobs.push_back(Job());
+        Job& job = m_qJobs.back();
+        job.pData = pData;
+        job.nSize = nSize;
+        job.vOutput.resize(GetBound(nSize));
+        job.nCompressed = 0;
+        job.bDone = false;
+        job.bSuccess = false;
+    }
+    if(!m_thread.joinable())
+        m_thread = thread(&Compressor::Run, this);
+    m_condition.notify_all();
+}
+
+bool Compressor::Get(vector<unsigned char>& vOutput)
+{
+    unique_lock<mutex> lock(m_mutex);
+    if(m_qJobs.empty())
+        return false;
+    m_condition.wait(lock, [this]{return m_qJobs.front().bDone;});
+    bool bSuccess = m_qJobs.front().bSuccess;
+    vOutput.swap(m_qJobs.front().vOutput);
+    vOutput.resize(m_qJobs.front().nCompressed);
+    m_qJobs.pop_front();
+    --m_nNext;
+    return bSuccess;
+}
+
+const unsigned char* Compressor::Wait(size_t nSize, size_t& nAvailable, bool& bComplete)
+{
+    unique_lock<mutex> lock(m_mutex);
+    nAvailable = 0;
+    bComplete = true;
+    if(m_qJobs.empty())
+        return NULL;
+    Job& job = m_qJobs.front();
+    m_condition.wait(lock, [&job, nSize]{return job.bDone || job.nCompressed >= nSize;});
+    nAvailable = job.nCompressed;
+    bComplete = job.bDone;
+    if(job.bDone && !job.bSuccess)
+        return NULL;
+    return job.vOutput.data();
+}
+
+size_t Compressor::Next()
+{
+    unique_lock<mutex> lock(m_mutex);
+    if(m_qJobs.empty())
+        return 0;
+    m_condition.wait(lock, [this]{return m_qJobs.front().bDone;});
+    size_t nCompressed = m_qJobs.front().nCompressed;
+    m_qJobs.pop_front();
+    --m_nNext;
+    return nCompressed;
+}
+
+size_t Compressor::GetBound(size_t nSize)
+{
+    //Each sync flush may add an empty stored block (4 bytes) after up to 7 bits of padding
+    return compressBound(nSize) + 5 * (nSize / COMPRESS_CHUNK + 1);
+}
+
+void Compressor::Run()
+{
+    unique_lock<mutex> lock(m_mutex);
+    while(true)
+    {
+        m_condition.wait(lock, [this]{return m_bStop || m_nNext < m_qJobs.size();});
+        if(m_bStop)
+            return;
+        //Deque elements are not moved by push_back / pop_front and output is not resized so job remains valid while unlocked
+        Job& job = m_qJobs[m_nNext];
+        lock.unlock();
+        z_stream zStream = {};
+        bool bSuccess = (deflateInit(&zStream, Z_BEST_COMPRESSION) == Z_OK);
+        zStream.next_out = job.vOutput.data();
+        zStream.avail_out = job.vOutput.size();
+        for(size_t nOffset = 0; bSuccess;)
+        {
+            size_t nChunk = min(COMPRESS_CHUNK, job.nSize - nOffset);
+            bool bLast = (nOffset + nChunk == job.nSize);
+            zStream.next_in = const_cast<unsigned char*>(job.pData + nOffset);
+            zStream.avail_in = nChunk;
+            int nResult = deflate(&zStream, bLast ? Z_FINISH : Z_SYNC_FLUSH);
+            //Output is large enough for the whole image so each call consumes its chunk
+            bSuccess = (nResult == (bLast ? Z_STREAM_END : Z_OK)) && zStream.avail_in == 0;
+            nOffset += nChunk;
+            lock.lock();
+            job.nCompressed = zStream.total_out;
+            lock.unlock();
+            m_condition.notify_all();
+            if(bLast)
+                break;
+        }
+        deflateEnd(&zStream);
+        lock.lock();
+        job.bSuccess = bSuccess;
+        job.bDone = true;
+        ++m_nNext;
+        m_condition.notify_all();
+    }
+}
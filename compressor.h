@@ -0,0 +1,75 @@
+/** Background image compressor
+*   Author: agent
+*   Date: 2026-10-17
+*   License: LGPL
+*/
+
+#pragma once
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstddef> //provides size_t
+
+using namespace std;
+
+const static size_t COMPRESS_CHUNK = 0x4000; //Quantity of bytes deflated before compressed data is made available to the sender
+
+class Compressor
+{
+    public:
+        Compressor();
+        virtual ~Compressor();
+
+        /** @brief  Queue an image for compression
+        *   @param  pData Pointer to image data which must remain valid until its result is collected
+        *   @param  nSize Quantity of bytes in image
+        *   @note   Images are compressed in the order they are added. The worker thread is started by the first image.
+        */
+        void Add(const unsigned char* pData, size_t nSize);
+
+        /** @brief  Get the next compressed image, waiting for compression to complete if necessary
+        *   @param  vOutput Vector to populate with compressed image
+        *   @retval bool True on success. False if compression failed or no images queued.
+        */
+        bool Get(vector<unsigned char>& vOutput);
+
+        /** @brief  Wait for compressed data of the oldest queued image
+        *   @param  nSize Quantity of compressed bytes required
+        *   @param  nAvailable Populated with quantity of compressed bytes available, at least nSize unless compression of the image is complete
+        *   @param  bComplete Populated with true if compression of the image is complete
+        *   @retval const unsigned char* Pointer to compressed data, valid until Next() is called. NULL if compression failed or no images queued.
+        *   @note   Data already available does not move whilst the rest of the image is compressed
+        */
+        const unsigned char* Wait(size_t nSize, size_t& nAvailable, bool& bComplete);
+
+        /** @brief  Discard the oldest queued image, waiting for its compression to complete if necessary
+        *   @retval size_t Quantity of compressed bytes of discarded image
+        */
+        size_t Next();
+
+        /** @brief  Get maximum size of compressed image
+        *   @param  nSize Quantity of bytes in image
+        *   @retval size_t Maximum quantity of compressed bytes, allowing for chunk flushes
+        */
+        static size_t GetBound(size_t nSize);
+
+    private:
+        struct Job
+        {
+            const unsigned char* pData; //Uncompressed image
+            size_t nSize; //Size of uncompressed image
+            vector<unsigned char> vOutput; //Compressed image, sized to GetBound so it is not reallocated whilst compressing
+            size_t nCompressed; //Quantity of compressed bytes available
+            bool bDone; //True when compression complete
+            bool bSuccess; //True if compression succeeded
+        };
+        void Run(); // Worker thread
+        deque<Job> m_qJobs; //Queue of images, oldest first
+        size_t m_nNext; //Index of next job for worker
+        bool m_bStop; //True to stop worker
+        mutex m_mutex; //Protects job queue
+        condition_variable m_condition; //Signals change to job queue
+        thread m_thread; //Worker thread, started by first Add
+};
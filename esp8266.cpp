@@ -1,21 +1,52 @@
 #include "esp8266.h"
+#include "compressor.h"
+#include "checksum.h"
 #include <iostream>
 #include <unistd.h> //provides usleep
+#include <chrono> //provides steady clock for response deadlines
+#include <algorithm> //provides min, max, fill
+#include <cstdio> //provides snprintf
 
 ESP8266::ESP8266(string sPort, unsigned int nBaud) :
     m_bConnected(false),
+    m_bStub(false),
+    m_nConnectBaud(nBaud),
+    m_nLinkCheck(0),
+    m_nLinkErrors(0),
+    m_nLinkCommands(0),
+    m_nBlockSize(0),
+    m_nPipelineDepth(0),
+    m_nFramesSent(0),
+    m_nConnectTime(0),
+    m_nSyncFrames(0),
+    m_bSyncDrain(false),
     m_bVerbose(false),
-    m_bSilent(false)
+    m_bSilent(false),
+    m_nTxFrameSize(0),
+    m_nTxOperation(ESP_OP_NONE),
+    m_nTxEscaped(0),
+    m_pStats(NULL),
+    m_vResponse(ESP_MAX_FRAME),
+    m_nResponseSize(0)
 {
+    GetPayload(ESP_MAX_PAYLOAD); //Preallocate frame buffers
     m_pSerial = new Serial();
     m_pSerial->SetPort(sPort);
     m_pSerial->SetBaud(nBaud);
+    SetResetSequence("classic");
 }
 
 ESP8266::~ESP8266()
 {
     m_pSerial->Close();
     delete m_pSerial;
+    delete m_pStats;
+}
+
+void ESP8266::EnableStats(bool bEnable)
+{
+    delete m_pStats;
+    m_pStats = bEnable ? new EspStats() : NULL;
 }
 
 bool ESP8266::Open()
@@ -29,242 +60,1106 @@ bool ESP8266::Reset(bool bFlash)
         ___ ___
        |DTR|RTS||RST|GP0|ACTION|
        | 0 | 0 || 1 | 1 |RUN   |
-       | 0 | 1 || 1 | 0 |FLASH |
-       | 1 | 0 || 0 | 1 |RESET |
+       | 0 | 1 || 0 | 1 |RESET |
+       | 1 | 0 || 1 | 0 |FLASH |
        | 1 | 1 || 1 | 1 |RUN   |
     */
     if(m_bVerbose)
         cout << "Reseting ESP" << endl;
     if(!(m_pSerial->IsOpen() || m_pSerial->Open()))
         return false;
-    //Reset !DTR=0 !RTS=1
-    m_pSerial->SetDtr(false);
-    m_pSerial->SetRts(true);
-    usleep(50000);
-    //Flash mode !DTR=1 !RTS=0
-    m_pSerial->SetDtr(bFlash);
-    m_pSerial->SetRts(false);
-    usleep(50000);
-    //Run mode DTR=1 RTS=1 (or DTR=0 RTS=0)
-    m_pSerial->SetDtr(false);
+    const vector<EspResetStep>& vSteps = bFlash ? m_vResetFlash : m_vResetRun;
+    chrono::steady_clock::time_point tStart = chrono::steady_clock::now();
+    for(auto it = vSteps.begin(); it != vSteps.end(); ++it)
+    {
+        switch(it->cType)
+        {
+            case 'U':
+                m_pSerial->SetModemLines(it->bDtr, it->bRts);
+                break;
+            case 'D':
+                m_pSerial->SetDtr(it->bDtr);
+                break;
+            case 'R':
+                m_pSerial->SetRts(it->bRts);
+                break;
+            case 'W':
+                usleep(it->nWait);
+                break;
+        }
+    }
+    if(m_bVerbose && !vSteps.empty())
+        cout << "Reset sequence " << m_sReset << (bFlash ? " (flash)" : " (run)") << " took "
+            << chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - tStart).count() / 1000.0 << "ms" << endl;
     return true;
 }
 
-bool ESP8266::Sync()
-{
-    bool bSuccess = true;
-    vector<unsigned char> vBuffer;
-    vBuffer.resize(36);
-    vBuffer[0] = 0x07;
-    vBuffer[1] = 0x07;
-    vBuffer[2] = 0x12;
-    vBuffer[3] = 0x20;
-    for(int nPos = 0; nPos < 32; ++nPos)
-        vBuffer[nPos + 4] = 0x55;
-    SendCommand(ESP_OP_SYNC, vBuffer, 0);
-    vBuffer.clear();
-    for(int nCycle = 0; nCycle < 7; ++nCycle)
-        bSuccess &= SendCommand(ESP_OP_NONE, vBuffer);
-    return bSuccess;
+bool ESP8266::SetResetSequence(string sSequence)
+{
+    string sFlash = sSequence;
+    string sRun = ESP_RESET_CLASSIC_RUN;
+    if(sSequence.compare("classic") == 0)
+        sFlash = ESP_RESET_CLASSIC;
+    else if(sSequence.compare("usb_jtag") == 0)
+    {
+        sFlash = ESP_RESET_USB_JTAG;
+        sRun = ESP_RESET_USB_JTAG_RUN;
+    }
+    else if(sSequence.compare("none") == 0)
+        sFlash = sRun = ""; //Target already in required mode or has no reset circuit
+    vector<EspResetStep> vFlash, vRun;
+    if(!ParseResetSequence(sFlash, vFlash) || !ParseResetSequence(sRun, vRun))
+    {
+        if(!m_bSilent)
+            cerr << "Invalid reset sequence: " << sSequence << endl;
+        return false;
+    }
+    m_vResetFlash.swap(vFlash);
+    m_vResetRun.swap(vRun);
+    m_sReset = sSequence;
+    return true;
 }
 
-bool ESP8266::Connect()
+bool ESP8266::ParseResetSequence(const string& sSequence, vector<EspResetStep>& vSteps)
 {
-    m_bConnected = false;
-    if(m_bVerbose)
-        cout << "Connecting to ESP8266..." << endl;
-    //!@todo Set appropriate number of reset and sync attempts
-    for(int nAttempt = 0; nAttempt < 4; ++nAttempt)
+    vSteps.clear();
+    size_t nStart = 0;
+    while(nStart < sSequence.length())
     {
-        Reset(true); //Hardware reset to flash mode
-        // worst-case latency timer should be 255ms (probably <20ms)
-        usleep(255000);
-        for(int nTry = 0; nTry < 4; ++nTry)
+        size_t nEnd = sSequence.find('|', nStart);
+        if(nEnd == string::npos)
+            nEnd = sSequence.length();
+        string sStep = sSequence.substr(nStart, nEnd - nStart);
+        nStart = nEnd + 1;
+        if(sStep.length() < 2)
+            return false;
+        EspResetStep step = {sStep[0], false, false, 0};
+        string sValue = sStep.substr(1);
+        switch(step.cType)
+        {
+            case 'U':
+                if(sValue.length() != 3 || sValue[1] != ',')
+                    return false;
+                step.bDtr = (sValue[0] == '1');
+                step.bRts = (sValue[2] == '1');
+                if((sValue[0] != '0' && !step.bDtr) || (sValue[2] != '0' && !step.bRts))
+                    return false;
+                break;
+            case 'D':
+            case 'R':
+                if(sValue.compare("0") != 0 && sValue.compare("1") != 0)
+                    return false;
+                step.bDtr = step.bRts = (sValue[0] == '1');
+                break;
+            case 'W':
+                try
+                {
+                    size_t nParsed;
+                    double dWait = stod(sValue, &nParsed);
+                    if(nParsed != sValue.length() || dWait < 0 || dWait > 10)
+                        return false;
+                    step.nWait = dWait * 1000000 + 0.5; //Round so formatting the steps gives back the same sequence
+                } catch(const std::exception& e)
+                {
+                    return false;
+                }
+                break;
+            default:
+                return false;
+        }
+        vSteps.push_back(step);
+    }
+    return true;
+}
+
+string ESP8266::FormatResetSequence(const vector<EspResetStep>& vSteps)
+{
+    string sSequence;
+    for(auto it = vSteps.begin(); it != vSteps.end(); ++it)
+    {
+        if(!sSequence.empty())
+            sSequence += "|";
+        sSequence += it->cType;
+        switch(it->cType)
         {
-            m_pSerial->Flush();
-            if(Sync())
+            case 'U':
+                sSequence += string(it->bDtr ? "1" : "0") + (it->bRts ? ",1" : ",0");
+                break;
+            case 'D':
+                sSequence += it->bDtr ? "1" : "0";
+                break;
+            case 'R':
+                sSequence += it->bRts ? "1" : "0";
+                break;
+            case 'W':
             {
-                m_bConnected = true;
-                return true;
+                char sWait[16];
+                snprintf(sWait, sizeof(sWait), "%.6f", it->nWait / 1000000.0);
+                string sValue = sWait;
+                sValue.erase(sValue.find_last_not_of('0') + 1); //Trim trailing zeros but leave at least "0."
+                if(sValue.back() == '.')
+                    sValue += '0';
+                sSequence += sValue;
+                break;
             }
         }
     }
-    return false;
+    return sSequence;
 }
 
-int ESP8266::Checksum(int *pData, unsigned int nSize, int nChecksum)
-{
-    int nCalcChecksum = nChecksum;
-    for(unsigned int nIndex = 0; nIndex < nSize; ++nIndex)
-        nChecksum ^= pData[nIndex];
-    return nCalcChecksum;
-}
-
-bool ESP8266::SlipRead(vector<unsigned char>& vBuffer)
-{
-    /*
-        Get data from serial
-        Check for header 0xc0
-            return false if not found
-            remove header
-        Iterate through data
-            Check for start of escape sequence 0xdb
-                set escape sequence flag
-                remove start of escape sequence byte
-            If within escape sequence
-                replace 0xdc with 0xc0
-                replace 0xdd with 0xdb
-                else report invalid slip sequence and return false
-                clear escape sequence flag
-            Check for footer 0xc0
-                return result
-    */
-    bool bInEscapeSeq = false;
-    m_pSerial->Read(vBuffer); //!@todo ADD TIMEOUT - gets stuck here
-    if(vBuffer.size() == 0 || vBuffer[0] != 0xc0)
-        return false; //!@todo Should we search for header rather than expect it to be first data element?
-    //!@todo add serial read timeout
-    for(vector<unsigned char>::iterator it = vBuffer.begin(); it != vBuffer.end(); ++it)
-    {
-        if(bInEscapeSeq)
+bool ESP8266::TryResetScale(const vector<EspResetStep>& vFull, unsigned int nScale)
+{
+    m_vResetFlash = vFull;
+    for(auto it = m_vResetFlash.begin(); it != m_vResetFlash.end(); ++it)
+        it->nWait = (unsigned long long)it->nWait * nScale / 1000;
+    for(int nTry = 0; nTry < ESP_CALIBRATE_TRIES; ++nTry)
+    {
+        m_bSyncDrain = false;
+        Reset(true);
+        m_pSerial->Flush(SERIAL_INPUT); //Discard boot messages
+        if(!Sync(ESP_CONNECT_WINDOW))
         {
-            bInEscapeSeq = false;
-            if(*it == 0xdc)
-                *it = 0xc0;
-            else if(*it == 0xdd)
-                *it = 0xdb;
+            if(m_bVerbose)
+                cout << "Holds at " << nScale / 10.0 << "% failed to connect on try " << nTry + 1 << endl;
+            return false;
+        }
+    }
+    if(m_bVerbose)
+        cout << "Holds at " << nScale / 10.0 << "% connected " << ESP_CALIBRATE_TRIES << " times" << endl;
+    return true;
+}
+
+bool ESP8266::CalibrateReset(string& sMinimum, unsigned int& nHold)
+{
+    m_bConnected = false;
+    m_bStub = false;
+    if(m_pSerial->GetBaud() != m_nConnectBaud)
+        m_pSerial->SetBaud(m_nConnectBaud);
+    vector<EspResetStep> vFull = m_vResetFlash;
+    //Bisect between shortest scale known to connect and longest known to fail
+    unsigned int nPass = 1000;
+    unsigned int nFail = 0;
+    bool bSuccess = TryResetScale(vFull, nPass);
+    if(bSuccess && !TryResetScale(vFull, 0))
+    {
+        for(int nStep = 0; nStep < ESP_CALIBRATE_STEPS && nPass - nFail > 1; ++nStep)
+        {
+            unsigned int nScale = (nPass + nFail) / 2;
+            if(TryResetScale(vFull, nScale))
+                nPass = nScale;
             else
-            {
-                if(!m_bSilent)
-                    cerr << "Invalid SLIP escape 0xdb " << "0x" << hex << *it << endl;
-                return false;
-            }
+                nFail = nScale;
         }
-        else if(*it == 0xdb)
+    }
+    else if(bSuccess)
+        nPass = 0; //Connects without any holds
+    if(bSuccess)
+    {
+        vector<EspResetStep> vMinimum = vFull;
+        nHold = 0;
+        for(auto it = vMinimum.begin(); it != vMinimum.end(); ++it)
         {
-            bInEscapeSeq = true;
-            vBuffer.erase(it);
+            it->nWait = (unsigned long long)it->nWait * nPass / 1000;
+            nHold += it->nWait;
         }
-        else if(*it == 0xc0)
+        sMinimum = FormatResetSequence(vMinimum);
+    }
+    else if(!m_bSilent)
+        cerr << "Reset sequence " << m_sReset << " does not connect with its full holds" << endl;
+    m_vResetFlash.swap(vFull);
+    m_bSyncDrain = false;
+    Reset();
+    return bSuccess;
+}
+
+bool ESP8266::Sync(int nWindow)
+{
+    chrono::steady_clock::time_point tDeadline = chrono::steady_clock::now() + chrono::milliseconds(nWindow);
+    BuildCommand(EspSync());
+    //Allow for sync frame and first response (12 bytes) to cross the wire at 10 bits per byte
+    int nInterval = EspSync::TIMEOUT + (int)((m_nTxFrameSize + 12) * 10000 / m_pSerial->GetActualBaud());
+    while(chrono::steady_clock::now() < tDeadline)
+    {
+        if(m_pStats)
+            m_pStats->Restart(); //Measure from the sync frame that gets the response
+        if(!SendFrame())
+            return false;
+        ++m_nSyncFrames;
+        chrono::steady_clock::time_point tNext = min(chrono::steady_clock::now() + chrono::milliseconds(nInterval), tDeadline);
+        int nWait;
+        while((nWait = chrono::duration_cast<chrono::milliseconds>(tNext - chrono::steady_clock::now()).count()) >= 0 && SlipRead(nWait))
         {
-            vBuffer.erase(it, vBuffer.end());
+            if(m_nResponseSize >= ESP_HEADER_SIZE && m_vResponse[ESP_HEADER_MSG_TYPE] == ESP_MSGTYPE_RESPONSE
+                && m_vResponse[ESP_HEADER_OP] == ESP_OP_SYNC && CheckStatus(ESP_OP_SYNC, EspSync::RESPONSE_SIZE))
+            {
+                m_bSyncDrain = true; //Remaining responses are discarded as they arrive
+                if(m_pStats)
+                    m_pStats->Response(ESP_OP_SYNC);
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+bool ESP8266::Connect()
+{
+    m_bConnected = false;
+    m_bStub = false; //Reset returns to ROM loader
+    m_bSyncDrain = false;
+    m_nSyncFrames = 0;
+    if(m_pSerial->GetBaud() != m_nConnectBaud)
+        m_pSerial->SetBaud(m_nConnectBaud);
+    if(m_bVerbose)
+        cout << "Connecting to ESP8266..." << endl;
+    chrono::steady_clock::time_point tStart = chrono::steady_clock::now();
+    for(int nAttempt = 0; nAttempt < ESP_CONNECT_ATTEMPTS; ++nAttempt)
+    {
+        Reset(true); //Hardware reset to flash mode
+        m_pSerial->Flush(SERIAL_INPUT); //Discard boot messages
+        //Sync from reset rather than waiting for worst-case boot and USB latency
+        if(Sync(ESP_CONNECT_WINDOW))
+        {
+            m_nConnectTime = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - tStart).count();
+            m_bConnected = true;
+            if(m_bVerbose)
+                cout << "Connected in " << m_nConnectTime << "ms (reset " << nAttempt + 1 << ", " << m_nSyncFrames << " sync frames)" << endl;
             return true;
         }
     }
-    return false; //Didn't sequence terminator
+    if(m_bVerbose)
+        cerr << "Failed to connect after " << ESP_CONNECT_ATTEMPTS << " resets and " << m_nSyncFrames << " sync frames" << endl;
+    return false;
 }
 
-bool ESP8266::SendCommand(int nOperation, vector<unsigned char>& vData, int nChecksum)
+int ESP8266::Checksum(const unsigned char* pData, size_t nSize, unsigned char nSeed)
+{
+    return XorChecksum(pData, nSize, nSeed);
+}
+
+bool ESP8266::SlipRead(int nTimeout, unsigned char* pBuffer, size_t nSize)
 {
-    vector<unsigned char> vBuffer = vData;
-    /*Populate header
+    //Decode directly from the serial receive ring until a frame is complete or the deadline passes, leaving any following frame in the ring
+    m_nResponseSize = 0;
+    if(pBuffer)
+        m_slipDecoder.SetBuffer(pBuffer, nSize);
+    else
+        m_slipDecoder.SetBuffer(m_vResponse.data(), m_vResponse.size());
+    unsigned long nEscapes = m_slipDecoder.GetEscapes();
+    unsigned long nDiscarded = m_slipDecoder.GetDiscarded();
+    unsigned long nErrors = m_slipDecoder.GetErrors();
+    size_t nConsumed = 0;
+    chrono::steady_clock::time_point tDeadline = chrono::steady_clock::now() + chrono::milliseconds(nTimeout);
+    while(!m_slipDecoder.IsComplete())
+    {
+        int nWait = chrono::duration_cast<chrono::milliseconds>(tDeadline - chrono::steady_clock::now()).count();
+        if(nWait < 0)
+            break;
+        const unsigned char* pData;
+        int nAvailable = m_pSerial->Peek(&pData, nWait);
+        if(nAvailable <= 0)
+            break; //Timeout or port error
+        if(m_pStats)
+            m_pStats->FirstByte();
+        size_t nDecoded = m_slipDecoder.Decode(pData, nAvailable);
+        m_pSerial->Consume(nDecoded);
+        nConsumed += nDecoded;
+    }
+    if(m_pStats)
+        m_pStats->Received(nConsumed, m_slipDecoder.GetEscapes() - nEscapes, m_slipDecoder.GetDiscarded() - nDiscarded, m_slipDecoder.GetErrors() - nErrors);
+    if(!m_slipDecoder.IsComplete())
+        return false;
+    m_nResponseSize = m_slipDecoder.GetSize();
+    return true;
+}
+
+unsigned char* ESP8266::GetPayload(size_t nSize)
+{
+    //Only grows so steady state commands reuse the same buffers
+    if(m_vCommand.size() < ESP_HEADER_SIZE + nSize)
+    {
+        m_vCommand.resize(ESP_HEADER_SIZE + nSize);
+        m_vTxFrame.resize(2 * m_vCommand.size() + 2);
+    }
+    return m_vCommand.data() + ESP_HEADER_SIZE;
+}
+
+void ESP8266::BuildFrame(int nOperation, size_t nSize, int nChecksum)
+{
+    /*Populate header in place
         byte message type
         byte operation code
-        short length of payload
-        int checksum
+        short length of payload (little-endian)
+        int checksum (little-endian)
     */
-    //Insert header in reverse order (keep pushing bytes at front)
-    vBuffer.insert(vBuffer.begin(), nChecksum & 0xFF);
-    vBuffer.insert(vBuffer.begin(), (nChecksum >> 8) & 0xFF);
-    vBuffer.insert(vBuffer.begin(), (nChecksum >> 16) & 0xFF);
-    vBuffer.insert(vBuffer.begin(), (nChecksum >> 24) & 0xFF);
-    vBuffer.insert(vBuffer.begin(),(vData.size() >> 8) & 0xFF);
-    vBuffer.insert(vBuffer.begin(), vData.size() & 0xFF);
-    vBuffer.insert(vBuffer.begin(), nOperation); //request command operation
-    vBuffer.insert(vBuffer.begin(), ESP_MSGTYPE_COMMAND); //Message type
-    //!@todo check little / big endian
-    //int[] checksum = toIntArray(checksum(data, 0));
-    m_pSerial->Write(vBuffer);
-    vBuffer.clear();
+    unsigned char* pHeader = m_vCommand.data();
+    pHeader[ESP_HEADER_MSG_TYPE] = ESP_MSGTYPE_COMMAND;
+    pHeader[ESP_HEADER_OP] = nOperation;
+    pHeader[ESP_HEADER_LEN] = nSize & 0xFF;
+    pHeader[ESP_HEADER_LEN + 1] = (nSize >> 8) & 0xFF;
+    PutLe32(pHeader + ESP_HEADER_CHECKSUM, nChecksum);
+    //SLIP encode directly into transmit buffer with frame delimiters
+    unsigned char* pFrame = m_vTxFrame.data();
+    m_nTxFrameSize = 0;
+    pFrame[m_nTxFrameSize++] = SLIP_END;
+    m_nTxFrameSize += SlipEncode(pHeader, ESP_HEADER_SIZE + nSize, pFrame + m_nTxFrameSize);
+    pFrame[m_nTxFrameSize++] = SLIP_END;
+    m_nTxOperation = nOperation;
+    m_nTxEscaped = m_nTxFrameSize - 2 - ESP_HEADER_SIZE - nSize;
+}
+
+bool ESP8266::SendFrame()
+{
+    CountFrame();
+    return m_pSerial->Write(m_vTxFrame.data(), m_nTxFrameSize);
+}
+
+void ESP8266::CountFrame()
+{
+    ++m_nFramesSent;
+    if(m_pStats)
+        m_pStats->Sent(m_nTxOperation, m_nTxFrameSize, m_nTxEscaped);
+}
+
+bool ESP8266::ReadResponse(int nOperation, int nTimeout)
+{
     //Try several times to get an appropriate header but not indefinitely
-    for(int nCount = 0; nCount  < ESP_RESPONSE_RETRY; ++nCount)
-    {
-        if(!SlipRead(vBuffer))
-           return false;
-        if(vBuffer.size() < ESP_HEADER_SIZE)
-            continue; //too short for a header
-        if(vBuffer[ESP_HEADER_MSG_TYPE] != ESP_MSGTYPE_RESPONSE)
-            continue; //not a response message
-        if((nOperation == ESP_OP_NONE) || (vBuffer[ESP_HEADER_OP] == nOperation))
+    int nCount = 0;
+    while(nCount < ESP_RESPONSE_RETRY)
+    {
+        if(!SlipRead(nTimeout))
         {
-            //Got the response we were looking for
-            vBuffer.erase(vBuffer.begin(), vBuffer.begin() + 8);
-            return true;
+            if(m_pStats)
+                m_pStats->Timeout(nOperation);
+            return false;
         }
+        if(m_nResponseSize < ESP_HEADER_SIZE || m_vResponse[ESP_HEADER_MSG_TYPE] != ESP_MSGTYPE_RESPONSE)
+        {
+            if(m_pStats)
+                m_pStats->Resync(nOperation);
+            ++nCount;
+            continue; //too short for a header or not a response message
+        }
+        if(m_bSyncDrain && nOperation != ESP_OP_SYNC && m_vResponse[ESP_HEADER_OP] == ESP_OP_SYNC)
+            continue; //late response to a connection sync so discard without counting as a retry
+        if((nOperation == ESP_OP_NONE) || (m_vResponse[ESP_HEADER_OP] == nOperation))
+        {
+            m_bSyncDrain = (nOperation == ESP_OP_SYNC); //ROM responds in order so only a sync leaves further sync responses to follow
+            if(m_pStats)
+                m_pStats->Response(m_vResponse[ESP_HEADER_OP]);
+            return true; //Got the response we were looking for
+        }
+        if(m_pStats)
+            m_pStats->Resync(nOperation);
+        ++nCount;
     }
     return false;
 }
 
+bool ESP8266::SendCommand(int nOperation, const unsigned char* pData, size_t nSize, int nChecksum, int nTimeout)
+{
+    unsigned char* pPayload = GetPayload(nSize);
+    if(pData != pPayload)
+        copy(pData, pData + nSize, pPayload);
+    BuildFrame(nOperation, nSize, nChecksum);
+    return SendFrame() && ReadResponse(nOperation, nTimeout);
+}
+
+unsigned int ESP8266::GetResponseValue()
+{
+    if(m_nResponseSize < ESP_HEADER_SIZE)
+        return 0;
+    return GetLe32(m_vResponse.data() + ESP_HEADER_VALUE);
+}
+
+bool ESP8266::CheckStatus(int nOperation, size_t nMinSize)
+{
+    if(GetResponseSize() < nMinSize || GetResponseSize() < ESP_STATUS_SIZE)
+        return false;
+    //Status bytes follow any response data. Non-zero status indicates failure.
+    const unsigned char* pStatus = GetResponse() + GetResponseSize() - ESP_STATUS_SIZE;
+    if(pStatus[0] != 0)
+    {
+        if(m_pStats)
+            m_pStats->Failure(nOperation, pStatus[1] == ESP_ERROR_CHECKSUM);
+        if(m_bVerbose)
+            cerr << "Command 0x" << hex << nOperation << " failed with error 0x" << (int)pStatus[1] << dec << endl;
+        return false;
+    }
+    return true;
+}
+
+template<class T> void ESP8266::BuildCommand(const T& command, const unsigned char* pData, size_t nSize, int nChecksum)
+{
+    unsigned char* pPayload = GetPayload(T::SIZE + nSize);
+    command.Serialise(pPayload);
+    if(nSize && pData != pPayload + T::SIZE)
+        copy(pData, pData + nSize, pPayload + T::SIZE);
+    BuildFrame(T::OP, T::SIZE + nSize, nChecksum);
+}
+
+template<class T> bool ESP8266::WaitResponse(int nTimeout)
+{
+    return ReadResponse(T::OP, nTimeout ? nTimeout : T::TIMEOUT) && CheckStatus(T::OP, T::RESPONSE_SIZE);
+}
+
+template<class T> bool ESP8266::Command(const T& command, const unsigned char* pData, size_t nSize, int nChecksum, int nTimeout)
+{
+    BuildCommand(command, pData, nSize, nChecksum);
+    return SendFrame() && WaitResponse<T>(nTimeout);
+}
+
+bool ESP8266::SendCommand(int nOperation, vector<unsigned char>& vData, int nChecksum)
+{
+    if(!SendCommand(nOperation, vData.data(), vData.size(), nChecksum))
+        return false;
+    vData.assign(GetResponse(), GetResponse() + GetResponseSize());
+    return true;
+}
+
 int ESP8266::ReadReg(int nAddress)
 {
     if(!m_bConnected && !Connect())
         return false;
-    vector<unsigned char> vBuffer;
-    FromInteger(nAddress, vBuffer, 0);
-    bool bResult = SendCommand(ESP_OP_READ_REG, vBuffer, 0);
-    if(!bResult)
+    EspReadReg command;
+    command.nAddress = nAddress;
+    if(!Command(command))
     {
         if(m_bVerbose)
-            cerr << "Failed to read register " << "0x" << hex << nAddress << endl;
+            cerr << "Failed to read register " << "0x" << hex << nAddress << dec << endl;
         return 0; //!@todo This is an error state
     }
-    return ToInteger(vBuffer, 0);
+    return GetResponseValue();
 }
 
 bool ESP8266::WriteReg(int nAddress, int nValue)
 {
     if(!m_bConnected && !Connect())
         return false;
-    vector<unsigned char> vBuffer;
-    FromInteger(nValue, vBuffer);
-    return SendCommand(ESP_OP_WRITE_REG, vBuffer, 0);
+    EspWriteReg command;
+    command.nAddress = nAddress;
+    command.nValue = nValue;
+    command.nMask = 0xFFFFFFFF;
+    command.nDelay = 0;
+    return Command(command);
 }
 
-int ESP8266::ToInteger(vector<unsigned char>& vBuffer, unsigned int nStart)
+unsigned int ESP8266::GetEraseSize(unsigned int nOffset, unsigned int nSize)
 {
-    if(vBuffer.size() < nStart + 4)
-        return 0; //!@todo This is an error state
-    int nResult = vBuffer[nStart] << 24;
-    nResult += vBuffer[nStart + 1] << 16;
-    nResult += vBuffer[nStart + 2] << 8;
-    nResult += vBuffer[nStart + 3] << 0;
-    return nResult;
+    //ROM erases whole 64K blocks more than requested so ask for less (see esptool.py get_erase_size)
+    unsigned int nSectors = (nSize + ESP_FLASH_SECTOR - 1) / ESP_FLASH_SECTOR;
+    unsigned int nStartSector = nOffset / ESP_FLASH_SECTOR;
+    unsigned int nHeadSectors = ESP_FLASH_SECTOR_PER_BLOCK - (nStartSector % ESP_FLASH_SECTOR_PER_BLOCK);
+    if(nSectors < nHeadSectors)
+        nHeadSectors = nSectors;
+    if(nSectors < 2 * nHeadSectors)
+        return (nSectors + 1) / 2 * ESP_FLASH_SECTOR;
+    return (nSectors - nHeadSectors) * ESP_FLASH_SECTOR;
 }
 
-void ESP8266::FromInteger(int nValue, vector<unsigned char>& vBuffer, unsigned int nStart)
+bool ESP8266::FlashBegin(unsigned int nOffset, unsigned int nSize, unsigned int nBlockSize)
 {
-    while(vBuffer.size() < 4)
-        vBuffer.insert(vBuffer.begin(), 0);
-    vBuffer[nStart + 0] = (nValue >> 24) & 0xFF;
-    vBuffer[nStart + 1] = (nValue>> 16) & 0xFF;
-    vBuffer[nStart + 2] = (nValue>> 8) & 0xFF;
-    vBuffer[nStart + 3] = (nValue>> 0) & 0xFF;
+    if(!m_bConnected && !Connect())
+        return false;
+    EspFlashBegin command;
+    command.nEraseSize = m_bStub ? nSize : GetEraseSize(nOffset, nSize); //Stub does not share ROM erase bug
+    command.nBlocks = (nSize + nBlockSize - 1) / nBlockSize;
+    command.nBlockSize = nBlockSize;
+    command.nOffset = nOffset;
+    //Erase takes roughly 30s per MB so allow for large regions
+    int nTimeout = EspFlashBegin::TIMEOUT;
+    if(command.nEraseSize / 1024 * 30 > (unsigned int)nTimeout)
+        nTimeout = command.nEraseSize / 1024 * 30;
+    if(Command(command, NULL, 0, 0, nTimeout))
+        return true;
+    if(!m_bSilent)
+        cerr << "Failed to start flash write at 0x" << hex << nOffset << dec << endl;
+    return false;
 }
 
-/*
-string ESP8266::ReadMac()
+bool ESP8266::WriteFlash(unsigned int nOffset, const unsigned char* pData, size_t nSize)
 {
-    int nOui
-    int nMac0 = ReadReg(ESP_OTP_MAC0)
-    int nMac1 = ReadReg(ESP_OTP_MAC1)
-    int nMac2 = ReadReg(ESP_OTP_MAC2)
-    int nMac3 = ReadReg(ESP_OTP_MAC3)
-    if(nMac3 != 0):
-        long lMac = ((nMac3 >> 16) & 0xff, (mac3 >> 8) & 0xff, mac3 & 0xff)
-    elif ((mac1 >> 16) & 0xff) == 0:
-        oui = (0x18, 0xfe, 0x34)
-    elif ((mac1 >> 16) & 0xff) == 1:
-        oui = (0xac, 0xd0, 0x74)
-    else:
-        raise FatalError("Unknown OUI")
-    return oui + ((mac1 >> 8) & 0xff, mac1 & 0xff, (mac0 >> 24) & 0xff)
-}
-*/
-unsigned int ESP8266::ReadId()
+    if(!m_bConnected && !Connect())
+        return false;
+    //Stub accepts larger blocks but takes longer to acknowledge each
+    unsigned int nBlockSize = m_nBlockSize ? m_nBlockSize : (m_bStub ? ESP_STUB_FLASH_BLOCK : ESP_FLASH_BLOCK);
+    if(!FlashBegin(nOffset, nSize, nBlockSize))
+        return false;
+    return SendBlocks<EspFlashData>(pData, nSize, nBlockSize, true, m_bStub ? ESP_STUB_TIMEOUT : EspFlashData::TIMEOUT);
+}
+
+bool ESP8266::WriteFlashDeflated(unsigned int nOffset, const unsigned char* pData, size_t nSize, size_t nUncompressedSize)
+{
+    if(!m_bStub)
+    {
+        if(!m_bSilent)
+            cerr << "Compressed flash write requires flasher stub" << endl;
+        return false;
+    }
+    unsigned int nBlockSize = m_nBlockSize ? m_nBlockSize : ESP_STUB_FLASH_BLOCK;
+    EspFlashDeflBegin begin;
+    begin.nSize = nUncompressedSize;
+    begin.nBlocks = (nSize + nBlockSize - 1) / nBlockSize;
+    begin.nBlockSize = nBlockSize;
+    begin.nOffset = nOffset;
+    if(!Command(begin))
+    {
+        if(!m_bSilent)
+            cerr << "Failed to start compressed flash write at 0x" << hex << nOffset << dec << endl;
+        return false;
+    }
+    //Compressed stream is not padded. Stub inflates each block straight into flash.
+    return SendBlocks<EspFlashDeflData>(pData, nSize, nBlockSize, false, EspFlashDeflData::TIMEOUT);
+}
+
+bool ESP8266::WriteFlashDeflated(unsigned int nOffset, Compressor& compressor, size_t nUncompressedSize)
+{
+    if(!m_bStub)
+    {
+        if(!m_bSilent)
+            cerr << "Compressed flash write requires flasher stub" << endl;
+        return false;
+    }
+    unsigned int nBlockSize = m_nBlockSize ? m_nBlockSize : ESP_STUB_FLASH_BLOCK;
+    EspFlashDeflBegin begin;
+    begin.nSize = nUncompressedSize;
+    begin.nBlocks = (Compressor::GetBound(nUncompressedSize) + nBlockSize - 1) / nBlockSize;
+    begin.nBlockSize = nBlockSize;
+    begin.nOffset = nOffset;
+    if(!Command(begin))
+    {
+        if(!m_bSilent)
+            cerr << "Failed to start compressed flash write at 0x" << hex << nOffset << dec << endl;
+        return false;
+    }
+    return SendBlocks<EspFlashDeflData>(NULL, 0, nBlockSize, false, EspFlashDeflData::TIMEOUT, &compressor, begin.nBlocks);
+}
+
+template<class T> bool ESP8266::SendBlocks(const unsigned char* pData, size_t nSize, unsigned int nBlockSize, bool bPad, int nTimeout, Compressor* pCompressor, unsigned int nBlocks)
+{
+    bool bComplete = !pCompressor; //True when all data is available
+    vector<unsigned char> vChecksums;
+    if(bComplete)
+    {
+        nBlocks = (nSize + nBlockSize - 1) / nBlockSize;
+        //Checksum all whole blocks in one pass over the data
+        vChecksums.resize(nBlocks);
+        XorChecksumBlocks(pData, nSize - nSize % nBlockSize, nBlockSize, ESP_CHECKSUM_MAGIC, vChecksums.data());
+    }
+    else
+    {
+        vChecksums.resize(nBlocks);
+        if(!WaitBlock(pCompressor, 0, nBlockSize, pData, nSize, bComplete, nBlocks, vChecksums))
+            return false;
+    }
+    /*  Pipeline: up to nDepth blocks are sent before waiting for the oldest to be acknowledged.
+        The frame for the next block is built while earlier blocks are on the wire and being written by the ESP8266.
+        Frames go to the serial driver whole so the transmit buffer is free to reuse as soon as SendFrame returns.
+    */
+    unsigned int nDepth = m_nPipelineDepth ? m_nPipelineDepth : (m_bStub ? ESP_STUB_PIPELINE_DEPTH : 1);
+    unsigned int nSent = 0; //Next block to send
+    unsigned int nAcked = 0; //Next block awaiting acknowledgement
+    int nAttempt = 1;
+    BuildDataBlock<T>(pData, nSize, 0, nBlockSize, bPad, vChecksums);
+    while(nAcked < nBlocks)
+    {
+        while(nSent < nBlocks && nSent - nAcked < nDepth)
+        {
+            if(!SendFrame())
+                return false;
+            if(++nSent < nBlocks && !WaitBlock(pCompressor, nSent, nBlockSize, pData, nSize, bComplete, nBlocks, vChecksums))
+                return false;
+            if(nSent < nBlocks)
+                BuildDataBlock<T>(pData, nSize, nSent, nBlockSize, bPad, vChecksums);
+        }
+        if(!WaitResponse<T>(nTimeout))
+        {
+            //Discard responses to blocks sent after the failed one while still at the rate they were sent
+            for(unsigned int nPending = nSent - nAcked - 1; nPending && SlipRead(ESP_TIMEOUT_SYNC); --nPending)
+                ;
+            m_pSerial->Flush(SERIAL_INPUT);
+            //Every failure counts towards a step down. A step down starts a fresh set of attempts at the slower rate.
+            unsigned int nBaud = m_pSerial->GetBaud();
+            bool bLink = LinkError();
+            if(bLink && m_pSerial->GetBaud() != nBaud)
+                nAttempt = 1;
+            else if(nAttempt++ >= ESP_BLOCK_RETRY)
+                bLink = false;
+            if(!bLink)
+            {
+                if(!m_bSilent)
+                    cerr << "Failed to write block " << nAcked << endl;
+                return false;
+            }
+            if(m_pStats)
+                m_pStats->Retry(T::OP);
+            //Resend from the failed block
+            nSent = nAcked;
+            BuildDataBlock<T>(pData, nSize, nSent, nBlockSize, bPad, vChecksums);
+            continue;
+        }
+        ++nAcked;
+        nAttempt = 1;
+        if(++m_nLinkCommands >= ESP_BAUD_ERROR_WINDOW)
+            m_nLinkErrors = m_nLinkCommands = 0;
+        if(m_bVerbose)
+            cout << "\rWritten " << nAcked * 100 / nBlocks << "%" << flush;
+    }
+    if(m_bVerbose)
+        cout << endl;
+    return true;
+}
+
+unsigned int ESP8266::SetFastBaud(unsigned int nBaud)
+{
+    if(!m_bStub)
+    {
+        if(!m_bSilent)
+            cerr << "Baud change requires flasher stub" << endl;
+        return m_pSerial->GetBaud();
+    }
+    //Remember a register value to check the link at each new rate
+    EspReadReg check;
+    check.nAddress = ESP_OTP_MAC0;
+    if(!Command(check))
+        return m_pSerial->GetBaud();
+    m_nLinkCheck = GetResponseValue();
+    //Try requested rate then each slower candidate until one works
+    vector<unsigned int> vCandidates;
+    if(nBaud)
+        vCandidates.push_back(nBaud);
+    for(unsigned int nIndex = 0; nIndex < sizeof(ESP_FAST_BAUDS) / sizeof(ESP_FAST_BAUDS[0]); ++nIndex)
+        if(!nBaud || ESP_FAST_BAUDS[nIndex] < nBaud)
+            vCandidates.push_back(ESP_FAST_BAUDS[nIndex]);
+    for(unsigned int nIndex = 0; nIndex < vCandidates.size(); ++nIndex)
+    {
+        if(vCandidates[nIndex] <= m_nConnectBaud || !m_pSerial->IsBaudSupported(vCandidates[nIndex]))
+            continue;
+        if(ChangeBaud(vCandidates[nIndex]))
+            break;
+    }
+    if(m_bVerbose)
+        cout << "Using baud " << m_pSerial->GetBaud() << " (port reports " << m_pSerial->GetActualBaud() << ")" << endl;
+    return m_pSerial->GetBaud();
+}
+
+bool ESP8266::ChangeBaud(unsigned int nBaud)
+{
+    if(m_bVerbose)
+        cout << "Changing baud to " << nBaud << endl;
+    EspChangeBaud command;
+    command.nBaud = nBaud;
+    command.nOldBaud = m_pSerial->GetBaud();
+    if(!Command(command))
+        return false; //Stub did not accept new rate so carry on at current rate
+    if(m_pSerial->SetBaud(nBaud))
+    {
+        //Allow both ends to settle then verify with a round-trip
+        usleep(50000);
+        m_pSerial->Flush(SERIAL_INPUT);
+        EspReadReg check;
+        check.nAddress = ESP_OTP_MAC0;
+        for(int nTry = 0; nTry < ESP_BLOCK_RETRY; ++nTry)
+        {
+            if(Command(check) && GetResponseValue() == m_nLinkCheck)
+            {
+                m_nLinkErrors = m_nLinkCommands = 0;
+                return true;
+            }
+        }
+    }
+    if(!m_bSilent)
+        cerr << "Link failed at baud " << nBaud << endl;
+    Reconnect();
+    return false;
+}
+
+bool ESP8266::LinkError()
 {
+    if(++m_nLinkErrors < ESP_BAUD_ERROR_THRESHOLD || m_pSerial->GetBaud() <= m_nConnectBaud)
+        return true;
+    //Too many errors so step down to next slower rate
+    unsigned int nBaud = m_pSerial->GetBaud();
+    for(unsigned int nIndex = 0; nIndex < sizeof(ESP_FAST_BAUDS) / sizeof(ESP_FAST_BAUDS[0]); ++nIndex)
+    {
+        unsigned int nCandidate = ESP_FAST_BAUDS[nIndex];
+        if(nCandidate >= nBaud || nCandidate <= m_nConnectBaud || !m_pSerial->IsBaudSupported(nCandidate))
+            continue;
+        if(!m_bSilent)
+            cerr << "Too many errors at baud " << nBaud << ", stepping down to " << nCandidate << endl;
+        return ChangeBaud(nCandidate);
+    }
+    //No slower fast rate so return to connection rate
+    return ChangeBaud(m_nConnectBaud);
+}
+
+bool ESP8266::Reconnect()
+{
+    //Stub is lost or at an unknown rate so start again from the ROM loader
+    if(m_bVerbose)
+        cout << "Reconnecting at baud " << m_nConnectBaud << endl;
+    vector<unsigned char> vStub;
+    vStub.swap(m_vStub);
+    return Connect() && (vStub.empty() || RunStub(vStub));
+}
+
+bool ESP8266::WriteMem(unsigned int nAddress, const unsigned char* pData, size_t nSize)
+{
+    EspMemBegin begin;
+    begin.nSize = nSize;
+    begin.nBlocks = (nSize + ESP_RAM_BLOCK - 1) / ESP_RAM_BLOCK;
+    begin.nBlockSize = ESP_RAM_BLOCK;
+    begin.nOffset = nAddress;
+    if(!Command(begin))
+        return false;
+    EspMemData data;
+    for(unsigned int nBlock = 0; nBlock < begin.nBlocks; ++nBlock)
+    {
+        size_t nStart = nBlock * ESP_RAM_BLOCK;
+        data.nSize = min(nSize - nStart, (size_t)ESP_RAM_BLOCK);
+        data.nSequence = nBlock;
+        if(!Command(data, pData + nStart, data.nSize, Checksum(pData + nStart, data.nSize)))
+            return false;
+    }
+    return true;
+}
+
+bool ESP8266::RunStub(const vector<unsigned char>& vImage)
+{
+    if(m_bStub)
+        return true; //Already running in this session
     if(!m_bConnected && !Connect())
         return false;
-    unsigned int nId0 = ReadReg(ESP_OTP_MAC0);
-    unsigned int nId1 = ReadReg(ESP_OTP_MAC1);
-    return (nId0 >> 24) | ((nId1 & 0xffffff) < 8);
+    if(vImage.size() < ESP_IMAGE_HEADER_SIZE || vImage[0] != ESP_IMAGE_MAGIC)
+    {
+        if(!m_bSilent)
+            cerr << "Invalid flasher stub image" << endl;
+        return false;
+    }
+    if(m_bVerbose)
+        cout << "Uploading flasher stub" << endl;
+    //Load each segment to its RAM address
+    size_t nPos = ESP_IMAGE_HEADER_SIZE;
+    for(int nSegment = 0; nSegment < vImage[ESP_IMAGE_SEGMENTS]; ++nSegment)
+    {
+        if(nPos + ESP_IMAGE_SEGMENT_HEADER > vImage.size())
+            return false;
+        unsigned int nAddress = GetLe32(vImage.data() + nPos);
+        unsigned int nSize = GetLe32(vImage.data() + nPos + 4);
+        nPos += ESP_IMAGE_SEGMENT_HEADER;
+        if(nPos + nSize > vImage.size() || !WriteMem(nAddress, vImage.data() + nPos, nSize))
+        {
+            if(!m_bSilent)
+                cerr << "Failed to upload flasher stub segment " << nSegment << endl;
+            return false;
+        }
+        nPos += nSize;
+    }
+    //Jump to entry point. ROM may not respond before stub starts so ignore response.
+    EspMemEnd end;
+    end.nEntry = GetLe32(vImage.data() + ESP_IMAGE_ENTRY);
+    Command(end);
+    //Stub announces itself with a frame containing "OHAI"
+    for(int nCount = 0; nCount < ESP_RESPONSE_RETRY; ++nCount)
+    {
+        if(!SlipRead(ESP_STUB_TIMEOUT))
+            break;
+        if(m_nResponseSize == 4 && equal(m_vResponse.begin(), m_vResponse.begin() + 4, "OHAI"))
+        {
+            m_bStub = true;
+            m_vStub = vImage;
+            if(m_bVerbose)
+                cout << "Flasher stub running" << endl;
+            return true;
+        }
+    }
+    if(!m_bSilent)
+        cerr << "Flasher stub failed to start" << endl;
+    return false;
+}
+
+template<class T> void ESP8266::BuildDataBlock(const unsigned char* pData, size_t nSize, unsigned int nBlock, unsigned int nBlockSize, bool bPad, vector<unsigned char>& vChecksums)
+{
+    size_t nStart = nBlock * nBlockSize;
+    size_t nLength = min(nSize - nStart, (size_t)nBlockSize);
+    T command;
+    command.nSequence = nBlock;
+    if(nLength == nBlockSize || !bPad)
+    {
+        command.nSize = nLength;
+        BuildCommand(command, pData + nStart, nLength, nLength == nBlockSize ? vChecksums[nBlock] : Checksum(pData + nStart, nLength));
+        return;
+    }
+    //Pad last block with erased flash value
+    command.nSize = nBlockSize;
+    unsigned char* pBlock = GetPayload(T::SIZE + nBlockSize) + T::SIZE;
+    copy(pData + nStart, pData + nSize, pBlock);
+    fill(pBlock + nLength, pBlock + nBlockSize, 0xFF);
+    BuildCommand(command, pBlock, nBlockSize, Checksum(pBlock, nBlockSize));
+}
+
+bool ESP8266::WaitBlock(Compressor* pCompressor, unsigned int nBlock, unsigned int nBlockSize, const unsigned char*& pData, size_t& nSize, bool& bComplete, unsigned int& nBlocks, vector<unsigned char>& vChecksums)
+{
+    if(bComplete || nSize >= (size_t)(nBlock + 1) * nBlockSize)
+        return true;
+    size_t nChecked = nSize - nSize % nBlockSize; //Whole blocks already checksummed
+    pData = pCompressor->Wait((size_t)(nBlock + 1) * nBlockSize, nSize, bComplete);
+    if(!pData)
+    {
+        if(!m_bSilent)
+            cerr << "Failed to compress image" << endl;
+        return false;
+    }
+    if(bComplete)
+        nBlocks = (nSize + nBlockSize - 1) / nBlockSize;
+    if(nBlocks > vChecksums.size())
+    {
+        if(!m_bSilent)
+            cerr << "Compressed image exceeds announced size" << endl;
+        return false;
+    }
+    size_t nWhole = nSize - nSize % nBlockSize;
+    XorChecksumBlocks(pData + nChecked, nWhole - nChecked, nBlockSize, ESP_CHECKSUM_MAGIC, vChecksums.data() + nChecked / nBlockSize);
+    return true;
+}
+
+bool ESP8266::FlashEnd(bool bReboot)
+{
+    if(!m_bConnected && !Connect())
+        return false;
+    EspFlashEnd command;
+    command.nStayInLoader = bReboot ? 0 : 1;
+    return Command(command);
+}
+
+bool ESP8266::AccessRegs(vector<EspRegAccess>& vAccess)
+{
+    if(!m_bConnected && !Connect())
+        return false;
+    for(auto it = vAccess.begin(); it != vAccess.end(); ++it)
+        it->bDone = false;
+    size_t nNext = 0; //Next access to send
+    size_t nAck = 0; //Next access awaiting response
+    vector<size_t> vFrameSize(vAccess.size());
+    size_t nInFlight = 0; //Quantity of bytes sent but not yet acknowledged
+    while(nAck < vAccess.size())
+    {
+        //Queue as many frames as the ESP8266 can buffer whilst it is busy responding, always at least one
+        m_vTxBatch.clear();
+        while(nNext < vAccess.size())
+        {
+            const EspRegAccess& access = vAccess[nNext];
+            if(access.bWrite)
+            {
+                EspWriteReg command;
+                command.nAddress = access.nAddress;
+                command.nValue = access.nValue;
+                command.nMask = access.nMask;
+                command.nDelay = access.nDelay;
+                BuildCommand(command);
+            }
+            else
+            {
+                EspReadReg command;
+                command.nAddress = access.nAddress;
+                BuildCommand(command);
+            }
+            if(nInFlight && nInFlight + m_nTxFrameSize > (size_t)ESP_UART_FIFO)
+                break; //Rebuilt when there is space
+            m_vTxBatch.insert(m_vTxBatch.end(), m_vTxFrame.begin(), m_vTxFrame.begin() + m_nTxFrameSize);
+            CountFrame();
+            vFrameSize[nNext++] = m_nTxFrameSize;
+            nInFlight += m_nTxFrameSize;
+        }
+        if(!m_vTxBatch.empty() && !m_pSerial->Write(m_vTxBatch.data(), m_vTxBatch.size()))
+            return false;
+        //ROM responds in order so each response belongs to the oldest outstanding access
+        EspRegAccess& access = vAccess[nAck];
+        bool bSuccess = access.bWrite ? WaitResponse<EspWriteReg>() : WaitResponse<EspReadReg>();
+        if(!bSuccess)
+        {
+            if(m_bVerbose)
+                cerr << "Failed to " << (access.bWrite ? "write" : "read") << " register 0x" << hex << access.nAddress << dec << endl;
+            return false;
+        }
+        if(!access.bWrite)
+            access.nValue = GetResponseValue();
+        access.bDone = true;
+        nInFlight -= vFrameSize[nAck++];
+    }
+    return true;
+}
+
+bool ESP8266::FlashMd5(unsigned int nOffset, unsigned int nSize, unsigned int nRegionSize, vector<Md5Digest>& vDigests)
+{
+    vDigests.clear();
+    if(!m_bStub)
+    {
+        if(!m_bSilent)
+            cerr << "Flash MD5 requires flasher stub" << endl;
+        return false;
+    }
+    if(!nRegionSize)
+        return false;
+    size_t nRegions = (nSize + nRegionSize - 1) / nRegionSize;
+    int nTimeout = max(EspSpiFlashMd5::TIMEOUT, (int)((uint64_t)nRegionSize * ESP_TIMEOUT_MD5_PER_MB / 0x100000));
+    size_t nNext = 0; //Next region to request
+    vector<size_t> vFrameSize(nRegions);
+    size_t nInFlight = 0; //Quantity of bytes sent but not yet acknowledged
+    while(vDigests.size() < nRegions)
+    {
+        //Queue as many requests as the ESP8266 can buffer whilst it is busy hashing, always at least one
+        m_vTxBatch.clear();
+        while(nNext < nRegions)
+        {
+            EspSpiFlashMd5 command;
+            command.nOffset = nOffset + nNext * nRegionSize;
+            command.nSize = min(nRegionSize, nSize - (unsigned int)(nNext * nRegionSize));
+            BuildCommand(command);
+            if(nInFlight && nInFlight + m_nTxFrameSize > (size_t)ESP_UART_FIFO)
+                break;
+            m_vTxBatch.insert(m_vTxBatch.end(), m_vTxFrame.begin(), m_vTxFrame.begin() + m_nTxFrameSize);
+            CountFrame();
+            vFrameSize[nNext++] = m_nTxFrameSize;
+            nInFlight += m_nTxFrameSize;
+        }
+        if(!m_vTxBatch.empty() && !m_pSerial->Write(m_vTxBatch.data(), m_vTxBatch.size()))
+            return false;
+        //Stub responds in order so each response belongs to the oldest outstanding region
+        if(!WaitResponse<EspSpiFlashMd5>(nTimeout))
+        {
+            if(!m_bSilent)
+                cerr << "Failed to get MD5 of flash at 0x" << hex << nOffset + vDigests.size() * nRegionSize << dec << endl;
+            return false;
+        }
+        Md5Digest digest;
+        copy(GetResponse(), GetResponse() + ESP_MD5_SIZE, digest.begin());
+        vDigests.push_back(digest);
+        nInFlight -= vFrameSize[vDigests.size() - 1];
+    }
+    return true;
+}
+
+bool ESP8266::EraseRegion(unsigned int nOffset, unsigned int nSize)
+{
+    if(!m_bStub)
+    {
+        if(!m_bSilent)
+            cerr << "Erase region requires flasher stub" << endl;
+        return false;
+    }
+    EspEraseRegion command;
+    command.nOffset = nOffset;
+    command.nSize = (nSize + ESP_FLASH_SECTOR - 1) / ESP_FLASH_SECTOR * ESP_FLASH_SECTOR;
+    int nTimeout = max(EspEraseRegion::TIMEOUT, (int)((uint64_t)command.nSize * ESP_TIMEOUT_ERASE_PER_MB / 0x100000));
+    if(Command(command, NULL, 0, 0, nTimeout))
+        return true;
+    if(!m_bSilent)
+        cerr << "Failed to erase flash at 0x" << hex << nOffset << dec << endl;
+    return false;
+}
+
+bool ESP8266::ReadFlash(unsigned int nOffset, unsigned int nSize, unsigned char* pBuffer, unsigned int nInFlight)
+{
+    if(!m_bStub)
+    {
+        if(!m_bSilent)
+            cerr << "Read flash requires flasher stub" << endl;
+        return false;
+    }
+    EspReadFlash command;
+    command.nOffset = nOffset;
+    command.nSize = nSize;
+    command.nBlockSize = ESP_READ_BLOCK;
+    command.nInFlight = nInFlight ? nInFlight : 1;
+    if(!Command(command))
+        return false;
+    //Stub streams data frames without headers, waiting whenever nInFlight frames are unacknowledged
+    Md5 md5;
+    size_t nReceived = 0;
+    unsigned char aAck[2 + 2 * 4]; //Acknowledgement frame: SLIP encoded total bytes received
+    unsigned char aReceived[4];
+    while(nReceived < nSize)
+    {
+        size_t nExpected = min((size_t)ESP_READ_BLOCK, nSize - nReceived);
+        if(!SlipRead(ESP_STUB_TIMEOUT, pBuffer + nReceived, nExpected) || m_nResponseSize != nExpected)
+        {
+            if(!m_bSilent)
+                cerr << "Failed to read flash at 0x" << hex << nOffset + nReceived << dec << endl;
+            return false;
+        }
+        md5.Update(pBuffer + nReceived, nExpected);
+        nReceived += nExpected;
+        PutLe32(aReceived, nReceived);
+        size_t nAckSize = 0;
+        aAck[nAckSize++] = SLIP_END;
+        nAckSize += SlipEncode(aReceived, sizeof(aReceived), aAck + nAckSize);
+        aAck[nAckSize++] = SLIP_END;
+        if(!m_pSerial->Write(aAck, nAckSize))
+            return false;
+    }
+    //Stub finishes with binary MD5 of whole region
+    if(!SlipRead(ESP_STUB_TIMEOUT) || m_nResponseSize != ESP_MD5_SIZE)
+    {
+        if(!m_bSilent)
+            cerr << "Failed to get MD5 of flash read from 0x" << hex << nOffset << dec << endl;
+        return false;
+    }
+    Md5Digest digest = md5.Final();
+    if(!equal(digest.begin(), digest.end(), m_vResponse.begin()))
+    {
+        if(!m_bSilent)
+            cerr << "MD5 mismatch reading flash at 0x" << hex << nOffset << dec << endl;
+        return false;
+    }
+    return true;
+}
+
+bool ESP8266::ReadRegs(const vector<uint32_t>& vAddresses, vector<uint32_t>& vValues)
+{
+    vector<EspRegAccess> vAccess(vAddresses.size());
+    for(size_t nIndex = 0; nIndex < vAddresses.size(); ++nIndex)
+    {
+        vAccess[nIndex].bWrite = false;
+        vAccess[nIndex].nAddress = vAddresses[nIndex];
+    }
+    vValues.clear();
+    if(!AccessRegs(vAccess))
+        return false;
+    for(auto it = vAccess.begin(); it != vAccess.end(); ++it)
+        vValues.push_back(it->nValue);
+    return true;
+}
+
+string ESP8266::ReadMac()
+{
+    vector<uint32_t> vMac;
+    if(!ReadRegs({ESP_OTP_MAC0, ESP_OTP_MAC1, ESP_OTP_MAC2, ESP_OTP_MAC3}, vMac))
+        return "";
+    //Vendor OUI is stored in MAC3 or implied by MAC1 (see esptool.py read_mac)
+    unsigned int nOui;
+    if(vMac[3] != 0)
+        nOui = vMac[3] & 0xffffff;
+    else if(((vMac[1] >> 16) & 0xff) == 0)
+        nOui = 0x18fe34;
+    else if(((vMac[1] >> 16) & 0xff) == 1)
+        nOui = 0xacd074;
+    else
+    {
+        if(!m_bSilent)
+            cerr << "Unknown OUI" << endl;
+        return "";
+    }
+    unsigned int anMac[6] = {(nOui >> 16) & 0xff, (nOui >> 8) & 0xff, nOui & 0xff, (vMac[1] >> 8) & 0xff, vMac[1] & 0xff, (vMac[0] >> 24) & 0xff};
+    char sMac[18];
+    snprintf(sMac, sizeof(sMac), "%02X:%02X:%02X:%02X:%02X:%02X", anMac[0], anMac[1], anMac[2], anMac[3], anMac[4], anMac[5]);
+    return sMac;
+}
+
+unsigned int ESP8266::ReadId()
+{
+    vector<uint32_t> vId;
+    if(!ReadRegs({ESP_OTP_MAC0, ESP_OTP_MAC1}, vId))
+        return 0;
+    return (vId[0] >> 24) | ((vId[1] & 0xffffff) << 8);
 }
@@ -3,6 +3,9 @@
 */
 #pragma once
 #include "serial.h"
+#include "slip.h"
+#include "espstats.h"
+#include "md5.h"
 
 using namespace std;
 
@@ -22,19 +25,53 @@ using namespace std;
 	const static int ESP_OP_WRITE_REG   = 0x09;
 	const static int ESP_OP_READ_REG    = 0x0a;
 
+    // Commands supported only by the RAM-loaded flasher stub
+    const static int ESP_OP_CHANGE_BAUDRATE = 0x0f;
+    const static int ESP_OP_FLASH_DEFL_BEGIN = 0x10;
+    const static int ESP_OP_FLASH_DEFL_DATA = 0x11;
+    const static int ESP_OP_FLASH_DEFL_END = 0x12;
+    const static int ESP_OP_SPI_FLASH_MD5 = 0x13;
+    const static int ESP_OP_ERASE_FLASH = 0xd0;
+    const static int ESP_OP_ERASE_REGION = 0xd1;
+    const static int ESP_OP_READ_FLASH = 0xd2;
+
     // Maximum block sized for RAM and Flash writes, respectively.
 	const static int ESP_RAM_BLOCK   = 0x1800;
 	const static int ESP_FLASH_BLOCK = 0x400;
+    // Maximum block size for flash writes when flasher stub is running
+    const static int ESP_STUB_FLASH_BLOCK = 0x4000;
+    // Quantity of flash data blocks in flight by default when flasher stub is running (ROM loader gets one at a time)
+    const static int ESP_STUB_PIPELINE_DEPTH = 4;
+    // Size of each data frame sent by flasher stub for READ_FLASH and quantity it may send before waiting for acknowledgement
+    const static int ESP_READ_BLOCK = 0x1000;
+    const static int ESP_READ_IN_FLIGHT = 64;
+
+    // Largest decoded frame we expect to receive
+    const static int ESP_MAX_FRAME   = 0x2000;
+    // Largest command payload we expect to send (data block plus its 16 byte parameters)
+    const static int ESP_MAX_PAYLOAD = ESP_RAM_BLOCK + 16;
+
+    // Size of ESP8266 UART receive FIFO. Limits quantity of pipelined command bytes sent ahead of responses.
+    const static int ESP_UART_FIFO   = 128;
 
     // Default baud rate. The ROM auto-bauds, so we can use more or less whatever we want.
 	const static int ESP_ROM_BAUD    = 115200;
 
+    // Candidate rates to switch to after connecting, fastest first. Flasher stub required.
+    const static unsigned int ESP_FAST_BAUDS[] = {3000000, 2000000, 1500000, 921600, 460800, 230400};
+    const static int ESP_BAUD_ERROR_THRESHOLD = 3; //Link errors within window that cause a step down to slower baud
+    const static int ESP_BAUD_ERROR_WINDOW = 64; //Quantity of successful commands after which link errors are forgotten
+    const static int ESP_BLOCK_RETRY = 3; //How many times we try to send each data block at each baud
+
     // First byte of the application image
 	const static int ESP_IMAGE_MAGIC = 0xe9;
 
     // Initial state for the checksum routine
 	const static int ESP_CHECKSUM_MAGIC = 0xef;
 
+    // Error code in response status indicating invalid data checksum
+    const static int ESP_ERROR_CHECKSUM = 0x07;
+
     // OTP ROM addresses
 	const static int ESP_OTP_MAC0    = 0x3ff00050;
 	const static int ESP_OTP_MAC1    = 0x3ff00054;
@@ -52,9 +89,52 @@ using namespace std;
     const static int ESP_HEADER_CHECKSUM = 4; //uint32 Checksum of payload (command message)
     const static int ESP_HEADER_VALUE    = 4; //uint32 Value (response message)
 
+    // Application image header
+    const static int ESP_IMAGE_HEADER_SIZE    = 8;
+    const static int ESP_IMAGE_SEGMENTS       = 1; //uint8 Quantity of segments
+    const static int ESP_IMAGE_ENTRY          = 4; //uint32 Entry point
+    const static int ESP_IMAGE_SEGMENT_HEADER = 8; //Each segment starts with uint32 address, uint32 size
+
+    // Hardware reset sequences - steps separated by '|'
+    // U<dtr>,<rts> sets both lines in one operation, D<0|1> sets DTR, R<0|1> sets RTS, W<seconds> waits
+    // Adapter inverts lines so asserting RTS pulls EN (reset) low and asserting DTR pulls GPIO0 low
+    const static char ESP_RESET_CLASSIC[]      = "U0,1|W0.05|U1,0|W0.05|U0,0"; //50ms reset pulse then GPIO0 held low 50ms whilst ROM samples strapping pins
+    const static char ESP_RESET_CLASSIC_RUN[]  = "U0,1|W0.05|U0,0";
+    const static char ESP_RESET_USB_JTAG[]     = "U0,0|W0.1|U1,0|W0.1|U1,1|U0,1|W0.1|U0,0"; //Passes through (1,1) rather than (0,0) to suit USB-JTAG-serial bridges
+    const static char ESP_RESET_USB_JTAG_RUN[] = "U0,1|W0.1|U0,0";
+
     // Timeouts
     const static int ESP_RESPONSE_RETRY  = 100; //How many times we try to get a response
-    const static int ESP_SLIP_TIMEOUT    = 500; //How many times we try to get a response
+    const static int ESP_SLIP_TIMEOUT    = 500; //Maximum time to wait for a complete SLIP frame in milliseconds
+    const static int ESP_STUB_TIMEOUT    = 3000; //Maximum time to wait for flasher stub to start or write a block in milliseconds
+    const static int ESP_CONNECT_ATTEMPTS = 4; //Quantity of hardware resets to try when connecting
+    const static int ESP_CONNECT_WINDOW  = 500; //Time to keep sending sync frames after each reset in milliseconds
+    const static int ESP_CALIBRATE_TRIES = 3; //Consecutive connects required at each hold time when calibrating reset
+    const static int ESP_CALIBRATE_STEPS = 7; //Bisection steps when calibrating reset (resolution 1/128 of sequence holds)
+
+#include "esp8266commands.h"
+
+/** Step of a hardware reset sequence */
+struct EspResetStep
+{
+    char cType; //U: set DTR and RTS, D: set DTR, R: set RTS, W: wait
+    bool bDtr; //DTR state for U and D steps
+    bool bRts; //RTS state for U and R steps
+    unsigned int nWait; //Duration of W step in microseconds
+};
+
+/** Register read or write within a batch (see ESP8266::AccessRegs) */
+struct EspRegAccess
+{
+    bool bWrite; //True to write register, false to read
+    uint32_t nAddress; //Register address
+    uint32_t nValue; //Value to write or value read
+    uint32_t nMask; //Mask of bits to write
+    uint32_t nDelay; //Delay after write in microseconds
+    bool bDone; //True once ESP8266 has acknowledged access
+};
+
+class Compressor;
 
 class ESP8266
 {
@@ -72,12 +152,42 @@ class ESP8266
         */
         bool Open();
 
+        /** @brief  Connect to ESP8266 in flash mode
+        *   @retval bool True on success
+        *   @note   Commands connect automatically. Only call this if application needs to separate connection from subsequent operations.
+        *   @note   Sync frames are sent repeatedly from reset until the first valid response so connection completes as soon as the ROM is ready
+        */
+        bool Connect();
+
+        /** @brief  Get the time taken by the last successful connection
+        *   @retval unsigned int Milliseconds from first reset to first valid sync response
+        */
+        unsigned int GetConnectTime() {return m_nConnectTime;};
+
         /** @brief  Hardware reset using RTS / DTR signals
         *   @param  bFlash True to set to flash mode. False to set to run mode (Default: false)
         *   @retval bool True on success
         */
         bool Reset(bool bflash = false);
 
+        /** @brief  Set the hardware reset sequence
+        *   @param  sSequence Name of built-in sequence (classic|usb_jtag|none) or custom sequence, e.g. "U0,1|W0.05|U1,0|W0.05|U0,0"
+        *   @retval bool True if sequence is valid
+        *   @note   A custom sequence is used to enter flash mode. Reset to run mode then uses the classic run sequence.
+        *   @note   See ESP_RESET_CLASSIC for sequence syntax
+        */
+        bool SetResetSequence(string sSequence);
+
+        /** @brief  Find the shortest holds for which the flash reset sequence still connects
+        *   @param  sMinimum String to populate with the sequence using the shortest holds that connected
+        *   @param  nHold Populated with total of shortest holds in microseconds
+        *   @retval bool True on success. False if the sequence does not connect with its full holds.
+        *   @note   Scales all W steps of the current flash sequence together, requiring ESP_CALIBRATE_TRIES consecutive connects at each scale
+        *   @note   The run sequence cannot be verified this way so is not calibrated. Resets to run mode when done.
+        *   @note   Result is a minimum for this board, adapter and host - add margin before using it
+        */
+        bool CalibrateReset(string& sMinimum, unsigned int& nHold);
+
         /** @brief  Set verbose mode
         *   @param  bVerbose True to output more verbose messages
         */
@@ -107,8 +217,166 @@ class ESP8266
         */
         bool SendCommand(int nCommand, vector<unsigned char>& vData, int nChecksum = 0);
 
+        /** @brief  Send a command to the ESP8266 without copying the payload into a new buffer
+        *   @param  nCommand Command ID (See ESPCOMMAND)
+        *   @param  pData Pointer to payload. May be the buffer returned by GetPayload() to avoid any copy.
+        *   @param  nSize Quantity of bytes in payload
+        *   @param  nChecksum Checksum of data
+        *   @param  nTimeout Maximum time to wait for response in milliseconds (Default: ESP_SLIP_TIMEOUT)
+        *   @retval bool True on success
+        *   @note   Response is available from GetResponse() until the next command
+        */
+        bool SendCommand(int nCommand, const unsigned char* pData, size_t nSize, int nChecksum = 0, int nTimeout = ESP_SLIP_TIMEOUT);
+
+        /** @brief  Get the payload area of the command frame buffer
+        *   @param  nSize Quantity of bytes required for payload
+        *   @retval unsigned char* Pointer to payload area, immediately after space reserved for header
+        *   @note   Buffer is reused for each command. Fill it then pass it to SendCommand() to send without copying.
+        */
+        unsigned char* GetPayload(size_t nSize);
+
+        /** @brief  Get the payload of the last response frame
+        *   @retval const unsigned char* Pointer to response payload
+        */
+        const unsigned char* GetResponse() {return m_vResponse.data() + ESP_HEADER_SIZE;};
+
+        /** @brief  Get size of last response payload
+        *   @retval size_t Quantity of bytes in response payload
+        */
+        size_t GetResponseSize() {return m_nResponseSize > ESP_HEADER_SIZE ? m_nResponseSize - ESP_HEADER_SIZE : 0;};
+
+        /** @brief  Get the value field from the header of the last response
+        *   @retval unsigned int Response value, e.g. content of register for READ_REG
+        */
+        unsigned int GetResponseValue();
+
+        /** @brief  Write data to flash memory
+        *   @param  nOffset Flash address at which to write data
+        *   @param  pData Pointer to data, e.g. memory mapped firmware image
+        *   @param  nSize Quantity of bytes to write
+        *   @retval bool True on success
+        *   @note   Call FlashEnd() after writing all images
+        */
+        bool WriteFlash(unsigned int nOffset, const unsigned char* pData, size_t nSize);
+
+        /** @brief  Switch to a faster baud, verifying the link and stepping down on failure
+        *   @param  nBaud Highest baud to try or zero to try each of ESP_FAST_BAUDS (Default: 0)
+        *   @retval unsigned int Baud in use after switch (connection baud if no faster rate works)
+        *   @note   Requires flasher stub (see RunStub). Once switched, data transfers step down automatically if link errors cross ESP_BAUD_ERROR_THRESHOLD.
+        */
+        unsigned int SetFastBaud(unsigned int nBaud = 0);
+
+        /** @brief  Write zlib compressed data to flash, inflated by flasher stub
+        *   @param  nOffset Flash address at which to write data
+        *   @param  pData Pointer to compressed data
+        *   @param  nSize Quantity of bytes of compressed data
+        *   @param  nUncompressedSize Quantity of bytes to be written to flash once inflated
+        *   @retval bool True on success
+        *   @note   Requires flasher stub (see RunStub)
+        */
+        bool WriteFlashDeflated(unsigned int nOffset, const unsigned char* pData, size_t nSize, size_t nUncompressedSize);
+
+        /** @brief  Write the oldest image queued for compression to flash, sending each block as soon as it is compressed
+        *   @param  nOffset Flash address at which to write data
+        *   @param  compressor Compressor holding the image
+        *   @param  nUncompressedSize Quantity of bytes to be written to flash once inflated
+        *   @retval bool True on success
+        *   @note   Requires flasher stub (see RunStub). Call compressor.Next() afterwards to move to the next image.
+        *   @note   Compressed size is not known when FLASH_DEFL_BEGIN is sent so the quantity of blocks announced is an upper bound (see Compressor::GetBound). The stub finishes when the zlib stream ends.
+        */
+        bool WriteFlashDeflated(unsigned int nOffset, Compressor& compressor, size_t nUncompressedSize);
+
+        /** @brief  Set size of data blocks used to write flash
+        *   @param  nBlockSize Bytes per block or zero for default (ESP_FLASH_BLOCK with ROM, ESP_STUB_FLASH_BLOCK with stub)
+        *   @note   ROM loader requires ESP_FLASH_BLOCK. Larger blocks need the flasher stub.
+        */
+        void SetBlockSize(unsigned int nBlockSize) {m_nBlockSize = nBlockSize;};
+
+        /** @brief  Set quantity of data blocks sent before waiting for the first to be acknowledged
+        *   @param  nDepth Blocks in flight or zero for default (1 with ROM, ESP_STUB_PIPELINE_DEPTH with stub)
+        *   @note   Depth above 1 relies on the receiver buffering whole frames, e.g. a flasher stub with a receive buffer
+        */
+        void SetPipelineDepth(unsigned int nDepth) {m_nPipelineDepth = nDepth;};
+
+        /** @brief  Get quantity of command frames sent since instantiation
+        *   @retval unsigned long Quantity of frames
+        */
+        unsigned long GetFramesSent() {return m_nFramesSent;};
+
+        /** @brief  Enable or disable per-operation statistics
+        *   @param  bEnable True to record statistics (clears any previous statistics)
+        *   @note   Disabled by default. Costs a pointer test per frame when disabled.
+        */
+        void EnableStats(bool bEnable = true);
+
+        /** @brief  Get per-operation statistics
+        *   @retval EspStats* Pointer to statistics or NULL if disabled
+        */
+        EspStats* GetStats() {return m_pStats;};
+
+        /** @brief  Finish writing flash
+        *   @param  bReboot True to reboot ESP8266. False to remain in loader (Default: false)
+        *   @retval bool True on success
+        */
+        bool FlashEnd(bool bReboot = false);
+
+        /** @brief  Upload flasher stub to RAM and run it
+        *   @param  vImage Stub in ESP8266 application image format (segments loaded to RAM and entry point)
+        *   @retval bool True if stub is running
+        *   @note   Does nothing if stub is already running in this session. Stub allows larger blocks and extra commands.
+        */
+        bool RunStub(const vector<unsigned char>& vImage);
+
+        /** @brief  Check whether flasher stub is running
+        *   @retval bool True if stub was loaded and has not been lost by reset
+        */
+        bool IsStub() {return m_bStub;};
+
+        /** @brief  Get MD5 digests of consecutive regions of flash
+        *   @param  nOffset Flash address of first region
+        *   @param  nSize Total quantity of bytes to hash
+        *   @param  nRegionSize Size of each region, e.g. ESP_FLASH_SECTOR. Last region may be shorter.
+        *   @param  vDigests Vector to populate with one digest per region
+        *   @retval bool True on success
+        *   @note   Requires flasher stub (see RunStub). Requests are pipelined as AccessRegs so many small regions cost little more than the device's hashing time.
+        */
+        bool FlashMd5(unsigned int nOffset, unsigned int nSize, unsigned int nRegionSize, vector<Md5Digest>& vDigests);
+
+        /** @brief  Erase a region of flash
+        *   @param  nOffset Flash address of region, on a sector boundary
+        *   @param  nSize Quantity of bytes, rounded up to whole sectors
+        *   @retval bool True on success
+        *   @note   Requires flasher stub (see RunStub)
+        */
+        bool EraseRegion(unsigned int nOffset, unsigned int nSize);
+
+        /** @brief  Read a region of flash
+        *   @param  nOffset Flash address of region
+        *   @param  nSize Quantity of bytes to read
+        *   @param  pBuffer Pointer to buffer to populate, e.g. a memory mapped output file. Must hold nSize bytes.
+        *   @param  nInFlight Quantity of ESP_READ_BLOCK frames the stub may send before waiting for acknowledgement (Default: ESP_READ_IN_FLIGHT)
+        *   @retval bool True if all data was received and matches the MD5 calculated by the stub
+        *   @note   Requires flasher stub (see RunStub). Each frame is decoded from the serial port straight into pBuffer.
+        */
+        bool ReadFlash(unsigned int nOffset, unsigned int nSize, unsigned char* pBuffer, unsigned int nInFlight = ESP_READ_IN_FLIGHT);
+
+        /** @brief  Read and write several registers with pipelined commands
+        *   @param  vAccess List of register accesses. Read values and completion are populated in place.
+        *   @retval bool True if all accesses succeeded
+        *   @note   Frames are sent back-to-back (limited by ESP8266 UART FIFO) and responses matched in order as they arrive so a batch costs about one round-trip
+        *   @note   Accesses are performed in order and processing stops at the first failure
+        */
+        bool AccessRegs(vector<EspRegAccess>& vAccess);
+
+        /** @brief  Read several registers with pipelined commands
+        *   @param  vAddresses List of register addresses
+        *   @param  vValues Vector to populate with register values, in the same order as vAddresses
+        *   @retval bool True on success
+        */
+        bool ReadRegs(const vector<uint32_t>& vAddresses, vector<uint32_t>& vValues);
+
         /** Read the MAC address of the ESP8266
-        *   @retval string MAC address as colon separated string, e.g. 12:34:56:78:9A:BC
+        *   @retval string MAC address as colon separated string, e.g. 12:34:56:78:9A:BC or empty string on failure
         */
         string ReadMac();
 
@@ -117,32 +385,178 @@ class ESP8266
         */
         unsigned int ReadId();
 
-        /** @brief  Validate or calculate checsum of data block
-        *   @param  pData Pointer to data block to check
-        *   @param  nSize Quantity of elements in data block
-        *   @param  nChecksum Checksum value to validate (set to zero to calculate checksum of data block)
-        *   @retval int Calculated checksum or zero if calculated checksum is same as checksum parameter
+        /** @brief  Calculate checksum of data block as sent with FLASH_DATA and MEM_DATA commands
+        *   @param  pData Pointer to data block
+        *   @param  nSize Quantity of bytes in data block
+        *   @param  nSeed Initial checksum value (Default: ESP_CHECKSUM_MAGIC)
+        *   @retval int Checksum
         */
-        static int Checksum(int *pData, unsigned int nSize, int nChecksum);
+        static int Checksum(const unsigned char* pData, size_t nSize, unsigned char nSeed = ESP_CHECKSUM_MAGIC);
 
     protected:
 
     private:
         /** @brief  Synchronise ESP8266 serial port with current baud
+        *   @param  nWindow Maximum time to keep sending sync frames in milliseconds
+        *   @retval bool True when first valid sync response is received
+        *   @note   Sends a sync frame, waits briefly then sends another until the ROM responds
+        *   @note   ROM answers each sync with several responses. The rest are discarded by ReadResponse when the next command runs rather than waited for here.
+        */
+        bool Sync(int nWindow);
+
+        /** @brief  Parse a hardware reset sequence
+        *   @param  sSequence Sequence string (see ESP_RESET_CLASSIC)
+        *   @param  vSteps Vector to populate with steps
+        *   @retval bool True if sequence is valid
+        */
+        static bool ParseResetSequence(const string& sSequence, vector<EspResetStep>& vSteps);
+
+        /** @brief  Format hardware reset steps as a sequence string
+        *   @param  vSteps Steps to format
+        *   @retval string Sequence string that ParseResetSequence accepts
+        */
+        static string FormatResetSequence(const vector<EspResetStep>& vSteps);
+
+        // Check flash reset sequence scaled to nScale / 1000 of its holds connects ESP_CALIBRATE_TRIES times in a row
+        bool TryResetScale(const vector<EspResetStep>& vFull, unsigned int nScale);
+
+        /** @brief  Read a message from ESP8266, decoding using SLIP escaping into response buffer
+        *   @param  nTimeout Maximum time to wait for a complete message in milliseconds
+        *   @param  pBuffer Pointer to buffer to decode into instead of response buffer (Default: NULL)
+        *   @param  nSize Size of pBuffer. Larger frames are discarded.
         *   @retval bool True on success
+        *   @note   GetResponse() is not valid after decoding into pBuffer but m_nResponseSize holds the frame size
         */
-        bool Sync();
+        bool SlipRead(int nTimeout = ESP_SLIP_TIMEOUT, unsigned char* pBuffer = NULL, size_t nSize = 0);
 
-        /** @brief  Connect to ESP8266 in flash mode
+        /** @brief  Build and SLIP encode a command frame into the transmit buffer
+        *   @param  nOperation Command ID
+        *   @param  nSize Quantity of bytes already placed in payload buffer (see GetPayload)
+        *   @param  nChecksum Checksum of data
+        */
+        void BuildFrame(int nOperation, size_t nSize, int nChecksum);
+
+        /** @brief  Send the frame in the transmit buffer
         *   @retval bool True on success
         */
-        bool Connect();
+        bool SendFrame();
+
+        /** @brief  Count the frame in the transmit buffer as sent
+        *   @note   Called by SendFrame or when the frame is sent as part of a batch
+        */
+        void CountFrame();
+
+        /** @brief  Wait for a response to a command
+        *   @param  nOperation Command ID to match or ESP_OP_NONE to accept any response
+        *   @param  nTimeout Maximum time to wait for each frame in milliseconds
+        *   @retval bool True if matching response received
+        */
+        bool ReadResponse(int nOperation, int nTimeout);
 
-        /** @brief  Read a message from ESP8266, decoding using SLIP escaping
-        *   @param  vBuffer Vector to hold received message
+        /** @brief  Check status bytes at end of last response
+        *   @param  nOperation Command ID (for error reporting)
+        *   @param  nMinSize Minimum expected response payload size
+        *   @retval bool True if response indicates success
+        */
+        bool CheckStatus(int nOperation, size_t nMinSize);
+
+        /** @brief  Build a frame from a command descriptor (see esp8266commands.h) into the transmit buffer
+        *   @param  command Command descriptor
+        *   @param  pData Pointer to data block to append after fixed payload (Default: none)
+        *   @param  nSize Quantity of bytes in data block
+        *   @param  nChecksum Checksum of data block
+        */
+        template<class T> void BuildCommand(const T& command, const unsigned char* pData = NULL, size_t nSize = 0, int nChecksum = 0);
+
+        /** @brief  Wait for and check the response to a command descriptor
+        *   @param  nTimeout Maximum time to wait in milliseconds or zero to use command default (Default: 0)
+        *   @retval bool True if ESP8266 reported success
+        */
+        template<class T> bool WaitResponse(int nTimeout = 0);
+
+        /** @brief  Send a command described by a command descriptor and check its response status
+        *   @param  command Command descriptor
+        *   @param  pData Pointer to data block to append after fixed payload (Default: none)
+        *   @param  nSize Quantity of bytes in data block
+        *   @param  nChecksum Checksum of data block
+        *   @param  nTimeout Maximum time to wait in milliseconds or zero to use command default (Default: 0)
+        *   @retval bool True if ESP8266 reported success
+        */
+        template<class T> bool Command(const T& command, const unsigned char* pData = NULL, size_t nSize = 0, int nChecksum = 0, int nTimeout = 0);
+
+        /** @brief  Calculate quantity of bytes to request erased by FLASH_BEGIN
+        *   @param  nOffset Flash address of start of write
+        *   @param  nSize Quantity of bytes to write
+        *   @retval unsigned int Erase size that causes the ROM to erase the intended region
+        */
+        unsigned int GetEraseSize(unsigned int nOffset, unsigned int nSize);
+
+        /** @brief  Start writing to flash, erasing the target region
+        *   @param  nOffset Flash address at which to write data
+        *   @param  nSize Quantity of bytes to write
+        *   @param  nBlockSize Size of each data block
         *   @retval bool True on success
         */
-        bool SlipRead(vector<unsigned char>& vBuffer);
+        bool FlashBegin(unsigned int nOffset, unsigned int nSize, unsigned int nBlockSize);
+
+        /** @brief  Change baud of flasher stub and serial port then verify link with a register read round-trip
+        *   @param  nBaud New baud
+        *   @retval bool True if link works at new baud. On failure the link is restored at connection baud.
+        */
+        bool ChangeBaud(unsigned int nBaud);
+
+        /** @brief  Record a link error and step down to a slower baud if too many occur
+        *   @retval bool False if link could not be restored
+        */
+        bool LinkError();
+
+        /** @brief  Reconnect at connection baud and reload flasher stub after link failure
+        *   @retval bool True on success
+        */
+        bool Reconnect();
+
+        /** @brief  Write data to RAM using MEM_BEGIN / MEM_DATA
+        *   @param  nAddress RAM address at which to write data
+        *   @param  pData Pointer to data
+        *   @param  nSize Quantity of bytes to write
+        *   @retval bool True on success
+        */
+        bool WriteMem(unsigned int nAddress, const unsigned char* pData, size_t nSize);
+
+        /** @brief  Send a sequence of data blocks, building each frame while the previous is in flight
+        *   @param  pData Pointer to data
+        *   @param  nSize Quantity of bytes of data
+        *   @param  nBlockSize Size of each block
+        *   @param  bPad True to pad last block to block size with 0xFF
+        *   @param  nTimeout Maximum time to wait for each block to be acknowledged in milliseconds
+        *   @param  pCompressor Pointer to compressor to take data from as it is compressed, ignoring pData and nSize. NULL to send pData. (Default: NULL)
+        *   @param  nBlocks Quantity of blocks announced to ESP8266 when streaming from a compressor
+        *   @retval bool True on success
+        */
+        template<class T> bool SendBlocks(const unsigned char* pData, size_t nSize, unsigned int nBlockSize, bool bPad, int nTimeout, Compressor* pCompressor = NULL, unsigned int nBlocks = 0);
+
+        /** @brief  Wait for a block of data to be compressed when streaming from a compressor (see SendBlocks)
+        *   @param  pCompressor Pointer to compressor or NULL if not streaming
+        *   @param  nBlock Index of block required
+        *   @param  nBlockSize Size of each block
+        *   @param  pData Populated with pointer to compressed data
+        *   @param  nSize Quantity of compressed bytes available, updated as more are compressed
+        *   @param  bComplete True once compression is complete, when nSize is final
+        *   @param  nBlocks Quantity of blocks, reduced to the actual quantity when compression completes
+        *   @param  vChecksums Checksums of whole blocks, extended to newly compressed blocks
+        *   @retval bool True on success, false if compression failed
+        */
+        bool WaitBlock(Compressor* pCompressor, unsigned int nBlock, unsigned int nBlockSize, const unsigned char*& pData, size_t& nSize, bool& bComplete, unsigned int& nBlocks, vector<unsigned char>& vChecksums);
+
+        /** @brief  Build data block frame (e.g. FLASH_DATA) for a block of data into the transmit buffer
+        *   @param  pData Pointer to data
+        *   @param  nSize Size of data
+        *   @param  nBlock Index of block
+        *   @param  nBlockSize Size of each block
+        *   @param  bPad True to pad last block to block size with 0xFF
+        *   @param  vChecksums Precalculated checksums of whole blocks
+        */
+        template<class T> void BuildDataBlock(const unsigned char* pData, size_t nSize, unsigned int nBlock, unsigned int nBlockSize, bool bPad, vector<unsigned char>& vChecksums);
 
         /** @brief  Reads from an ESP8266 register
         *   @param  nAddress Register address
@@ -157,22 +571,33 @@ class ESP8266
         */
         bool WriteReg(int nAddress, int nValue);
 
-        /** @brief  Convert 4 consecutive bytes from a vector to an integer
-        *   @param  vBuffer Vector containing the source data
-        *   @param  nStart Position of first element in vector to convert
-        *   @retval int Converted value
-        */
-        int ToInteger(vector<unsigned char>& vBuffer, unsigned int nStart);
-
-        /** @brief  Convert an integer to big-endian bytes placing in a vector
-        *   @param  nValue Integer to convert
-        *   @param  vBuffer Vector in which to place result
-        *   @param  nStart Position of first element at which to place results in vector (default: 0)
-        */
-        void FromInteger(int nValue, vector<unsigned char>& vBuffer, unsigned int nStart = 0);
-
         Serial* m_pSerial; // Pointer to serial port
+        SlipDecoder m_slipDecoder; //Decodes SLIP frames received from serial port
         bool m_bConnected; //True if connected to ESP8266 in flash mode
+        bool m_bStub; //True if flasher stub is running
+        vector<unsigned char> m_vStub; //Flasher stub image, kept to reload after link failure
+        unsigned int m_nConnectBaud; //Baud used to connect to ROM loader
+        unsigned int m_nLinkCheck; //Register value read at connection baud used to verify link at faster baud
+        unsigned int m_nLinkErrors; //Quantity of link errors at current baud
+        unsigned int m_nLinkCommands; //Quantity of successful commands since link errors last cleared
+        vector<EspResetStep> m_vResetFlash; //Reset sequence to enter flash mode
+        vector<EspResetStep> m_vResetRun; //Reset sequence to run application
+        string m_sReset; //Name of reset sequence
+        unsigned int m_nBlockSize; //Flash write block size or zero for default
+        unsigned int m_nPipelineDepth; //Quantity of data blocks in flight or zero for default
+        unsigned long m_nFramesSent; //Quantity of command frames sent
+        unsigned int m_nConnectTime; //Duration of last successful connection in milliseconds
+        unsigned int m_nSyncFrames; //Quantity of sync frames sent during last connection
+        bool m_bSyncDrain; //True whilst late responses to connection sync frames may still arrive
         bool m_bVerbose; //True to provide verbose output
         bool m_bSilent; //True to supress all output
+        vector<unsigned char> m_vCommand; //Command frame buffer with header space reserved at start
+        vector<unsigned char> m_vTxFrame; //SLIP encoded command frame
+        vector<unsigned char> m_vTxBatch; //Concatenated SLIP encoded frames sent together by AccessRegs
+        size_t m_nTxFrameSize; //Quantity of bytes in SLIP encoded command frame
+        int m_nTxOperation; //Command ID of frame in transmit buffer
+        size_t m_nTxEscaped; //Extra bytes in transmit buffer due to SLIP escaping
+        EspStats* m_pStats; //Per-operation statistics or NULL if disabled
+        vector<unsigned char> m_vResponse; //Decoded response frame
+        size_t m_nResponseSize; //Quantity of bytes in response frame
 };
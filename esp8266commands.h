@@ -0,0 +1,299 @@
+/*  Defines ESP8266 ROM loader command descriptors
+*   Each command is a struct describing its opcode, payload layout, response size and timeout
+*/
+#pragma once
+#include <stdint.h> //provides fixed width integers
+#include <cstddef> //provides size_t
+
+    // Response status bytes appended to each response payload by the ESP8266 ROM (status, error)
+    const static size_t ESP_STATUS_SIZE = 2;
+
+    // Command timeouts in milliseconds
+    const static int ESP_TIMEOUT_DEFAULT = ESP_SLIP_TIMEOUT; //Most commands
+    const static int ESP_TIMEOUT_SYNC    = 20; //Interval between sync frames (plus transmit time) whilst waiting for ROM to respond
+    const static int ESP_TIMEOUT_ERASE   = 10000; //Flash begin erases the target region before responding
+    const static int ESP_TIMEOUT_MEM_END = 50; //ROM may jump to entry point before responding
+    const static int ESP_TIMEOUT_MD5_PER_MB = 8000; //Flasher stub reads and hashes flash at roughly this time per MB
+    const static int ESP_TIMEOUT_ERASE_PER_MB = 30000; //Flash erases at worst at roughly this time per MB
+
+    // Size of binary MD5 digest returned by flasher stub for SPI_FLASH_MD5
+    const static size_t ESP_MD5_SIZE = 16;
+
+/** @brief  Write a 32-bit value as little-endian bytes
+*   @param  pBuffer Pointer to first of 4 bytes to populate
+*   @param  nValue Value to write
+*/
+inline void PutLe32(unsigned char* pBuffer, uint32_t nValue)
+{
+    pBuffer[0] = nValue & 0xFF;
+    pBuffer[1] = (nValue >> 8) & 0xFF;
+    pBuffer[2] = (nValue >> 16) & 0xFF;
+    pBuffer[3] = (nValue >> 24) & 0xFF;
+}
+
+/** @brief  Read a 32-bit value from little-endian bytes
+*   @param  pBuffer Pointer to first of 4 bytes to read
+*   @retval uint32_t Value
+*/
+inline uint32_t GetLe32(const unsigned char* pBuffer)
+{
+    return pBuffer[0] | (pBuffer[1] << 8) | (pBuffer[2] << 16) | ((uint32_t)pBuffer[3] << 24);
+}
+
+/*  Command descriptors
+    OP              Operation code sent in header
+    SIZE            Size of fixed payload (excludes any trailing data block)
+    RESPONSE_SIZE   Minimum size of response payload
+    TIMEOUT         Time to wait for response in milliseconds
+    Serialise()     Writes fixed payload to buffer which must hold SIZE bytes
+*/
+
+struct EspFlashBegin
+{
+    static constexpr int OP = ESP_OP_FLASH_BEGIN;
+    static constexpr size_t SIZE = 16;
+    static constexpr size_t RESPONSE_SIZE = ESP_STATUS_SIZE;
+    static constexpr int TIMEOUT = ESP_TIMEOUT_ERASE;
+    uint32_t nEraseSize; //Quantity of bytes to erase
+    uint32_t nBlocks; //Quantity of data blocks to follow
+    uint32_t nBlockSize; //Size of each data block
+    uint32_t nOffset; //Flash address at which to start writing
+    void Serialise(unsigned char* pBuffer) const
+    {
+        PutLe32(pBuffer, nEraseSize);
+        PutLe32(pBuffer + 4, nBlocks);
+        PutLe32(pBuffer + 8, nBlockSize);
+        PutLe32(pBuffer + 12, nOffset);
+    }
+};
+
+struct EspFlashData
+{
+    static constexpr int OP = ESP_OP_FLASH_DATA;
+    static constexpr size_t SIZE = 16; //Followed by data block
+    static constexpr size_t RESPONSE_SIZE = ESP_STATUS_SIZE;
+    static constexpr int TIMEOUT = ESP_TIMEOUT_DEFAULT;
+    uint32_t nSize; //Quantity of bytes in data block
+    uint32_t nSequence; //Sequence number of block, starting at zero
+    void Serialise(unsigned char* pBuffer) const
+    {
+        PutLe32(pBuffer, nSize);
+        PutLe32(pBuffer + 4, nSequence);
+        PutLe32(pBuffer + 8, 0);
+        PutLe32(pBuffer + 12, 0);
+    }
+};
+
+struct EspChangeBaud
+{
+    static constexpr int OP = ESP_OP_CHANGE_BAUDRATE; //Stub only
+    static constexpr size_t SIZE = 8;
+    static constexpr size_t RESPONSE_SIZE = ESP_STATUS_SIZE;
+    static constexpr int TIMEOUT = ESP_TIMEOUT_DEFAULT;
+    uint32_t nBaud; //New baud
+    uint32_t nOldBaud; //Current baud
+    void Serialise(unsigned char* pBuffer) const
+    {
+        PutLe32(pBuffer, nBaud);
+        PutLe32(pBuffer + 4, nOldBaud);
+    }
+};
+
+struct EspFlashDeflBegin
+{
+    static constexpr int OP = ESP_OP_FLASH_DEFL_BEGIN; //Stub only
+    static constexpr size_t SIZE = 16;
+    static constexpr size_t RESPONSE_SIZE = ESP_STATUS_SIZE;
+    static constexpr int TIMEOUT = ESP_TIMEOUT_ERASE;
+    uint32_t nSize; //Quantity of uncompressed bytes to write (stub erases as required)
+    uint32_t nBlocks; //Quantity of compressed data blocks to follow
+    uint32_t nBlockSize; //Size of each compressed data block
+    uint32_t nOffset; //Flash address at which to start writing
+    void Serialise(unsigned char* pBuffer) const
+    {
+        PutLe32(pBuffer, nSize);
+        PutLe32(pBuffer + 4, nBlocks);
+        PutLe32(pBuffer + 8, nBlockSize);
+        PutLe32(pBuffer + 12, nOffset);
+    }
+};
+
+struct EspFlashDeflData
+{
+    static constexpr int OP = ESP_OP_FLASH_DEFL_DATA; //Stub only
+    static constexpr size_t SIZE = 16; //Followed by block of zlib stream
+    static constexpr size_t RESPONSE_SIZE = ESP_STATUS_SIZE;
+    static constexpr int TIMEOUT = ESP_STUB_TIMEOUT;
+    uint32_t nSize; //Quantity of bytes in data block
+    uint32_t nSequence; //Sequence number of block, starting at zero
+    void Serialise(unsigned char* pBuffer) const
+    {
+        PutLe32(pBuffer, nSize);
+        PutLe32(pBuffer + 4, nSequence);
+        PutLe32(pBuffer + 8, 0);
+        PutLe32(pBuffer + 12, 0);
+    }
+};
+
+struct EspFlashEnd
+{
+    static constexpr int OP = ESP_OP_FLASH_END;
+    static constexpr size_t SIZE = 4;
+    static constexpr size_t RESPONSE_SIZE = ESP_STATUS_SIZE;
+    static constexpr int TIMEOUT = ESP_TIMEOUT_DEFAULT;
+    uint32_t nStayInLoader; //0 to reboot, 1 to remain in loader
+    void Serialise(unsigned char* pBuffer) const
+    {
+        PutLe32(pBuffer, nStayInLoader);
+    }
+};
+
+struct EspMemBegin
+{
+    static constexpr int OP = ESP_OP_MEM_BEGIN;
+    static constexpr size_t SIZE = 16;
+    static constexpr size_t RESPONSE_SIZE = ESP_STATUS_SIZE;
+    static constexpr int TIMEOUT = ESP_TIMEOUT_DEFAULT;
+    uint32_t nSize; //Total quantity of bytes to write
+    uint32_t nBlocks; //Quantity of data blocks to follow
+    uint32_t nBlockSize; //Size of each data block
+    uint32_t nOffset; //RAM address at which to start writing
+    void Serialise(unsigned char* pBuffer) const
+    {
+        PutLe32(pBuffer, nSize);
+        PutLe32(pBuffer + 4, nBlocks);
+        PutLe32(pBuffer + 8, nBlockSize);
+        PutLe32(pBuffer + 12, nOffset);
+    }
+};
+
+struct EspMemEnd
+{
+    static constexpr int OP = ESP_OP_MEM_END;
+    static constexpr size_t SIZE = 8;
+    static constexpr size_t RESPONSE_SIZE = ESP_STATUS_SIZE;
+    static constexpr int TIMEOUT = ESP_TIMEOUT_MEM_END;
+    uint32_t nEntry; //Address to jump to or zero to remain in loader
+    void Serialise(unsigned char* pBuffer) const
+    {
+        PutLe32(pBuffer, nEntry == 0);
+        PutLe32(pBuffer + 4, nEntry);
+    }
+};
+
+struct EspMemData
+{
+    static constexpr int OP = ESP_OP_MEM_DATA;
+    static constexpr size_t SIZE = 16; //Followed by data block
+    static constexpr size_t RESPONSE_SIZE = ESP_STATUS_SIZE;
+    static constexpr int TIMEOUT = ESP_TIMEOUT_DEFAULT;
+    uint32_t nSize; //Quantity of bytes in data block
+    uint32_t nSequence; //Sequence number of block, starting at zero
+    void Serialise(unsigned char* pBuffer) const
+    {
+        PutLe32(pBuffer, nSize);
+        PutLe32(pBuffer + 4, nSequence);
+        PutLe32(pBuffer + 8, 0);
+        PutLe32(pBuffer + 12, 0);
+    }
+};
+
+struct EspSync
+{
+    static constexpr int OP = ESP_OP_SYNC;
+    static constexpr size_t SIZE = 36;
+    static constexpr size_t RESPONSE_SIZE = ESP_STATUS_SIZE;
+    static constexpr int TIMEOUT = ESP_TIMEOUT_SYNC;
+    void Serialise(unsigned char* pBuffer) const
+    {
+        pBuffer[0] = 0x07;
+        pBuffer[1] = 0x07;
+        pBuffer[2] = 0x12;
+        pBuffer[3] = 0x20;
+        for(size_t nPos = 4; nPos < SIZE; ++nPos)
+            pBuffer[nPos] = 0x55;
+    }
+};
+
+struct EspWriteReg
+{
+    static constexpr int OP = ESP_OP_WRITE_REG;
+    static constexpr size_t SIZE = 16;
+    static constexpr size_t RESPONSE_SIZE = ESP_STATUS_SIZE;
+    static constexpr int TIMEOUT = ESP_TIMEOUT_DEFAULT;
+    uint32_t nAddress; //Register address
+    uint32_t nValue; //Value to write
+    uint32_t nMask; //Mask of bits to write
+    uint32_t nDelay; //Delay after write in microseconds
+    void Serialise(unsigned char* pBuffer) const
+    {
+        PutLe32(pBuffer, nAddress);
+        PutLe32(pBuffer + 4, nValue);
+        PutLe32(pBuffer + 8, nMask);
+        PutLe32(pBuffer + 12, nDelay);
+    }
+};
+
+struct EspReadReg
+{
+    static constexpr int OP = ESP_OP_READ_REG;
+    static constexpr size_t SIZE = 4;
+    static constexpr size_t RESPONSE_SIZE = ESP_STATUS_SIZE; //Value returned in response header
+    static constexpr int TIMEOUT = ESP_TIMEOUT_DEFAULT;
+    uint32_t nAddress; //Register address
+    void Serialise(unsigned char* pBuffer) const
+    {
+        PutLe32(pBuffer, nAddress);
+    }
+};
+
+struct EspSpiFlashMd5
+{
+    static constexpr int OP = ESP_OP_SPI_FLASH_MD5; //Stub only on ESP8266
+    static constexpr size_t SIZE = 16;
+    static constexpr size_t RESPONSE_SIZE = ESP_MD5_SIZE + ESP_STATUS_SIZE; //Digest precedes status
+    static constexpr int TIMEOUT = ESP_TIMEOUT_DEFAULT; //Small regions. Scale by ESP_TIMEOUT_MD5_PER_MB for large regions.
+    uint32_t nOffset; //Flash address of region
+    uint32_t nSize; //Quantity of bytes in region
+    void Serialise(unsigned char* pBuffer) const
+    {
+        PutLe32(pBuffer, nOffset);
+        PutLe32(pBuffer + 4, nSize);
+        PutLe32(pBuffer + 8, 0);
+        PutLe32(pBuffer + 12, 0);
+    }
+};
+
+struct EspEraseRegion
+{
+    static constexpr int OP = ESP_OP_ERASE_REGION; //Stub only
+    static constexpr size_t SIZE = 8;
+    static constexpr size_t RESPONSE_SIZE = ESP_STATUS_SIZE;
+    static constexpr int TIMEOUT = ESP_TIMEOUT_ERASE; //Small regions. Scale by ESP_TIMEOUT_ERASE_PER_MB for large regions.
+    uint32_t nOffset; //Flash address of region, on a sector boundary
+    uint32_t nSize; //Quantity of bytes to erase, a multiple of ESP_FLASH_SECTOR
+    void Serialise(unsigned char* pBuffer) const
+    {
+        PutLe32(pBuffer, nOffset);
+        PutLe32(pBuffer + 4, nSize);
+    }
+};
+
+struct EspReadFlash
+{
+    static constexpr int OP = ESP_OP_READ_FLASH; //Stub only
+    static constexpr size_t SIZE = 16;
+    static constexpr size_t RESPONSE_SIZE = ESP_STATUS_SIZE; //Data follows as separate frames, each acknowledged by host, then MD5 of region
+    static constexpr int TIMEOUT = ESP_TIMEOUT_DEFAULT;
+    uint32_t nOffset; //Flash address of region
+    uint32_t nSize; //Quantity of bytes to read
+    uint32_t nBlockSize; //Size of each data frame
+    uint32_t nInFlight; //Quantity of data frames stub may send ahead of acknowledgement
+    void Serialise(unsigned char* pBuffer) const
+    {
+        PutLe32(pBuffer, nOffset);
+        PutLe32(pBuffer + 4, nSize);
+        PutLe32(pBuffer + 8, nBlockSize);
+        PutLe32(pBuffer + 12, nInFlight);
+    }
+};
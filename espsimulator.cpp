@@ -0,0 +1,571 @@
+#include "espsimulator.h"
+#include "checksum.h"
+#include "md5.h"
+#include <iostream>
+#include <fstream>
+#include <algorithm> //provides min, max, fill
+#include <string.h> //provides strerror, memset
+#include <errno.h> //provides errno
+#include <fcntl.h> //provides open, fcntl
+#include <unistd.h> //provides read, write, close
+#include <stdlib.h> //provides posix_openpt, grantpt, unlockpt, ptsname
+#include <poll.h> //provides ppoll
+#include <termios.h> //provides cfmakeraw
+
+const static size_t SIM_FRAME_SIZE = 0x10000; //Largest command frame accepted
+const static int SIM_SYNC_RESPONSES = 8; //ROM responds to each sync with this many frames
+const static int SIM_POLL_MAX = 100000; //Longest wait in microseconds so Stop() from another thread is noticed
+
+EspSimulator::EspSimulator(size_t nFlashSize) :
+    m_nMaster(-1),
+    m_nSlave(-1),
+    m_bRun(false),
+    m_bVerbose(false),
+    m_bStub(false),
+    m_nBaud(0),
+    m_nLatency(0),
+    m_dErrorRate(0),
+    m_vFlash(nFlashSize, 0xFF),
+    m_vFrame(SIM_FRAME_SIZE),
+    m_nWriteOffset(0),
+    m_nWriteBlocks(0),
+    m_nWriteBlockSize(0),
+    m_nWriteSequence(0),
+    m_nWriteSize(0),
+    m_nWritten(0),
+    m_bInflating(false),
+    m_bReading(false),
+    m_nReadOffset(0),
+    m_nReadSize(0),
+    m_nReadBlockSize(0),
+    m_nReadInFlight(0),
+    m_nReadSent(0),
+    m_nReadAcked(0),
+    m_nCommands(0),
+    m_nRxBytes(0),
+    m_nTxBytes(0),
+    m_nErrorsInjected(0),
+    m_nRejected(0),
+    m_nFlashBytes(0)
+{
+    m_slipDecoder.SetBuffer(m_vFrame.data(), m_vFrame.size());
+    //OTP words give chip ID 0xBCDE9A and MAC 18:FE:34:BC:DE:9A
+    m_mRegisters[ESP_OTP_MAC0] = 0x9A000000;
+    m_mRegisters[ESP_OTP_MAC1] = 0x0000BCDE;
+    m_mRegisters[ESP_OTP_MAC2] = 0;
+    m_mRegisters[ESP_OTP_MAC3] = 0;
+}
+
+EspSimulator::~EspSimulator()
+{
+    if(m_bInflating)
+        inflateEnd(&m_zStream);
+    if(m_nSlave >= 0)
+        close(m_nSlave);
+    if(m_nMaster >= 0)
+        close(m_nMaster);
+}
+
+bool EspSimulator::Open()
+{
+    m_nMaster = posix_openpt(O_RDWR | O_NOCTTY);
+    if(m_nMaster < 0 || grantpt(m_nMaster) < 0 || unlockpt(m_nMaster) < 0)
+    {
+        cerr << "Failed to create pseudo terminal - " << strerror(errno) << endl;
+        return false;
+    }
+    m_sPath = ptsname(m_nMaster);
+    //Hold slave open so master does not report hang-up between client sessions
+    m_nSlave = open(m_sPath.c_str(), O_RDWR | O_NOCTTY);
+    if(m_nSlave < 0)
+    {
+        cerr << "Failed to open " << m_sPath << " - " << strerror(errno) << endl;
+        return false;
+    }
+    termios tty;
+    if(tcgetattr(m_nSlave, &tty) == 0)
+    {
+        cfmakeraw(&tty);
+        tcsetattr(m_nSlave, TCSANOW, &tty);
+    }
+    fcntl(m_nMaster, F_SETFL, fcntl(m_nMaster, F_GETFL) | O_NONBLOCK);
+    m_tRxFree = m_tTxFree = m_tFrame = chrono::steady_clock::now();
+    return true;
+}
+
+void EspSimulator::SetErrorRate(double dRate, unsigned int nSeed)
+{
+    m_dErrorRate = dRate;
+    m_random.seed(nSeed);
+}
+
+bool EspSimulator::Run()
+{
+    if(m_nMaster < 0)
+        return false;
+    m_bRun = true;
+    unsigned char pBuffer[4096];
+    pollfd fdPoll;
+    fdPoll.fd = m_nMaster;
+    while(m_bRun)
+    {
+        if(!Flush())
+            return false;
+        fdPoll.events = POLLIN | (m_vTxPending.empty() ? 0 : POLLOUT);
+        int nWait = GetWait();
+        if(nWait < 0 || nWait > SIM_POLL_MAX)
+            nWait = SIM_POLL_MAX;
+        timespec tsWait;
+        tsWait.tv_sec = nWait / 1000000;
+        tsWait.tv_nsec = (nWait % 1000000) * 1000;
+        int nResult = ppoll(&fdPoll, 1, &tsWait, NULL);
+        if(nResult < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            cerr << "Simulator failed to wait for data - " << strerror(errno) << endl;
+            return false;
+        }
+        if(nResult == 0 || !(fdPoll.revents & POLLIN))
+            continue;
+        ssize_t nRead = read(m_nMaster, pBuffer, sizeof(pBuffer));
+        if(nRead > 0)
+            Receive(pBuffer, nRead);
+        else if(nRead < 0 && errno != EAGAIN && errno != EINTR)
+        {
+            cerr << "Simulator failed to read - " << strerror(errno) << endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+chrono::nanoseconds EspSimulator::ByteTime(size_t nSize)
+{
+    if(m_nBaud == 0)
+        return chrono::nanoseconds(0);
+    return chrono::nanoseconds((uint64_t)nSize * 10000000000ULL / m_nBaud); //10 bits per byte
+}
+
+void EspSimulator::Receive(unsigned char* pData, size_t nSize)
+{
+    m_nRxBytes += nSize;
+    Corrupt(pData, nSize);
+    //Data cannot arrive faster than the simulated line so it completes when the line has delivered it
+    TimePoint tNow = chrono::steady_clock::now();
+    m_tRxFree = max(tNow, m_tRxFree) + ByteTime(nSize);
+    m_tFrame = m_tRxFree;
+    size_t nPos = 0;
+    while(nPos < nSize)
+    {
+        nPos += m_slipDecoder.Decode(pData + nPos, nSize - nPos);
+        if(m_slipDecoder.IsComplete())
+        {
+            HandleCommand();
+            m_slipDecoder.Restart();
+        }
+    }
+}
+
+void EspSimulator::HandleCommand()
+{
+    size_t nSize = m_slipDecoder.GetSize();
+    const unsigned char* pFrame = m_vFrame.data();
+    if(m_bReading)
+    {
+        //Stub treats each frame as acknowledgement of READ_FLASH data until all data is acknowledged
+        if(nSize == 4)
+        {
+            m_nReadAcked = GetLe32(pFrame);
+            SendReadBlocks();
+            return;
+        }
+        m_bReading = false; //Host abandoned read
+    }
+    if(nSize < (size_t)ESP_HEADER_SIZE || pFrame[ESP_HEADER_MSG_TYPE] != ESP_MSGTYPE_COMMAND)
+        return; //ROM ignores anything that is not a command
+    int nOp = pFrame[ESP_HEADER_OP];
+    size_t nLen = pFrame[ESP_HEADER_LEN] | (pFrame[ESP_HEADER_LEN + 1] << 8);
+    uint32_t nChecksum = GetLe32(pFrame + ESP_HEADER_CHECKSUM);
+    const unsigned char* pData = pFrame + ESP_HEADER_SIZE;
+    if(m_bVerbose)
+        cout << "SIM: command 0x" << hex << nOp << dec << " length " << nLen << (m_bStub ? " (stub)" : "") << endl;
+    if(nLen != nSize - ESP_HEADER_SIZE)
+    {
+        Respond(nOp, 0, SIM_ERROR_INVALID);
+        return;
+    }
+    ++m_nCommands;
+    bool bStubOnly = (nOp == ESP_OP_CHANGE_BAUDRATE || nOp == ESP_OP_FLASH_DEFL_BEGIN || nOp == ESP_OP_FLASH_DEFL_DATA
+        || nOp == ESP_OP_FLASH_DEFL_END || nOp == ESP_OP_ERASE_FLASH || nOp == ESP_OP_ERASE_REGION || nOp == ESP_OP_SPI_FLASH_MD5
+        || nOp == ESP_OP_READ_FLASH);
+    if(bStubOnly && !m_bStub)
+    {
+        Respond(nOp, 0, SIM_ERROR_INVALID);
+        return;
+    }
+    switch(nOp)
+    {
+        case ESP_OP_SYNC:
+            if(nLen != EspSync::SIZE)
+                break;
+            //Host only syncs after a hardware reset which returns to the ROM loader
+            m_bStub = false;
+            for(int nCount = 0; nCount < SIM_SYNC_RESPONSES; ++nCount)
+                Respond(nOp, 0);
+            return;
+        case ESP_OP_READ_REG:
+        {
+            if(nLen != EspReadReg::SIZE)
+                break;
+            auto it = m_mRegisters.find(GetLe32(pData));
+            Respond(nOp, it == m_mRegisters.end() ? 0 : it->second);
+            return;
+        }
+        case ESP_OP_WRITE_REG:
+        {
+            if(nLen != EspWriteReg::SIZE)
+                break;
+            uint32_t nMask = GetLe32(pData + 8);
+            uint32_t& nRegister = m_mRegisters[GetLe32(pData)];
+            nRegister = (nRegister & ~nMask) | (GetLe32(pData + 4) & nMask);
+            Respond(nOp, 0);
+            return;
+        }
+        case ESP_OP_FLASH_BEGIN:
+        case ESP_OP_FLASH_DEFL_BEGIN:
+        case ESP_OP_MEM_BEGIN:
+        {
+            if(nLen != EspFlashBegin::SIZE)
+                break;
+            m_nWriteSize = GetLe32(pData);
+            m_nWriteBlocks = GetLe32(pData + 4);
+            m_nWriteBlockSize = GetLe32(pData + 8);
+            m_nWriteOffset = GetLe32(pData + 12);
+            m_nWriteSequence = 0;
+            m_nWritten = 0;
+            if(m_bInflating)
+            {
+                inflateEnd(&m_zStream);
+                m_bInflating = false;
+            }
+            if(nOp == ESP_OP_FLASH_BEGIN)
+            {
+                //ROM erases more than requested (see ESP8266::GetEraseSize) whereas stub erases exactly
+                unsigned int nErase = m_bStub ? m_nWriteSize : EraseSize(m_nWriteOffset, m_nWriteSize);
+                if(!Erase(m_nWriteOffset, nErase))
+                {
+                    Respond(nOp, 0, SIM_ERROR_FAILED);
+                    return;
+                }
+            }
+            else if(nOp == ESP_OP_FLASH_DEFL_BEGIN)
+            {
+                memset(&m_zStream, 0, sizeof(m_zStream));
+                if(!Erase(m_nWriteOffset, m_nWriteSize) || inflateInit(&m_zStream) != Z_OK)
+                {
+                    Respond(nOp, 0, SIM_ERROR_FAILED);
+                    return;
+                }
+                m_bInflating = true;
+            }
+            Respond(nOp, 0);
+            return;
+        }
+        case ESP_OP_FLASH_DATA:
+        case ESP_OP_FLASH_DEFL_DATA:
+        case ESP_OP_MEM_DATA:
+        {
+            if(nLen < EspFlashData::SIZE)
+                break;
+            uint32_t nDataSize = GetLe32(pData);
+            uint32_t nSequence = GetLe32(pData + 4);
+            const unsigned char* pBlock = pData + EspFlashData::SIZE;
+            if(nDataSize != nLen - EspFlashData::SIZE || nDataSize > m_nWriteBlockSize || nSequence >= m_nWriteBlocks)
+                break;
+            if(XorChecksum(pBlock, nDataSize, ESP_CHECKSUM_MAGIC) != (nChecksum & 0xFF))
+            {
+                Respond(nOp, 0, SIM_ERROR_CHECKSUM);
+                return;
+            }
+            if(nOp == ESP_OP_MEM_DATA)
+            {
+                //RAM content is not executed so only the transfer is checked
+                Respond(nOp, 0);
+                return;
+            }
+            if(nOp == ESP_OP_FLASH_DATA)
+            {
+                Respond(nOp, 0, Program(m_nWriteOffset + nSequence * m_nWriteBlockSize, pBlock, nDataSize) ? 0 : SIM_ERROR_FLASH);
+                return;
+            }
+            //Compressed stream must be inflated in order. A repeated block was already inflated before its response was lost.
+            if(nSequence < m_nWriteSequence)
+            {
+                Respond(nOp, 0);
+                return;
+            }
+            if(nSequence != m_nWriteSequence || !m_bInflating)
+                break;
+            unsigned char pOut[4096];
+            m_zStream.next_in = const_cast<unsigned char*>(pBlock);
+            m_zStream.avail_in = nDataSize;
+            int nResult;
+            do
+            {
+                m_zStream.next_out = pOut;
+                m_zStream.avail_out = sizeof(pOut);
+                nResult = inflate(&m_zStream, Z_NO_FLUSH);
+                size_t nOut = sizeof(pOut) - m_zStream.avail_out;
+                if((nResult != Z_OK && nResult != Z_STREAM_END && nResult != Z_BUF_ERROR) || !Program(m_nWriteOffset + m_nWritten, pOut, nOut))
+                {
+                    Respond(nOp, 0, SIM_ERROR_INFLATE);
+                    return;
+                }
+                m_nWritten += nOut;
+            } while(nResult == Z_OK && (m_zStream.avail_in || m_zStream.avail_out == 0));
+            ++m_nWriteSequence;
+            Respond(nOp, 0);
+            return;
+        }
+        case ESP_OP_FLASH_END:
+        case ESP_OP_FLASH_DEFL_END:
+            if(nLen != EspFlashEnd::SIZE)
+                break;
+            Respond(nOp, 0);
+            if(GetLe32(pData) == 0)
+                m_bStub = false; //Reboot leaves loader
+            return;
+        case ESP_OP_MEM_END:
+        {
+            if(nLen != EspMemEnd::SIZE)
+                break;
+            Respond(nOp, 0);
+            if(GetLe32(pData + 4) != 0)
+            {
+                //Jump to uploaded flasher stub which announces itself
+                m_bStub = true;
+                const unsigned char pHello[] = {SLIP_END, 'O', 'H', 'A', 'I', SLIP_END};
+                Send(pHello, sizeof(pHello));
+            }
+            return;
+        }
+        case ESP_OP_CHANGE_BAUDRATE:
+            if(nLen != EspChangeBaud::SIZE)
+                break;
+            Respond(nOp, 0);
+            if(m_nBaud)
+                m_nBaud = GetLe32(pData);
+            return;
+        case ESP_OP_ERASE_FLASH:
+            Respond(nOp, 0, Erase(0, m_vFlash.size()) ? 0 : SIM_ERROR_FAILED);
+            return;
+        case ESP_OP_ERASE_REGION:
+            if(nLen != EspEraseRegion::SIZE || GetLe32(pData) % ESP_FLASH_SECTOR || GetLe32(pData + 4) % ESP_FLASH_SECTOR)
+                break;
+            Respond(nOp, 0, Erase(GetLe32(pData), GetLe32(pData + 4)) ? 0 : SIM_ERROR_FAILED);
+            return;
+        case ESP_OP_SPI_FLASH_MD5:
+        {
+            if(nLen != EspSpiFlashMd5::SIZE)
+                break;
+            uint32_t nOffset = GetLe32(pData);
+            uint32_t nMd5Size = GetLe32(pData + 4);
+            if((size_t)nOffset + nMd5Size > m_vFlash.size())
+            {
+                Respond(nOp, 0, SIM_ERROR_FAILED);
+                return;
+            }
+            //Stub returns binary digest (ROM of later chips returns hexadecimal)
+            Md5Digest digest = Md5::Hash(m_vFlash.data() + nOffset, nMd5Size);
+            Respond(nOp, 0, 0, digest.data(), digest.size());
+            return;
+        }
+        case ESP_OP_READ_FLASH:
+        {
+            if(nLen != EspReadFlash::SIZE)
+                break;
+            m_nReadOffset = GetLe32(pData);
+            m_nReadSize = GetLe32(pData + 4);
+            m_nReadBlockSize = GetLe32(pData + 8);
+            m_nReadInFlight = GetLe32(pData + 12);
+            if((size_t)m_nReadOffset + m_nReadSize > m_vFlash.size() || m_nReadBlockSize == 0 || m_nReadBlockSize > SIM_FRAME_SIZE || m_nReadInFlight == 0)
+            {
+                Respond(nOp, 0, SIM_ERROR_FAILED);
+                return;
+            }
+            Respond(nOp, 0);
+            m_nReadSent = 0;
+            m_nReadAcked = 0;
+            m_bReading = true;
+            SendReadBlocks();
+            return;
+        }
+        default:
+            break;
+    }
+    //Unsupported command or invalid parameters
+    Respond(nOp, 0, SIM_ERROR_INVALID);
+}
+
+void EspSimulator::Respond(int nOperation, uint32_t nValue, unsigned char nError, const unsigned char* pData, size_t nSize)
+{
+    if(nError)
+        ++m_nRejected;
+    vector<unsigned char> vResponse(ESP_HEADER_SIZE + nSize + ESP_STATUS_SIZE);
+    vResponse[ESP_HEADER_MSG_TYPE] = ESP_MSGTYPE_RESPONSE;
+    vResponse[ESP_HEADER_OP] = nOperation;
+    vResponse[ESP_HEADER_LEN] = (nSize + ESP_STATUS_SIZE) & 0xFF;
+    vResponse[ESP_HEADER_LEN + 1] = ((nSize + ESP_STATUS_SIZE) >> 8) & 0xFF;
+    PutLe32(vResponse.data() + ESP_HEADER_VALUE, nValue);
+    if(nSize)
+        copy(pData, pData + nSize, vResponse.begin() + ESP_HEADER_SIZE);
+    vResponse[ESP_HEADER_SIZE + nSize] = nError ? 1 : 0;
+    vResponse[ESP_HEADER_SIZE + nSize + 1] = nError;
+    SendFrame(vResponse.data(), vResponse.size());
+}
+
+void EspSimulator::SendFrame(const unsigned char* pData, size_t nSize)
+{
+    vector<unsigned char> vFrame(2 * nSize + 2);
+    size_t nFrameSize = 0;
+    vFrame[nFrameSize++] = SLIP_END;
+    nFrameSize += SlipEncode(pData, nSize, vFrame.data() + nFrameSize);
+    vFrame[nFrameSize++] = SLIP_END;
+    Send(vFrame.data(), nFrameSize);
+}
+
+void EspSimulator::SendReadBlocks()
+{
+    while(m_nReadSent < m_nReadSize && m_nReadSent - min(m_nReadAcked, m_nReadSent) < m_nReadInFlight * m_nReadBlockSize)
+    {
+        unsigned int nBlock = min(m_nReadBlockSize, m_nReadSize - m_nReadSent);
+        SendFrame(m_vFlash.data() + m_nReadOffset + m_nReadSent, nBlock);
+        m_nReadSent += nBlock;
+    }
+    if(m_nReadAcked < m_nReadSize)
+        return;
+    Md5Digest digest = Md5::Hash(m_vFlash.data() + m_nReadOffset, m_nReadSize);
+    SendFrame(digest.data(), digest.size());
+    m_bReading = false;
+}
+
+void EspSimulator::Send(const unsigned char* pData, size_t nSize)
+{
+    vector<unsigned char> vData(pData, pData + nSize);
+    Corrupt(vData.data(), nSize);
+    //Response starts after latency once line is free and arrives when last byte has been sent
+    TimePoint tDue = m_tFrame + chrono::microseconds(m_nLatency);
+    if(m_nBaud)
+    {
+        m_tTxFree = max(tDue, m_tTxFree) + ByteTime(nSize);
+        tDue = m_tTxFree;
+    }
+    if(m_qTx.empty() && tDue <= chrono::steady_clock::now())
+        m_vTxPending.insert(m_vTxPending.end(), vData.begin(), vData.end());
+    else
+        m_qTx.push_back(make_pair(tDue, vData));
+}
+
+bool EspSimulator::Flush()
+{
+    TimePoint tNow = chrono::steady_clock::now();
+    while(!m_qTx.empty() && m_qTx.front().first <= tNow)
+    {
+        m_vTxPending.insert(m_vTxPending.end(), m_qTx.front().second.begin(), m_qTx.front().second.end());
+        m_qTx.pop_front();
+    }
+    while(!m_vTxPending.empty())
+    {
+        ssize_t nWritten = write(m_nMaster, m_vTxPending.data(), m_vTxPending.size());
+        if(nWritten < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            if(errno == EAGAIN || errno == EWOULDBLOCK)
+                return true; //Client not reading so wait for POLLOUT
+            cerr << "Simulator failed to write - " << strerror(errno) << endl;
+            return false;
+        }
+        m_nTxBytes += nWritten;
+        m_vTxPending.erase(m_vTxPending.begin(), m_vTxPending.begin() + nWritten);
+    }
+    return true;
+}
+
+int EspSimulator::GetWait()
+{
+    if(m_qTx.empty())
+        return -1;
+    long long nWait = chrono::duration_cast<chrono::microseconds>(m_qTx.front().first - chrono::steady_clock::now()).count();
+    if(nWait < 0)
+        return 0;
+    return nWait > SIM_POLL_MAX ? SIM_POLL_MAX : nWait;
+}
+
+void EspSimulator::Corrupt(unsigned char* pData, size_t nSize)
+{
+    if(m_dErrorRate <= 0)
+        return;
+    //Skip directly to each corrupted byte rather than testing every byte
+    geometric_distribution<size_t> gap(m_dErrorRate);
+    uniform_int_distribution<int> bit(0, 7);
+    for(size_t nPos = gap(m_random); nPos < nSize; nPos += gap(m_random) + 1)
+    {
+        pData[nPos] ^= (1 << bit(m_random));
+        ++m_nErrorsInjected;
+    }
+}
+
+unsigned int EspSimulator::EraseSize(unsigned int nOffset, unsigned int nSize)
+{
+    //ROM erases the sectors before the next 64K boundary twice over (inverse of ESP8266::GetEraseSize)
+    unsigned int nSectors = (nSize + ESP_FLASH_SECTOR - 1) / ESP_FLASH_SECTOR;
+    unsigned int nHeadSectors = ESP_FLASH_SECTOR_PER_BLOCK - ((nOffset / ESP_FLASH_SECTOR) % ESP_FLASH_SECTOR_PER_BLOCK);
+    return (nSectors + min(nSectors, nHeadSectors)) * ESP_FLASH_SECTOR;
+}
+
+bool EspSimulator::Erase(unsigned int nOffset, unsigned int nSize)
+{
+    size_t nStart = nOffset / ESP_FLASH_SECTOR * ESP_FLASH_SECTOR;
+    size_t nEnd = ((size_t)nOffset + nSize + ESP_FLASH_SECTOR - 1) / ESP_FLASH_SECTOR * ESP_FLASH_SECTOR;
+    if(nStart > m_vFlash.size())
+        return false;
+    fill(m_vFlash.begin() + nStart, m_vFlash.begin() + min(nEnd, m_vFlash.size()), 0xFF);
+    return true;
+}
+
+bool EspSimulator::Program(unsigned int nOffset, const unsigned char* pData, size_t nSize)
+{
+    if((size_t)nOffset + nSize > m_vFlash.size())
+        return false;
+    unsigned char* pFlash = m_vFlash.data() + nOffset;
+    for(size_t nPos = 0; nPos < nSize; ++nPos)
+        pFlash[nPos] &= pData[nPos];
+    m_nFlashBytes += nSize;
+    return true;
+}
+
+bool EspSimulator::LoadFlash(string sFilename)
+{
+    ifstream file(sFilename, ios::binary);
+    if(!file)
+        return false;
+    fill(m_vFlash.begin(), m_vFlash.end(), 0xFF);
+    file.read(reinterpret_cast<char*>(m_vFlash.data()), m_vFlash.size());
+    return !file.bad();
+}
+
+bool EspSimulator::SaveFlash(string sFilename)
+{
+    ofstream file(sFilename, ios::binary | ios::trunc);
+    file.write(reinterpret_cast<const char*>(m_vFlash.data()), m_vFlash.size());
+    return file.good();
+}
+
+void EspSimulator::ShowStats()
+{
+    cout << "Simulator processed " << m_nCommands << " commands (" << m_nRejected << " rejected), received "
+        << m_nRxBytes << " bytes, sent " << m_nTxBytes << " bytes, wrote " << m_nFlashBytes << " bytes to flash, injected "
+        << m_nErrorsInjected << " errors" << endl;
+}
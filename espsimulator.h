@@ -0,0 +1,164 @@
+/** ESP8266 ROM loader simulator
+*   Author: agent
+*   Date: 2026-10-17
+*   License: LGPL
+*/
+
+#pragma once
+#include "esp8266.h"
+#include "slip.h"
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <random>
+#include <chrono>
+#include <atomic>
+#include <stdint.h> //provides fixed width integers
+#include <zlib.h> //provides inflate for compressed flash writes
+
+using namespace std;
+
+const static size_t SIM_FLASH_SIZE = 0x400000; //Default size of simulated flash (4MB)
+
+// Error codes returned in second status byte
+const static unsigned char SIM_ERROR_INVALID = 0x05; //Received message is invalid
+const static unsigned char SIM_ERROR_FAILED = 0x06; //Failed to act on received message
+const static unsigned char SIM_ERROR_CHECKSUM = 0x07; //Invalid data checksum
+const static unsigned char SIM_ERROR_FLASH = 0x08; //Flash write error
+const static unsigned char SIM_ERROR_INFLATE = 0xC3; //Stub failed to inflate compressed data
+
+class EspSimulator
+{
+    public:
+        /** @brief  Instantiate a simulator
+        *   @param  nFlashSize Size of simulated flash in bytes (Default: SIM_FLASH_SIZE)
+        */
+        EspSimulator(size_t nFlashSize = SIM_FLASH_SIZE);
+        virtual ~EspSimulator();
+
+        /** @brief  Create the pseudo terminal
+        *   @retval bool True on success
+        *   @note   Use GetPath() to find the device name to pass to Serial / ESP8266
+        */
+        bool Open();
+
+        /** @brief  Get the name of the pseudo terminal device
+        *   @retval string Device path, e.g. /dev/pts/3
+        */
+        string GetPath() {return m_sPath;};
+
+        /** @brief  Process commands until Stop() is called
+        *   @retval bool True if stopped normally, false on error
+        */
+        bool Run();
+
+        /** @brief  Request Run() to return
+        *   @note   Safe to call from a signal handler or another thread
+        */
+        void Stop() {m_bRun = false;};
+
+        /** @brief  Throttle data to the rate of a serial line
+        *   @param  nBaud Baud rate to simulate at 10 bits per byte or zero for unlimited rate (Default: 0)
+        *   @note   Follows CHANGE_BAUDRATE commands once set
+        */
+        void SetBaud(unsigned int nBaud) {m_nBaud = nBaud;};
+
+        /** @brief  Set time between receiving a command and starting its response
+        *   @param  nLatency Latency in microseconds (Default: 0)
+        */
+        void SetLatency(unsigned int nLatency) {m_nLatency = nLatency;};
+
+        /** @brief  Inject random bit errors
+        *   @param  dRate Probability of each byte in either direction being corrupted (Default: 0)
+        *   @param  nSeed Seed for random number generator so runs are repeatable
+        */
+        void SetErrorRate(double dRate, unsigned int nSeed = 1);
+
+        /** @brief  Set verbose mode
+        *   @param  bVerbose True to log each command
+        */
+        void SetVerbose(bool bVerbose) {m_bVerbose = bVerbose;};
+
+        /** @brief  Load simulated flash content from a file
+        *   @param  sFilename Name of file. Flash beyond the end of the file is erased (0xFF).
+        *   @retval bool True on success
+        */
+        bool LoadFlash(string sFilename);
+
+        /** @brief  Save simulated flash content to a file
+        *   @param  sFilename Name of file
+        *   @retval bool True on success
+        */
+        bool SaveFlash(string sFilename);
+
+        /** @brief  Get direct access to the simulated flash
+        *   @retval vector<unsigned char>& Flash content
+        */
+        vector<unsigned char>& GetFlash() {return m_vFlash;};
+
+        /** @brief  Print summary of activity to stdout
+        */
+        void ShowStats();
+
+    private:
+        typedef chrono::steady_clock::time_point TimePoint;
+
+        void Receive(unsigned char* pData, size_t nSize); // Decode received data, handling each complete frame (data may be corrupted in place)
+        void HandleCommand(); // Act on the command in m_vFrame
+        void Respond(int nOperation, uint32_t nValue, unsigned char nError = 0, const unsigned char* pData = NULL, size_t nSize = 0); // Queue a response frame. nError non-zero indicates failure.
+        void SendFrame(const unsigned char* pData, size_t nSize); // SLIP encode and queue a frame
+        void SendReadBlocks(); // Queue READ_FLASH data frames allowed by acknowledgements, then the MD5 of the region once all are acknowledged
+        void Send(const unsigned char* pData, size_t nSize); // Queue raw bytes for transmission after latency and line time
+        bool Flush(); // Write any queued data that is due. Returns false on error
+        int GetWait(); // Microseconds until next queued data is due or -1 if none
+        void Corrupt(unsigned char* pData, size_t nSize); // Apply random bit errors
+        unsigned int EraseSize(unsigned int nOffset, unsigned int nSize); // Bytes the ROM actually erases for FLASH_BEGIN (see ESP8266::GetEraseSize)
+        bool Erase(unsigned int nOffset, unsigned int nSize); // Erase whole sectors covering region
+        bool Program(unsigned int nOffset, const unsigned char* pData, size_t nSize); // Write to flash, clearing bits only as NOR flash does
+        chrono::nanoseconds ByteTime(size_t nSize); // Time to transfer nSize bytes at simulated baud
+
+        int m_nMaster; //File descriptor of pseudo terminal master
+        int m_nSlave; //File descriptor of slave held open so master survives client disconnecting
+        string m_sPath; //Name of pseudo terminal slave device
+        atomic<bool> m_bRun; //False to stop Run()
+        bool m_bVerbose; //True to log commands
+        bool m_bStub; //True if simulated flasher stub is running
+        unsigned int m_nBaud; //Simulated line rate or zero for unlimited
+        unsigned int m_nLatency; //Response latency in microseconds
+        double m_dErrorRate; //Probability of corrupting each byte
+        mt19937 m_random; //Random number generator for error injection
+        vector<unsigned char> m_vFlash; //Simulated flash
+        map<uint32_t,uint32_t> m_mRegisters; //Simulated registers
+        SlipDecoder m_slipDecoder; //Decodes received frames
+        vector<unsigned char> m_vFrame; //Received frame buffer
+        TimePoint m_tRxFree; //Time at which receive line finishes delivering data already received
+        TimePoint m_tTxFree; //Time at which transmit line finishes sending data already queued
+        TimePoint m_tFrame; //Time at which current frame was completely received
+        deque<pair<TimePoint, vector<unsigned char> > > m_qTx; //Data awaiting transmission with time it is due
+        vector<unsigned char> m_vTxPending; //Data due but not yet accepted by pseudo terminal
+        //Current write operation (FLASH_BEGIN, FLASH_DEFL_BEGIN or MEM_BEGIN)
+        unsigned int m_nWriteOffset; //Address of first block
+        unsigned int m_nWriteBlocks; //Quantity of blocks expected
+        unsigned int m_nWriteBlockSize; //Size of each block
+        unsigned int m_nWriteSequence; //Next expected sequence number
+        unsigned int m_nWriteSize; //Total quantity of bytes (uncompressed) to write
+        unsigned int m_nWritten; //Quantity of bytes (uncompressed) written
+        z_stream m_zStream; //Inflate state for compressed write
+        bool m_bInflating; //True if m_zStream is initialised
+        //Current read operation (READ_FLASH)
+        bool m_bReading; //True whilst host is acknowledging data frames
+        unsigned int m_nReadOffset; //Flash address of region
+        unsigned int m_nReadSize; //Quantity of bytes to send
+        unsigned int m_nReadBlockSize; //Size of each data frame
+        unsigned int m_nReadInFlight; //Quantity of data frames that may be unacknowledged
+        unsigned int m_nReadSent; //Quantity of bytes sent
+        unsigned int m_nReadAcked; //Quantity of bytes acknowledged by host
+        //Statistics
+        unsigned long m_nCommands; //Quantity of valid commands processed
+        unsigned long m_nRxBytes; //Quantity of bytes received
+        unsigned long m_nTxBytes; //Quantity of bytes sent
+        unsigned long m_nErrorsInjected; //Quantity of bytes corrupted
+        unsigned long m_nRejected; //Quantity of commands failed with error status
+        unsigned long m_nFlashBytes; //Quantity of bytes written to flash
+};
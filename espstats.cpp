@@ -0,0 +1,224 @@
+#include "espstats.h"
+#include "esp8266.h"
+#include <iomanip>
+#include <sstream>
+#include <cstring> //provides memset
+
+EspStats::EspStats()
+{
+    Reset();
+}
+
+void EspStats::Reset()
+{
+    memset(m_aOps, 0, sizeof(m_aOps));
+    m_nHead = m_nTail = 0;
+    m_nLastOp = ESP_OP_NONE;
+    m_bFirstByte = false;
+}
+
+void EspStats::Sent(int nOperation, size_t nBytes, size_t nEscaped)
+{
+    EspOpStats& stats = m_aOps[nOperation & 0xFF];
+    ++stats.nCommands;
+    stats.nTxBytes += nBytes;
+    stats.nTxEscaped += nEscaped;
+    if(m_nHead == m_nTail)
+        m_bFirstByte = false; //Data received before this command cannot be its response
+    else if(m_nHead - m_nTail == ESP_STATS_INFLIGHT)
+        ++m_nTail; //Too many outstanding so forget oldest
+    m_aSent[m_nHead % ESP_STATS_INFLIGHT] = chrono::steady_clock::now();
+    m_aSentOp[m_nHead % ESP_STATS_INFLIGHT] = nOperation;
+    ++m_nHead;
+    m_nLastOp = nOperation;
+}
+
+void EspStats::Received(size_t nBytes, size_t nEscaped, size_t nJunk, size_t nErrors)
+{
+    int nOperation = (m_nHead != m_nTail) ? m_aSentOp[m_nTail % ESP_STATS_INFLIGHT] : m_nLastOp;
+    EspOpStats& stats = m_aOps[nOperation & 0xFF];
+    stats.nRxBytes += nBytes;
+    stats.nRxEscaped += nEscaped;
+    stats.nRxJunk += nJunk;
+    stats.nResyncs += nErrors;
+}
+
+void EspStats::FirstByte()
+{
+    if(m_bFirstByte)
+        return;
+    m_tFirstByte = chrono::steady_clock::now();
+    m_bFirstByte = true;
+}
+
+void EspStats::Response(int nOperation)
+{
+    EspOpStats& stats = m_aOps[nOperation & 0xFF];
+    ++stats.nResponses;
+    if(m_nHead != m_nTail)
+    {
+        //Responses arrive in order so belong to the oldest outstanding command
+        TimePoint tSent = m_aSent[m_nTail++ % ESP_STATS_INFLIGHT];
+        TimePoint tNow = chrono::steady_clock::now();
+        uint64_t nRtt = chrono::duration_cast<chrono::microseconds>(tNow - tSent).count();
+        stats.nRttTotal += nRtt;
+        if(nRtt > stats.nRttMax)
+            stats.nRttMax = nRtt;
+        Record(stats.aRtt, nRtt);
+        //First byte may have been received before a pipelined command was sent
+        uint64_t nTtfb = 0;
+        if(m_bFirstByte && m_tFirstByte > tSent)
+            nTtfb = chrono::duration_cast<chrono::microseconds>(m_tFirstByte - tSent).count();
+        stats.nTtfbTotal += nTtfb;
+        Record(stats.aTtfb, nTtfb);
+    }
+    m_bFirstByte = false;
+}
+
+void EspStats::Resync(int nOperation)
+{
+    ++m_aOps[nOperation & 0xFF].nResyncs;
+    m_bFirstByte = false;
+}
+
+void EspStats::Failure(int nOperation, bool bChecksum)
+{
+    EspOpStats& stats = m_aOps[nOperation & 0xFF];
+    ++stats.nFailures;
+    if(bChecksum)
+        ++stats.nChecksumFailures;
+}
+
+void EspStats::Timeout(int nOperation)
+{
+    ++m_aOps[nOperation & 0xFF].nTimeouts;
+    //Oldest command will not be answered so its send time must not be matched to the next response
+    if(m_nHead != m_nTail)
+        ++m_nTail;
+    m_bFirstByte = false;
+}
+
+void EspStats::Retry(int nOperation)
+{
+    ++m_aOps[nOperation & 0xFF].nRetries;
+    Restart();
+}
+
+void EspStats::Restart()
+{
+    m_nTail = m_nHead;
+    m_bFirstByte = false;
+}
+
+void EspStats::Record(unsigned long* pHistogram, uint64_t nMicroseconds)
+{
+    int nBucket = 0;
+    while(nBucket < ESP_STATS_BUCKETS - 1 && nMicroseconds >= (1ULL << nBucket))
+        ++nBucket;
+    ++pHistogram[nBucket];
+}
+
+uint64_t EspStats::Percentile(const unsigned long* pHistogram, unsigned long nCount, unsigned int nPercent)
+{
+    //Smallest bucket bound with at least nPercent of samples at or below it
+    unsigned long nTarget = (nCount * nPercent + 99) / 100;
+    unsigned long nTotal = 0;
+    for(int nBucket = 0; nBucket < ESP_STATS_BUCKETS; ++nBucket)
+    {
+        nTotal += pHistogram[nBucket];
+        if(nTotal >= nTarget)
+            return 1ULL << nBucket;
+    }
+    return 1ULL << (ESP_STATS_BUCKETS - 1);
+}
+
+string EspStats::GetName(int nOperation)
+{
+    switch(nOperation)
+    {
+        case ESP_OP_FLASH_BEGIN: return "FLASH_BEGIN";
+        case ESP_OP_FLASH_DATA: return "FLASH_DATA";
+        case ESP_OP_FLASH_END: return "FLASH_END";
+        case ESP_OP_MEM_BEGIN: return "MEM_BEGIN";
+        case ESP_OP_MEM_END: return "MEM_END";
+        case ESP_OP_MEM_DATA: return "MEM_DATA";
+        case ESP_OP_SYNC: return "SYNC";
+        case ESP_OP_WRITE_REG: return "WRITE_REG";
+        case ESP_OP_READ_REG: return "READ_REG";
+        case ESP_OP_CHANGE_BAUDRATE: return "CHANGE_BAUDRATE";
+        case ESP_OP_FLASH_DEFL_BEGIN: return "FLASH_DEFL_BEGIN";
+        case ESP_OP_FLASH_DEFL_DATA: return "FLASH_DEFL_DATA";
+        case ESP_OP_FLASH_DEFL_END: return "FLASH_DEFL_END";
+        case ESP_OP_SPI_FLASH_MD5: return "SPI_FLASH_MD5";
+        case ESP_OP_ERASE_FLASH: return "ERASE_FLASH";
+        case ESP_OP_ERASE_REGION: return "ERASE_REGION";
+        case ESP_OP_READ_FLASH: return "READ_FLASH";
+    }
+    ostringstream sName;
+    sName << "0x" << hex << setw(2) << setfill('0') << nOperation;
+    return sName.str();
+}
+
+void EspStats::ShowTable(ostream& output)
+{
+    output << left << setw(17) << "operation" << right << setw(7) << "sent" << setw(7) << "retry" << setw(7) << "resync"
+        << setw(6) << "fail" << setw(7) << "cksum" << setw(10) << "tx bytes" << setw(8) << "tx esc" << setw(10) << "rx bytes"
+        << setw(8) << "rx esc" << setw(9) << "ttfb us" << setw(9) << "rtt us" << setw(8) << "p50" << setw(8) << "p99"
+        << setw(9) << "max" << endl;
+    for(int nOperation = 0; nOperation < ESP_STATS_OPS; ++nOperation)
+    {
+        const EspOpStats& stats = m_aOps[nOperation];
+        if(!stats.nCommands && !stats.nResponses && !stats.nRxBytes)
+            continue;
+        output << left << setw(17) << GetName(nOperation) << right << setw(7) << stats.nCommands << setw(7) << stats.nRetries
+            << setw(7) << stats.nResyncs << setw(6) << stats.nFailures << setw(7) << stats.nChecksumFailures
+            << setw(10) << stats.nTxBytes << setw(8) << stats.nTxEscaped << setw(10) << stats.nRxBytes << setw(8) << stats.nRxEscaped;
+        unsigned long nSamples = 0;
+        for(int nBucket = 0; nBucket < ESP_STATS_BUCKETS; ++nBucket)
+            nSamples += stats.aRtt[nBucket];
+        if(nSamples)
+            output << setw(9) << stats.nTtfbTotal / nSamples << setw(9) << stats.nRttTotal / nSamples
+                << setw(8) << Percentile(stats.aRtt, nSamples, 50) << setw(8) << Percentile(stats.aRtt, nSamples, 99)
+                << setw(9) << stats.nRttMax;
+        output << endl;
+    }
+    output << "Latency percentiles are upper bounds of power-of-two histogram buckets" << endl;
+}
+
+void EspStats::WriteJson(ostream& output)
+{
+    output << "{\"operations\":[";
+    bool bFirst = true;
+    for(int nOperation = 0; nOperation < ESP_STATS_OPS; ++nOperation)
+    {
+        const EspOpStats& stats = m_aOps[nOperation];
+        if(!stats.nCommands && !stats.nResponses && !stats.nRxBytes)
+            continue;
+        unsigned long nSamples = 0;
+        for(int nBucket = 0; nBucket < ESP_STATS_BUCKETS; ++nBucket)
+            nSamples += stats.aRtt[nBucket];
+        output << (bFirst ? "" : ",") << endl
+            << "{\"op\":" << nOperation << ",\"name\":\"" << GetName(nOperation) << "\""
+            << ",\"commands\":" << stats.nCommands << ",\"responses\":" << stats.nResponses
+            << ",\"retries\":" << stats.nRetries << ",\"resyncs\":" << stats.nResyncs
+            << ",\"failures\":" << stats.nFailures << ",\"checksum_failures\":" << stats.nChecksumFailures
+            << ",\"timeouts\":" << stats.nTimeouts
+            << ",\"tx_bytes\":" << stats.nTxBytes << ",\"tx_escaped\":" << stats.nTxEscaped
+            << ",\"rx_bytes\":" << stats.nRxBytes << ",\"rx_escaped\":" << stats.nRxEscaped << ",\"rx_junk\":" << stats.nRxJunk
+            << ",\"ttfb_mean_us\":" << (nSamples ? stats.nTtfbTotal / nSamples : 0)
+            << ",\"rtt_mean_us\":" << (nSamples ? stats.nRttTotal / nSamples : 0)
+            << ",\"rtt_p50_us\":" << (nSamples ? Percentile(stats.aRtt, nSamples, 50) : 0)
+            << ",\"rtt_p99_us\":" << (nSamples ? Percentile(stats.aRtt, nSamples, 99) : 0)
+            << ",\"rtt_max_us\":" << stats.nRttMax;
+        //Histograms as counts per bucket where bucket n holds durations below 2^n microseconds
+        output << ",\"rtt_histogram\":[";
+        for(int nBucket = 0; nBucket < ESP_STATS_BUCKETS; ++nBucket)
+            output << (nBucket ? "," : "") << stats.aRtt[nBucket];
+        output << "],\"ttfb_histogram\":[";
+        for(int nBucket = 0; nBucket < ESP_STATS_BUCKETS; ++nBucket)
+            output << (nBucket ? "," : "") << stats.aTtfb[nBucket];
+        output << "]}";
+        bFirst = false;
+    }
+    output << endl << "]}" << endl;
+}
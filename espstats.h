@@ -0,0 +1,137 @@
+/** ESP8266 protocol statistics
+*   Author: agent
+*   Date: 2026-10-17
+*   License: LGPL
+*/
+
+#pragma once
+#include <string>
+#include <ostream>
+#include <chrono>
+#include <stdint.h> //provides fixed width integers
+#include <cstddef> //provides size_t
+
+using namespace std;
+
+const static int ESP_STATS_OPS = 256; //Quantity of possible operation codes
+const static int ESP_STATS_BUCKETS = 24; //Latency histogram buckets. Bucket n counts durations below 2^n microseconds, last bucket counts the rest.
+const static size_t ESP_STATS_INFLIGHT = 256; //Maximum quantity of commands tracked awaiting response
+
+struct EspOpStats
+{
+    unsigned long nCommands; //Quantity of frames sent
+    unsigned long nResponses; //Quantity of matching responses received
+    unsigned long nRetries; //Quantity of frames resent after failure or timeout
+    unsigned long nResyncs; //Quantity of frames discarded (unexpected, too short or corrupt) whilst waiting for a response
+    unsigned long nFailures; //Quantity of responses with failure status
+    unsigned long nChecksumFailures; //Quantity of responses reporting invalid data checksum
+    unsigned long nTimeouts; //Quantity of waits for a response that timed out
+    uint64_t nTxBytes; //Bytes sent on the wire including SLIP framing
+    uint64_t nTxEscaped; //Extra bytes sent due to SLIP escaping
+    uint64_t nRxBytes; //Bytes received on the wire including SLIP framing and junk
+    uint64_t nRxEscaped; //Extra bytes received due to SLIP escaping
+    uint64_t nRxJunk; //Bytes received outside frames
+    uint64_t nRttTotal; //Sum of round-trip times in microseconds
+    uint64_t nRttMax; //Longest round-trip time in microseconds
+    uint64_t nTtfbTotal; //Sum of times to first response byte in microseconds
+    unsigned long aRtt[ESP_STATS_BUCKETS]; //Histogram of round-trip times (send to complete response)
+    unsigned long aTtfb[ESP_STATS_BUCKETS]; //Histogram of times to first response byte
+};
+
+class EspStats
+{
+    public:
+        typedef chrono::steady_clock::time_point TimePoint;
+
+        EspStats();
+
+        /** @brief  Clear all statistics
+        */
+        void Reset();
+
+        /** @brief  Record a frame sent
+        *   @param  nOperation Command ID
+        *   @param  nBytes Bytes on the wire including SLIP framing
+        *   @param  nEscaped Extra bytes due to SLIP escaping
+        */
+        void Sent(int nOperation, size_t nBytes, size_t nEscaped);
+
+        /** @brief  Record bytes received whilst reading a frame
+        *   @param  nBytes Bytes consumed from the wire
+        *   @param  nEscaped Escape sequences decoded
+        *   @param  nJunk Bytes discarded outside frames
+        *   @param  nErrors Frames dropped by SLIP decoder
+        *   @note   Attributed to the oldest command awaiting response or the last command sent if none
+        */
+        void Received(size_t nBytes, size_t nEscaped, size_t nJunk, size_t nErrors);
+
+        /** @brief  Record arrival of the first byte of a response
+        *   @note   Only the first call after each response is recorded
+        */
+        void FirstByte();
+
+        /** @brief  Record a matching response, completing the oldest command awaiting response
+        *   @param  nOperation Command ID
+        */
+        void Response(int nOperation);
+
+        /** @brief  Record a frame discarded whilst waiting for a response
+        *   @param  nOperation Command ID awaited
+        */
+        void Resync(int nOperation);
+
+        /** @brief  Record a response with failure status
+        *   @param  nOperation Command ID
+        *   @param  bChecksum True if ESP8266 reported invalid data checksum
+        */
+        void Failure(int nOperation, bool bChecksum);
+
+        /** @brief  Record a timeout waiting for a response and forget the oldest command awaiting response
+        *   @param  nOperation Command ID awaited
+        */
+        void Timeout(int nOperation);
+
+        /** @brief  Record a command being resent and forget commands awaiting response
+        *   @param  nOperation Command ID
+        */
+        void Retry(int nOperation);
+
+        /** @brief  Forget commands awaiting response, e.g. after input is flushed
+        */
+        void Restart();
+
+        /** @brief  Get statistics for an operation
+        *   @param  nOperation Command ID
+        *   @retval const EspOpStats& Statistics
+        */
+        const EspOpStats& Get(int nOperation) {return m_aOps[nOperation & 0xFF];};
+
+        /** @brief  Get the name of an operation
+        *   @param  nOperation Command ID
+        *   @retval string Name, e.g. FLASH_DATA, or hexadecimal ID if unknown
+        */
+        static string GetName(int nOperation);
+
+        /** @brief  Print table of statistics for each operation used
+        *   @param  output Stream to write to
+        */
+        void ShowTable(ostream& output);
+
+        /** @brief  Write statistics for each operation used as JSON, including histograms
+        *   @param  output Stream to write to
+        */
+        void WriteJson(ostream& output);
+
+    private:
+        void Record(unsigned long* pHistogram, uint64_t nMicroseconds); // Add a duration to a histogram
+        uint64_t Percentile(const unsigned long* pHistogram, unsigned long nCount, unsigned int nPercent); // Upper bound of bucket holding percentile
+
+        EspOpStats m_aOps[ESP_STATS_OPS]; //Statistics for each operation
+        TimePoint m_aSent[ESP_STATS_INFLIGHT]; //Time each command awaiting response was sent, oldest at m_nTail
+        unsigned char m_aSentOp[ESP_STATS_INFLIGHT]; //Operation of each command awaiting response
+        size_t m_nHead; //Index of next command sent
+        size_t m_nTail; //Index of oldest command awaiting response
+        int m_nLastOp; //Last operation sent
+        TimePoint m_tFirstByte; //Time first byte of current response arrived
+        bool m_bFirstByte; //True if first byte of current response has been seen
+};
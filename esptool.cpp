@@ -1,34 +1,24 @@
 #include "esptool.h"
 #include "version.h"
+#include "compressor.h"
 #include <iostream>
 #include <libgen.h> //provides file name manipulation
 #include <getopt.h>
 #include <unistd.h> //provides usleep
-//#include <conio.h> //provides keyboard input
+#include <fcntl.h> //provides open
+#include <sys/mman.h> //provides mmap
+#include <sys/stat.h> //provides fstat
+#include <chrono> //provides steady clock for throughput measurement
+#include <fstream> //provides file input
+#include <signal.h> //provides signal to stop simulator
+#include <random> //provides random selection of cached sectors to spot-check
+#include <algorithm> //provides shuffle
+#include <cstdio> //provides rename, remove, snprintf
+#include <errno.h> //provides ENOSPC
 
-#include <sys/ioctl.h>
-#include <stdio.h>
-#include <sys/select.h>
-#include <termios.h>
-int _kbhit()
+static void StopTerminal(int nSignal)
 {
-    static const int STDIN = 0;
-    static bool bIninitialized = false;
-
-    if(!bIninitialized)
-    {
-        cerr << "Initializing _kbhit" << endl;
-        // Use termios to turn off line buffering
-        termios term;
-        tcgetattr(STDIN, &term);
-        term.c_lflag &= ~ICANON;
-        tcsetattr(STDIN, TCSANOW, &term);
-        setbuf(stdin, NULL);
-        bIninitialized = true;
-    }
-    int bytesWaiting;
-    ioctl(STDIN, TIOCINQ, &bytesWaiting);
-    return bytesWaiting;
+    Terminal::Stop();
 }
 
 int main(int argc, char** argv)
@@ -47,6 +37,15 @@ int main(int argc, char** argv)
         case COMMAND::ELF2IMAGE:
             exit(Elf2Image("elf", "image")?0:-1);
             break;
+        case COMMAND::SIMULATE:
+            exit(Simulate()?0:-1);
+            break;
+        case COMMAND::BENCHMARK:
+            exit(RunBenchmark()?0:-1);
+            break;
+        case COMMAND::REPLAY:
+            exit(Replay()?0:-1);
+            break;
         default:
             ; //carry on to open serial port
     }
@@ -56,6 +55,18 @@ int main(int argc, char** argv)
         }
     g_pEsp = new ESP8266(g_sPort, g_nBaud);
     g_pEsp->SetVerbose(g_bVerbose);
+    g_pEsp->SetSilent(g_bQuiet);
+    g_pEsp->SetPipelineDepth(g_nPipelineDepth);
+    g_pEsp->GetSerial()->SetVerbose(g_bVerbose);
+    g_pEsp->GetSerial()->SetLowLatency(g_bLowLatency);
+    g_pEsp->EnableStats(g_bStats);
+    if(!g_sTraceFile.empty() && !g_pEsp->GetSerial()->SetTrace(g_sTraceFile))
+    {
+        if(!g_bQuiet) cerr << "Failed to create trace file " << g_sTraceFile << endl;
+        return -1;
+    }
+    if(!g_pEsp->SetResetSequence(g_sReset))
+        return -1;
     if(g_pEsp->Open())
     {
         if(g_bVerbose) cout << "Opened serial port" << endl;
@@ -69,45 +80,82 @@ int main(int argc, char** argv)
     switch(nCommand)
     {
     case COMMAND::RESET:
+        if(g_bCalibrate)
+        {
+            string sMinimum;
+            unsigned int nHold;
+            bool bSuccess = g_pEsp->CalibrateReset(sMinimum, nHold);
+            if(bSuccess)
+                cout << "Shortest " << g_sReset << " flash reset that connected " << ESP_CALIBRATE_TRIES << " times: \"" << sMinimum
+                    << "\" (" << nHold / 1000.0 << "ms of holds)" << endl;
+            delete g_pEsp;
+            return bSuccess ? 0 : -1;
+        }
         g_pEsp->Reset();
         break;
     case COMMAND::TERMINAL:
         {
-            Serial* pSerial = g_pEsp->GetSerial();
-            while(pSerial->IsOpen())
+            Terminal terminal(g_pEsp);
+            if(!g_sCaptureFile.empty() && !terminal.SetCapture(g_sCaptureFile))
             {
-                unsigned char cData;
-                if(pSerial->Read(&cData) > 0)
-                {
-                    cout << cData;
-                }
-                while(_kbhit())
-                {
-//                    cout << (char)getchar(); //!@todo Send to serial
-                }
+                if(!g_bQuiet) cerr << "Failed to create capture file " << g_sCaptureFile << endl;
+                delete g_pEsp;
+                return -1;
+            }
+            signal(SIGTERM, StopTerminal);
+            signal(SIGHUP, StopTerminal);
+            if(!terminal.Run())
+            {
+                ReportStats();
+                delete g_pEsp;
+                return -1;
             }
         }
         break;
     case ERASE:
         break;
     case FLASH:
-        for(map<unsigned int,string>::iterator it = g_mFirmwareMap.begin(); it != g_mFirmwareMap.end(); ++it)
         {
-            if(g_bVerbose)
-                cout << "Write " << it->second << " to " << it->first << endl;
-            WriteFlash(it->first, it->second);
+            bool bSuccess = g_pEsp->Connect() && LoadStub() && WriteFlash();
+            //Leave loader and run new firmware
+            if(bSuccess && g_pEsp->FlashEnd())
+                g_pEsp->Reset();
+            else
+                bSuccess = false;
+            ReportStats();
+            delete g_pEsp;
+            return bSuccess ? 0 : -1;
+        }
+    case READ_FLASH:
+        {
+            bool bSuccess = g_pEsp->Connect() && LoadStub() && ReadFlash();
+            ReportStats();
+            delete g_pEsp;
+            return bSuccess ? 0 : -1;
         }
-        break;
     case RUN:
         break;
     case CHIP_ID:
         cout << g_pEsp->ReadId() << endl;
         break;
+    case MAC:
+        {
+            string sMac = g_pEsp->ReadMac();
+            if(sMac.empty())
+            {
+                ReportStats();
+                delete g_pEsp;
+                return -1;
+            }
+            cout << sMac << endl;
+        }
+        break;
     case FLASH_ID:
         break;
     default:
         if(g_bVerbose) cout << "Unsupported command" << endl;
     }
+    ReportStats();
     delete g_pEsp;
 }
 
@@ -129,11 +177,42 @@ COMMAND ParseCommandLine(int nCount, char** pArgs)
         {"freq", required_argument, 0, 'f'},
         {"flash_mode", required_argument, 0, 'm'},
         {"flash_size", required_argument, 0, 's'},
+        {"depth", required_argument, 0, OPTION_DEPTH},
+        {"stub", required_argument, 0, 'l'},
+        {"compress", no_argument, 0, 'z'},
+        {"fast-baud", required_argument, 0, 'B'},
+        {"low-latency", no_argument, 0, OPTION_LOW_LATENCY},
+        {"reset", required_argument, 0, 'R'},
+        {"calibrate", no_argument, 0, OPTION_CALIBRATE},
+        {"sim-baud", required_argument, 0, OPTION_SIM_BAUD},
+        {"sim-latency", required_argument, 0, OPTION_SIM_LATENCY},
+        {"sim-errors", required_argument, 0, OPTION_SIM_ERRORS},
+        {"sim-seed", required_argument, 0, OPTION_SIM_SEED},
+        {"sim-flash-size", required_argument, 0, OPTION_SIM_FLASH_SIZE},
+        {"stats", optional_argument, 0, OPTION_STATS},
+        {"trace", required_argument, 0, OPTION_TRACE},
+        {"capture", required_argument, 0, OPTION_CAPTURE},
+        {"diff", no_argument, 0, OPTION_DIFF},
+        {"cache", optional_argument, 0, OPTION_CACHE},
+        {"cache-check", required_argument, 0, OPTION_CACHE_CHECK},
+        {"sparse", no_argument, 0, OPTION_SPARSE},
+        {"bench-size", required_argument, 0, OPTION_BENCH_SIZE},
+        {"bench-baud", required_argument, 0, OPTION_BENCH_BAUD},
+        {"bench-block", required_argument, 0, OPTION_BENCH_BLOCK},
+        {"bench-depth", required_argument, 0, OPTION_BENCH_DEPTH},
+        {"bench-compress", required_argument, 0, OPTION_BENCH_COMPRESS},
+        {"bench-slip", required_argument, 0, OPTION_BENCH_SLIP},
+        {"bench-checksum", required_argument, 0, OPTION_BENCH_CHECKSUM},
+        {"bench-write", required_argument, 0, OPTION_BENCH_WRITE},
+        {"bench-low-latency", required_argument, 0, OPTION_BENCH_LOW_LATENCY},
+        {"bench-regs", required_argument, 0, OPTION_BENCH_REGS},
+        {"bench-sim-latency", required_argument, 0, OPTION_BENCH_SIM_LATENCY},
         {0, 0, 0, 0} //terminate arguments
     };
     while(bMoreOptions)
     {
-        switch(getopt_long(nCount, pArgs, "-b:p:f:m:s:hvVtq", options, &nOptionIndex))
+        int nOption = getopt_long(nCount, pArgs, "-b:B:p:f:m:s:l:R:zhvVtq", options, &nOptionIndex);
+        switch(nOption)
         {
         case 'v':
             //show version
@@ -168,10 +247,163 @@ COMMAND ParseCommandLine(int nCount, char** pArgs)
                 }
             }
             break;
+        case 'B':
+            //set baud rate to switch to after connecting
+            {
+                string sBaud = optarg;
+                try
+                {
+                    g_nFastBaud = (sBaud.compare("auto") == 0) ? 0 : stoi(sBaud);
+                } catch(const std::exception& e)
+                {
+                    if(!g_bQuiet) cerr << "Invalid fast baud rate: " << optarg << endl;
+                    exit(-1);
+                }
+            }
+            break;
         case 'p':
             //set serial port device
             g_sPort = optarg;
             break;
+        case 'l':
+            //flasher stub
+            g_sStub = optarg;
+            break;
+        case 'z':
+            //compress
+            g_bCompress = true;
+            break;
+        case 'R':
+            //hardware reset sequence
+            g_sReset = optarg;
+            break;
+        case OPTION_LOW_LATENCY:
+            //tune serial port latency settings
+            g_bLowLatency = true;
+            break;
+        case OPTION_CALIBRATE:
+            //find shortest reset holds
+            g_bCalibrate = true;
+            break;
+        case OPTION_SIM_BAUD:
+        case OPTION_SIM_LATENCY:
+        case OPTION_SIM_ERRORS:
+        case OPTION_SIM_SEED:
+        case OPTION_SIM_FLASH_SIZE:
+            //simulator parameters
+            try
+            {
+                if(nOption == OPTION_SIM_BAUD)
+                    g_nSimBaud = stoul(optarg);
+                else if(nOption == OPTION_SIM_LATENCY)
+                    g_nSimLatency = stoul(optarg);
+                else if(nOption == OPTION_SIM_ERRORS)
+                    g_dSimErrors = stod(optarg);
+                else if(nOption == OPTION_SIM_SEED)
+                    g_nSimSeed = stoul(optarg);
+                else
+                    g_nSimFlashSize = stoul(optarg, 0, 0);
+            } catch(const std::exception& e)
+            {
+                if(!g_bQuiet) cerr << "Invalid value for --" << options[nOptionIndex].name << ": " << optarg << endl;
+                exit(-1);
+            }
+            break;
+        case OPTION_DEPTH:
+            //quantity of flash write blocks in flight
+            try
+            {
+                g_nPipelineDepth = stoul(optarg);
+            } catch(const std::exception& e)
+            {
+                if(!g_bQuiet) cerr << "Invalid value for --" << options[nOptionIndex].name << ": " << optarg << endl;
+                exit(-1);
+            }
+            break;
+        case OPTION_STATS:
+            //protocol statistics
+            g_bStats = true;
+            if(optarg)
+                g_sStatsFile = optarg;
+            break;
+        case OPTION_TRACE:
+            //record serial trace
+            g_sTraceFile = optarg;
+            break;
+        case OPTION_CAPTURE:
+            //capture terminal output
+            g_sCaptureFile = optarg;
+            break;
+        case OPTION_DIFF:
+            //only write changed sectors
+            g_bDiff = true;
+            break;
+        case OPTION_CACHE:
+            //cache flash content digests (implies diff)
+            g_bDiff = g_bCache = true;
+            if(optarg)
+                g_flashCache.SetDirectory(optarg);
+            break;
+        case OPTION_SPARSE:
+            //skip erased sectors when reading flash
+            g_bSparse = true;
+            break;
+        case OPTION_CACHE_CHECK:
+            //quantity of cached sectors to verify
+            try
+            {
+                g_nCacheCheck = stoul(optarg);
+            } catch(const std::exception& e)
+            {
+                if(!g_bQuiet) cerr << "Invalid value for --" << options[nOptionIndex].name << ": " << optarg << endl;
+                exit(-1);
+            }
+            break;
+        case OPTION_BENCH_SIZE:
+        case OPTION_BENCH_BAUD:
+        case OPTION_BENCH_BLOCK:
+        case OPTION_BENCH_DEPTH:
+        case OPTION_BENCH_COMPRESS:
+        case OPTION_BENCH_SLIP:
+        case OPTION_BENCH_CHECKSUM:
+        case OPTION_BENCH_WRITE:
+        case OPTION_BENCH_LOW_LATENCY:
+        case OPTION_BENCH_REGS:
+        case OPTION_BENCH_SIM_LATENCY:
+            //benchmark parameters
+            try
+            {
+                vector<unsigned int> vValues = ParseList(optarg);
+                if(vValues.empty())
+                    throw invalid_argument(optarg);
+                if(nOption == OPTION_BENCH_SIZE)
+                    g_benchmark.SetImageSize(vValues[0]);
+                else if(nOption == OPTION_BENCH_BAUD)
+                    g_benchmark.SetBauds(vValues);
+                else if(nOption == OPTION_BENCH_BLOCK)
+                    g_benchmark.SetBlockSizes(vValues);
+                else if(nOption == OPTION_BENCH_DEPTH)
+                    g_benchmark.SetDepths(vValues);
+                else if(nOption == OPTION_BENCH_SLIP)
+                    g_benchmark.SetSlipEscapes(vValues);
+                else if(nOption == OPTION_BENCH_CHECKSUM)
+                    g_benchmark.SetChecksumBlocks(vValues);
+                else if(nOption == OPTION_BENCH_WRITE)
+                    g_benchmark.SetWriteChunks(vValues);
+                else if(nOption == OPTION_BENCH_LOW_LATENCY)
+                    g_benchmark.SetLatencyModes(vector<bool>(vValues.begin(), vValues.end()));
+                else if(nOption == OPTION_BENCH_REGS)
+                    g_benchmark.SetRegCounts(vValues);
+                else if(nOption == OPTION_BENCH_SIM_LATENCY)
+                    g_benchmark.SetSimLatency(vValues[0]);
+                else
+                    g_benchmark.SetCompression(vector<bool>(vValues.begin(), vValues.end()));
+            } catch(const std::exception& e)
+            {
+                if(!g_bQuiet) cerr << "Invalid value for --" << options[nOptionIndex].name << ": " << optarg << endl;
+                exit(-1);
+            }
+            break;
         case 'f':
             //cpu frequency
             if(nCommand == COMMAND::FLASH)
@@ -209,12 +441,22 @@ COMMAND ParseCommandLine(int nCount, char** pArgs)
                     nCommand = COMMAND::RUN;
                 else if(sArg.compare("chip_id") == 0)
                     nCommand = COMMAND::CHIP_ID;
+                else if(sArg.compare("read_mac") == 0)
+                    nCommand = COMMAND::MAC;
                 else if(sArg.compare("flash_id") == 0)
                     nCommand = COMMAND::FLASH_ID;
+                else if(sArg.compare("read_flash") == 0)
+                    nCommand = COMMAND::READ_FLASH;
                 else if(sArg.compare("terminal") == 0)
                     nCommand = COMMAND::TERMINAL;
                 else if(sArg.compare("elf2image") == 0)
                     nCommand = COMMAND::ELF2IMAGE;
+                else if(sArg.compare("simulate") == 0)
+                    nCommand = COMMAND::SIMULATE;
+                else if(sArg.compare("benchmark") == 0)
+                    nCommand = COMMAND::BENCHMARK;
+                else if(sArg.compare("replay") == 0)
+                    nCommand = COMMAND::REPLAY;
                 break;
             case COMMAND::FLASH:
                 if(nOffset == -1)
@@ -241,7 +483,7 @@ COMMAND ParseCommandLine(int nCount, char** pArgs)
                 }
                 break;
             default:
-                ;
+                g_vParameters.push_back(sArg);
             }
             break;
         }
@@ -265,6 +507,22 @@ COMMAND ParseCommandLine(int nCount, char** pArgs)
             exit(-1);
         }
         break;
+    case COMMAND::READ_FLASH:
+        if(g_vParameters.size() != 3)
+        {
+            if(!g_bQuiet)
+                cerr << "read_flash expects offset, size and filename" << endl;
+            exit(-1);
+        }
+        break;
+    case COMMAND::REPLAY:
+        if(g_vParameters.empty())
+        {
+            if(!g_bQuiet)
+                cerr << "replay expects a trace file" << endl;
+            exit(-1);
+        }
+        break;
     case COMMAND::NONE:
         if(!g_bQuiet)
             cerr << "**No command provided**" << endl;
@@ -290,6 +548,13 @@ void ShowHelp(COMMAND nCommand)
     string sCommonSerialOptions = "\t-p, --port <PORT> \tSerial port device (default: " + g_sPort;
     sCommonSerialOptions += ")\n\t-b, --baud <BAUD> \tBaud rate (default: ";
     sCommonSerialOptions += to_string(g_nBaud) + ")";
+    sCommonSerialOptions += "\n\t-B, --fast-baud <BAUD|auto> Switch to faster baud after connecting, stepping down on errors (requires --stub)";
+    sCommonSerialOptions += "\n\t--low-latency \t\tTune serial driver / FTDI latency timer for low latency until port is closed";
+    sCommonSerialOptions += "\n\t-R, --reset <SEQUENCE> \tHardware reset sequence: classic, usb_jtag, none or custom, e.g. \"U0,1|W0.05|U1,0|W0.05|U0,0\"";
+    sCommonSerialOptions += "\n\t\t\t\t(U<dtr>,<rts> set both lines, D<0|1> DTR, R<0|1> RTS, W<seconds> wait. Default: classic)";
+    sCommonSerialOptions += "\n\t--trace <FILE> \t\tRecord all serial data with timestamps to binary trace FILE (see replay)";
+    sCommonSerialOptions += "\n\t--stats[=FILE] \t\tShow per-operation latency, retry and byte counts (JSON to FILE, - for stdout)";
+    sCommonSerialOptions += "\n\t-l, --stub <FILE> \tUpload flasher stub image to RAM and use it instead of ROM loader";
     string sCommonOptions = "\t-V, --verbose \t\tIncrease verbosity of output\n\t-q, --quiet \t\tSuppress output";
 
     cout << endl << "usage: " << g_sAppName;
@@ -318,12 +583,16 @@ void ShowHelp(COMMAND nCommand)
             << "\tflash_id \t\tRead Flash ID from ESP8266"<< endl
             << "\tread_flash \t\tDownload flash image from ESP8266" << endl
     //            << "\tverify_flash \t\tVerify flash image in ESP8266" << endl
-            << "\terase_flash \t\tErase flash memory" << endl;
+            << "\terase_flash \t\tErase flash memory" << endl
+            << "\tsimulate \t\tRun ESP8266 simulator on a pseudo terminal" << endl
+            << "\tbenchmark \t\tMeasure protocol throughput against the simulator" << endl
+            << "\treplay \t\t\tReplay a serial trace through the protocol stack" << endl;
             break;
         case COMMAND::FLASH:
             cout << " write_flash [options] <offset> <image> [<offset> <image>...]" << endl
             << endl << "Write firmware <image> to ESP8266 flash at <offset>. "
-            << "Several <offset> <image> pairs may be provided to write multiple images." << endl << endl
+            << "Several <offset> <image> pairs may be provided to write multiple images. "
+            << "Sparse images from read_flash --sparse are written without sending erased regions (requires --stub)." << endl << endl
             << "options:" << endl
             << sCommonSerialOptions << endl
             << sCommonOptions << endl
@@ -331,6 +600,12 @@ void ShowHelp(COMMAND nCommand)
             << "\t-f, --flash-freq \tSet CPU frequency (20m|26m|40m|80m default: 40m)" << endl
             << "\t-m, --flash-mode \tSet flash mode (qio|qout|dio|diout default: qio)" << endl
             << "\t-s, --flash-size \tSet flash mode (detect|2m|4m|8m|16m|32m|16m-c1|32m-c1|32m-c2 default: 4m)" << endl
+            << "\t--depth <N> \t\tSend N blocks before waiting for the first to be acknowledged (default: 4 with --stub, 1 without)" << endl
+            << "\t-z, --compress \t\tCompress images before sending (requires --stub)" << endl
+            << "\t--diff \t\t\tOnly erase and write sectors that differ from flash, compared by MD5 (requires --stub)" << endl
+            << "\t--cache[=DIR] \t\tAs --diff but remember sector digests per chip ID in DIR (default: " << FlashCache::GetDefaultDirectory() << ")" << endl
+            << "\t\t\t\tso unchanged sectors are skipped without asking the device" << endl
+            << "\t--cache-check <N> \tVerify N cached sectors with the device, discarding the cache on mismatch (default: 2)" << endl
             << "\t-p, --no-progress \tSuppress progress output" << endl
             << "\t-v, --verify \t\tVerify data after flash. (Should not be required because data is CRC checked during flash)" << endl;
             break;
@@ -363,9 +638,12 @@ void ShowHelp(COMMAND nCommand)
             << sCommonOptions << endl;
             break;
         case COMMAND::READ_FLASH:
-            cout << " read_flash [options] <flash_image>" << endl
-            << endl << "Read image from ESP8266 flash to file <flash_image>" << endl << endl
+            cout << " read_flash [options] <offset> <size> <flash_image>" << endl
+            << endl << "Read <size> bytes of ESP8266 flash from <offset> to file <flash_image> (requires --stub). "
+            << "Data is verified by MD5 every " << READ_FLASH_CHUNK / 1024 << "KB and progress kept in <flash_image>.progress "
+            << "so an interrupted read continues where it stopped when run again with the same parameters." << endl << endl
             << "options:" << endl
+            << "\t--sparse \t\tSkip erased sectors, found by MD5 on the device, and write a sparse image which write_flash accepts" << endl
             << sCommonSerialOptions << endl
             << sCommonOptions << endl;
             break;
@@ -375,6 +653,45 @@ void ShowHelp(COMMAND nCommand)
             << "options:" << endl
             << sCommonOptions << endl;
             break;
+        case COMMAND::SIMULATE:
+            cout << " simulate [options] [<flash_image>]" << endl
+            << endl << "Simulate an ESP8266 in flash mode on a pseudo terminal until interrupted. "
+            << "Prints the device name to pass to --port. Flash is loaded from and saved to <flash_image> if provided." << endl << endl
+            << "options:" << endl
+            << "\t--sim-baud <BAUD> \tThrottle to line rate of BAUD (default: unlimited)" << endl
+            << "\t--sim-latency <US> \tDelay each response by US microseconds (default: 0)" << endl
+            << "\t--sim-errors <RATE> \tProbability of corrupting each byte, e.g. 0.0001 (default: 0)" << endl
+            << "\t--sim-seed <SEED> \tRandom seed for error injection (default: 1)" << endl
+            << "\t--sim-flash-size <BYTES> Size of simulated flash (default: 0x400000)" << endl
+            << sCommonOptions << endl;
+            break;
+        case COMMAND::BENCHMARK:
+            cout << " benchmark [options] [<json_file>]" << endl
+            << endl << "Write an image to the simulator for each combination of block size, baud, compression and pipeline depth. "
+            << "Reports bytes/s, frames/s, system calls and heap allocations per frame (Benchmark build only) and READ_REG latency (p50 / p99). "
+            << "Results are written as JSON to <json_file> if provided (- for stdout)." << endl << endl
+            << "options:" << endl
+            << "\t--bench-size <BYTES> \tSize of image (default: 0x40000)" << endl
+            << "\t--bench-baud <LIST> \tSimulated bauds, 0 for unlimited (default: 921600,3000000,0)" << endl
+            << "\t--bench-block <LIST> \tBlock sizes (default: 0x400,0x1000,0x4000)" << endl
+            << "\t--bench-depth <LIST> \tBlocks in flight (default: 1,2,4)" << endl
+            << "\t--bench-compress <LIST> Compression, 0 for off, 1 for on (default: 0,1)" << endl
+            << "\t--bench-sim-latency <US> Simulated response latency in microseconds (default: 0)" << endl
+            << "\t--bench-slip <LIST> \tTime SLIP encode / decode against byte at a time loops for each percentage of bytes needing escape, e.g. 0,25,100 (no simulator)" << endl
+            << "\t--bench-checksum <LIST> Time XorChecksum / XorChecksumBlocks against a byte loop with each kernel for each block size, e.g. 0x400,0x4000 (no simulator)" << endl
+            << "\t--bench-write <LIST> \tTime writing 1MB to a pseudo terminal in each chunk size, 1 for one byte per write() as before bulk writes, e.g. 1,0x400,0x4000 (no simulator)" << endl
+            << "\t--bench-low-latency <LIST> Time READ_REG, WRITE_REG and SPI_FLASH_MD5 round trips with each serial latency mode, 0 for default, 1 for --low-latency, e.g. 0,1" << endl
+            << "\t--bench-regs <LIST> \tTime reading each quantity of registers one round trip at a time against one ReadRegs batch, e.g. 2,4,16" << endl
+            << sCommonOptions << endl;
+            break;
+        case COMMAND::REPLAY:
+            cout << " replay [options] <trace_file> [<loops>]" << endl
+            << endl << "Feed a trace recorded with --trace back through SLIP decoding and command response matching as fast as possible (does not open serial port). "
+            << "Reports answered and unanswered commands and any difference between retransmitted and recorded data. Repeat <loops> times to benchmark (default: 1)." << endl << endl
+            << "options:" << endl
+            << "\t--stats[=FILE] \t\tShow per-operation counts (latencies reflect replay, not the recording)" << endl
+            << sCommonOptions << endl;
+            break;
         case COMMAND::ERASE:
             cout << " erase" << endl
             << endl << "Erase ESP8266 flash memory" << endl << endl
@@ -383,19 +700,138 @@ void ShowHelp(COMMAND nCommand)
             break;
         case COMMAND::TERMINAL:
             cout << " terminal" << endl
-            << endl << "Start terminal emulator" << endl << endl
+            << endl << "Start terminal emulator. Ctrl+] exits. Ctrl+T then R resets, F resets to flash mode, + / - change baud." << endl
+            << "Output is buffered so the port is never left unread. Bytes dropped if output cannot keep up are counted and reported on exit." << endl << endl
             << "options:" << endl
+            << "\t--capture <FILE> \tAlso write received data to FILE with a timestamp on each line" << endl
             << sCommonSerialOptions << endl
             << sCommonOptions << endl;
         case COMMAND::RESET:
             cout << " reset" << endl
             << endl << "Hardware reset using RTS / DTR" << endl << endl
             << "options:" << endl
+            << "\t--calibrate \t\tShorten holds of the flash reset sequence until connecting fails and show the shortest that" << endl
+            << "\t\t\t\tconnected. Add margin before using it with --reset. The run sequence is not calibrated." << endl
             << sCommonSerialOptions << endl
             << sCommonOptions << endl;
     }
 }
 
+static EspSimulator* g_pSimulator = NULL; //Simulator to stop on signal
+
+static void StopSimulator(int nSignal)
+{
+    if(g_pSimulator)
+        g_pSimulator->Stop();
+}
+
+bool Simulate()
+{
+    EspSimulator simulator(g_nSimFlashSize);
+    simulator.SetVerbose(g_bVerbose);
+    simulator.SetBaud(g_nSimBaud);
+    simulator.SetLatency(g_nSimLatency);
+    simulator.SetErrorRate(g_dSimErrors, g_nSimSeed);
+    if(!g_vParameters.empty() && !simulator.LoadFlash(g_vParameters[0]) && g_bVerbose)
+        cout << "Cannot read " << g_vParameters[0] << " - starting with erased flash" << endl;
+    if(!simulator.Open())
+        return false;
+    cout << simulator.GetPath() << endl; //Always report device so scripts can connect
+    g_pSimulator = &simulator;
+    signal(SIGINT, StopSimulator);
+    signal(SIGTERM, StopSimulator);
+    bool bSuccess = simulator.Run();
+    g_pSimulator = NULL;
+    if(!g_vParameters.empty() && !simulator.SaveFlash(g_vParameters[0]))
+    {
+        if(!g_bQuiet)
+            cerr << "Failed to save flash to " << g_vParameters[0] << endl;
+        bSuccess = false;
+    }
+    if(!g_bQuiet)
+        simulator.ShowStats();
+    return bSuccess;
+}
+
+bool Replay()
+{
+    TraceReplay replay;
+    if(!replay.Load(g_vParameters[0]))
+        return false;
+    unsigned int nLoops = 1;
+    if(g_vParameters.size() > 1)
+    {
+        try
+        {
+            nLoops = stoul(g_vParameters[1]);
+        } catch(const std::exception& e)
+        {
+            if(!g_bQuiet) cerr << "Invalid loop count: " << g_vParameters[1] << endl;
+            return false;
+        }
+    }
+    g_pEsp = new ESP8266(g_vParameters[0], g_nBaud);
+    g_pEsp->SetVerbose(g_bVerbose);
+    g_pEsp->SetSilent(true);
+    g_pEsp->EnableStats(g_bStats);
+    bool bSuccess = replay.Run(g_pEsp, nLoops);
+    if(!g_bQuiet)
+        replay.ShowResults();
+    ReportStats();
+    delete g_pEsp;
+    return bSuccess;
+}
+
+void ReportStats()
+{
+    EspStats* pStats = g_pEsp->GetStats();
+    if(!pStats)
+        return;
+    if(!g_bQuiet)
+        pStats->ShowTable(cout);
+    if(g_sStatsFile.empty())
+        return;
+    if(g_sStatsFile == "-")
+    {
+        pStats->WriteJson(cout);
+        return;
+    }
+    ofstream fileStats(g_sStatsFile.c_str());
+    pStats->WriteJson(fileStats);
+    if(!fileStats && !g_bQuiet)
+        cerr << "Failed to write statistics to " << g_sStatsFile << endl;
+}
+
+vector<unsigned int> ParseList(string sList)
+{
+    vector<unsigned int> vValues;
+    size_t nStart = 0;
+    while(nStart <= sList.size())
+    {
+        size_t nEnd = sList.find(',', nStart);
+        if(nEnd == string::npos)
+            nEnd = sList.size();
+        vValues.push_back(stoul(sList.substr(nStart, nEnd - nStart), 0, 0));
+        nStart = nEnd + 1;
+    }
+    return vValues;
+}
+
+bool RunBenchmark()
+{
+    g_benchmark.SetVerbose(g_bVerbose);
+    bool bSuccess = g_benchmark.Run();
+    if(!g_bQuiet)
+        g_benchmark.ShowResults();
+    if(!g_vParameters.empty() && !g_benchmark.WriteJson(g_vParameters[0]))
+    {
+        if(!g_bQuiet)
+            cerr << "Failed to write " << g_vParameters[0] << endl;
+        bSuccess = false;
+    }
+    return bSuccess;
+}
+
 bool Elf2Image(string sElf, string sImage)
 {
     bool bSuccess = false;
@@ -407,8 +843,692 @@ bool Elf2Image(string sElf, string sImage)
     return bSuccess;
 }
 
-bool WriteFlash(unsigned int nOffset, string sFilename)
+bool LoadStub()
 {
-    //!@todo implement write_flash
-    return false;
+    if(g_sStub.empty())
+        return true;
+    ifstream fileStub(g_sStub.c_str(), ios::binary);
+    vector<unsigned char> vImage((istreambuf_iterator<char>(fileStub)), istreambuf_iterator<char>());
+    if(vImage.empty())
+    {
+        if(!g_bQuiet)
+            cerr << "Failed to read flasher stub " << g_sStub << endl;
+        return false;
+    }
+    if(!g_pEsp->RunStub(vImage))
+        return false;
+    if(g_nFastBaud >= 0)
+    {
+        unsigned int nBaud = g_pEsp->SetFastBaud(g_nFastBaud);
+        if(g_bVerbose)
+            cout << "Running at " << nBaud << " baud" << endl;
+    }
+    return true;
+}
+
+const unsigned char* MapFile(string sFilename, size_t& nSize)
+{
+    int nFd = open(sFilename.c_str(), O_RDONLY);
+    struct stat fileStat;
+    if(nFd < 0 || fstat(nFd, &fileStat) != 0 || fileStat.st_size == 0)
+    {
+        if(!g_bQuiet)
+            cerr << "Failed to open " << sFilename << endl;
+        if(nFd >= 0)
+            close(nFd);
+        return NULL;
+    }
+    nSize = fileStat.st_size;
+    void* pData = mmap(NULL, nSize, PROT_READ, MAP_PRIVATE, nFd, 0);
+    close(nFd);
+    if(pData == MAP_FAILED)
+    {
+        if(!g_bQuiet)
+            cerr << "Failed to map " << sFilename << endl;
+        return NULL;
+    }
+    return static_cast<const unsigned char*>(pData);
+}
+
+bool WriteFlash()
+{
+    if(g_bCompress && !g_pEsp->IsStub())
+    {
+        if(!g_bQuiet)
+            cerr << "Compressed flashing requires flasher stub (--stub)" << endl;
+        return false;
+    }
+    if(g_bDiff && !g_pEsp->IsStub())
+    {
+        if(!g_bQuiet)
+            cerr << "Diff flashing requires flasher stub (--stub)" << endl;
+        return false;
+    }
+    if(g_bCache)
+    {
+        unsigned int nChipId = g_pEsp->ReadId();
+        if(!nChipId)
+        {
+            if(!g_bQuiet)
+                cerr << "Cannot read chip ID to select flash cache" << endl;
+            return false;
+        }
+        g_flashCache.Load(nChipId);
+        if(g_bVerbose)
+            cout << "Flash cache for chip " << hex << nChipId << dec << " holds " << g_flashCache.GetSize() << " sectors" << endl;
+        //Check once before any comparison so a discarded cache leaves every run to be found from the device
+        if(!CheckFlashCache())
+        {
+            if(!g_bQuiet)
+                cerr << "Failed to spot-check flash cache" << endl;
+            return false;
+        }
+    }
+    //Map all images and find the regions to write up front so the compressor can work ahead of the serial sender
+    vector<const unsigned char*> vFiles;
+    vector<size_t> vFileSizes;
+    vector<SparseImage> vImages(g_mFirmwareMap.size());
+    vector<vector<pair<size_t, size_t> > > vRuns; //Offset within image and size of each region to write
+    vector<vector<pair<size_t, size_t> > > vErase; //Offset within image and size of each erased region of a sparse image to erase
+    vector<double> vHashSeconds; //Time taken to compare each image with flash
+    vector<size_t> vCached; //Quantity of sectors of each image found in cache
+    Compressor compressor;
+    bool bSuccess = true;
+    size_t nImage = 0;
+    for(map<unsigned int,string>::iterator it = g_mFirmwareMap.begin(); it != g_mFirmwareMap.end(); ++it, ++nImage)
+    {
+        size_t nFileSize = 0;
+        const unsigned char* pFile = MapFile(it->second, nFileSize);
+        vFiles.push_back(pFile);
+        vFileSizes.push_back(nFileSize);
+        vRuns.push_back(vector<pair<size_t, size_t> >());
+        vErase.push_back(vector<pair<size_t, size_t> >());
+        vHashSeconds.push_back(0);
+        vCached.push_back(0);
+        if(!pFile)
+            continue;
+        SparseImage& image = vImages[nImage];
+        if(!image.Attach(pFile, nFileSize))
+        {
+            if(!g_bQuiet)
+                cerr << "Invalid sparse image " << it->second << endl;
+            bSuccess = false;
+            break;
+        }
+        if(image.IsSparse() && !CheckSparseImage(it->first, it->second, image))
+        {
+            bSuccess = false;
+            break;
+        }
+        chrono::steady_clock::time_point tStart = chrono::steady_clock::now();
+        //Compare erased regions of sparse images and, if diffing, extents holding data in one pass
+        vector<SparseExtent> vRegions = image.GetHoles();
+        if(g_bDiff)
+            vRegions.insert(vRegions.end(), image.GetExtents().begin(), image.GetExtents().end());
+        else
+            for(auto itExtent = image.GetExtents().begin(); itExtent != image.GetExtents().end(); ++itExtent)
+                vRuns.back().push_back(make_pair(itExtent->nOffset, itExtent->nSize));
+        sort(vRegions.begin(), vRegions.end(), [](const SparseExtent& a, const SparseExtent& b) {return a.nOffset < b.nOffset;});
+        vector<pair<size_t, size_t> > vChanged;
+        bSuccess = FindChangedRuns(it->first, image, vRegions, vChanged, &vCached.back());
+        //Erased regions are only erased where flash is not already erased
+        for(auto itChanged = vChanged.begin(); itChanged != vChanged.end(); ++itChanged)
+        {
+            if(image.GetData(itChanged->first))
+                vRuns.back().push_back(*itChanged);
+            else
+                vErase.back().push_back(*itChanged);
+        }
+        if(!bSuccess)
+            break;
+        vHashSeconds.back() = chrono::duration<double>(chrono::steady_clock::now() - tStart).count();
+        if(g_bCompress)
+            for(auto itRun = vRuns.back().begin(); itRun != vRuns.back().end(); ++itRun)
+                compressor.Add(image.GetData(itRun->first), itRun->second);
+    }
+    bool bCacheSaved = true;
+    if(bSuccess && g_bCache)
+    {
+        //Content of regions about to change is unknown until written so forget them on disk before touching flash
+        nImage = 0;
+        for(map<unsigned int,string>::iterator it = g_mFirmwareMap.begin(); it != g_mFirmwareMap.end(); ++it, ++nImage)
+        {
+            for(auto itErase = vErase[nImage].begin(); itErase != vErase[nImage].end(); ++itErase)
+                g_flashCache.Remove(it->first + itErase->first, itErase->second);
+            for(auto itRun = vRuns[nImage].begin(); itRun != vRuns[nImage].end(); ++itRun)
+                g_flashCache.Remove(it->first + itRun->first, itRun->second);
+        }
+        bSuccess = bCacheSaved = g_flashCache.Save();
+    }
+    nImage = 0;
+    //Line rate is 10 bits per byte (8N1) and SLIP escaping plus command overhead reduce useful throughput further
+    double dLineRate = g_pEsp->GetSerial()->GetActualBaud() / 10.0;
+    for(map<unsigned int,string>::iterator it = g_mFirmwareMap.begin(); bSuccess && it != g_mFirmwareMap.end(); ++it, ++nImage)
+    {
+        SparseImage& image = vImages[nImage];
+        size_t nSize = image.GetSize();
+        if(!vFiles[nImage])
+        {
+            bSuccess = false;
+            break;
+        }
+        if(g_bVerbose)
+            cout << "Write " << it->second << " to 0x" << hex << it->first << dec << endl;
+        size_t nWritten = 0;
+        size_t nCompressed = 0;
+        size_t nErased = 0;
+        chrono::steady_clock::time_point tStart = chrono::steady_clock::now();
+        for(auto itErase = vErase[nImage].begin(); bSuccess && itErase != vErase[nImage].end(); ++itErase)
+        {
+            unsigned int nEraseOffset = it->first + itErase->first;
+            if(!(bSuccess = g_pEsp->EraseRegion(nEraseOffset, itErase->second)))
+                break;
+            nErased += itErase->second;
+            if(g_bCache)
+                CacheImage(nEraseOffset, NULL, itErase->second);
+        }
+        for(auto itRun = vRuns[nImage].begin(); bSuccess && itRun != vRuns[nImage].end(); ++itRun)
+        {
+            unsigned int nRunOffset = it->first + itRun->first;
+            if(g_bCompress)
+            {
+                //Blocks are sent as soon as they are compressed
+                bSuccess = g_pEsp->WriteFlashDeflated(nRunOffset, compressor, itRun->second);
+                nCompressed += compressor.Next();
+            }
+            else
+                bSuccess = g_pEsp->WriteFlash(nRunOffset, image.GetData(itRun->first), itRun->second);
+            if(!bSuccess)
+                break;
+            nWritten += itRun->second;
+            if(g_bCache)
+                CacheImage(nRunOffset, image.GetData(itRun->first), itRun->second);
+        }
+        double dSeconds = chrono::duration<double>(chrono::steady_clock::now() - tStart).count();
+        if(!bSuccess)
+        {
+            if(!g_bQuiet)
+                cerr << "Failed to write " << it->second << " to flash" << endl;
+            break;
+        }
+        if(g_bQuiet)
+            continue;
+        double dRate = nWritten ? nWritten / dSeconds : 0;
+        if(nWritten)
+        {
+            cout << "Wrote " << nWritten << " bytes to 0x" << hex << it->first << dec << " in " << dSeconds << "s ("
+                << (unsigned int)dRate << " bytes/s, " << (unsigned int)(100 * dRate / dLineRate) << "% of " << (unsigned int)dLineRate << " bytes/s line rate)" << endl;
+        }
+        if(g_bCompress && nWritten)
+        {
+            //Uncompressed data cannot move faster than line rate so compare measured time with that ideal
+            double dUncompressed = nWritten / dLineRate;
+            cout << "Compressed " << nWritten << " bytes to " << nCompressed << " (" << 100 * nCompressed / nWritten << "%), "
+                << "took " << dSeconds << "s against at least " << dUncompressed << "s uncompressed at line rate, wall-clock speed-up "
+                << dUncompressed / dSeconds << "x" << endl;
+        }
+        if(image.IsSparse())
+        {
+            size_t nHoleSectors = 0;
+            vector<SparseExtent> vHoles = image.GetHoles();
+            for(auto itHole = vHoles.begin(); itHole != vHoles.end(); ++itHole)
+                nHoleSectors += (itHole->nSize + ESP_FLASH_SECTOR - 1) / ESP_FLASH_SECTOR;
+            size_t nErasedSectors = (nErased + ESP_FLASH_SECTOR - 1) / ESP_FLASH_SECTOR;
+            cout << "Sparse " << it->second << ": " << image.GetDataSize() << " bytes in " << image.GetExtents().size() << " extents, "
+                << nHoleSectors << " erased sectors not sent (" << nErasedSectors << " erased on device, " << nHoleSectors - nErasedSectors << " already erased)" << endl;
+        }
+        if(g_bDiff)
+        {
+            size_t nSectors = (nSize + ESP_FLASH_SECTOR - 1) / ESP_FLASH_SECTOR;
+            size_t nChanged = (nWritten + ESP_FLASH_SECTOR - 1) / ESP_FLASH_SECTOR;
+            //Estimate full write at line rate, reduced by compression ratio achieved on changed sectors
+            double dFull = nSize / dLineRate;
+            if(g_bCompress && nWritten)
+                dFull = dFull * nCompressed / nWritten;
+            double dSaved = dFull - dSeconds - vHashSeconds[nImage];
+            cout << "Diff " << it->second << ": " << nChanged << " of " << nSectors << " sectors changed in " << vRuns[nImage].size()
+                << " runs, skipped " << nSectors - nChanged << " sectors (" << nSize - nWritten << " bytes), compare took "
+                << vHashSeconds[nImage] << "s" << (g_bCache ? " (" + to_string(vCached[nImage]) + " sectors from cache)" : "") << ", about " << dSaved << "s saved" << endl;
+        }
+    }
+    for(nImage = 0; nImage < vFiles.size(); ++nImage)
+        if(vFiles[nImage])
+            munmap(const_cast<unsigned char*>(vFiles[nImage]), vFileSizes[nImage]);
+    if(g_bCache && !(bCacheSaved && g_flashCache.Save()) && !g_bQuiet)
+        cerr << "Failed to save flash cache" << endl;
+    return bSuccess;
+}
+
+bool CheckSparseImage(unsigned int nOffset, string sFilename, SparseImage& image)
+{
+    if(!g_pEsp->IsStub())
+    {
+        if(!g_bQuiet)
+            cerr << "Writing sparse image " << sFilename << " requires flasher stub (--stub)" << endl;
+        return false;
+    }
+    if(nOffset % ESP_FLASH_SECTOR)
+    {
+        if(!g_bQuiet)
+            cerr << "Sparse image " << sFilename << " must be written on a sector boundary" << endl;
+        return false;
+    }
+    if(!image.IsComplete())
+    {
+        if(!g_bQuiet)
+            cerr << "Sparse image " << sFilename << " is incomplete - run read_flash again to finish it" << endl;
+        return false;
+    }
+    if(image.CalculateMd5() != image.GetMd5())
+    {
+        if(!g_bQuiet)
+            cerr << "Sparse image " << sFilename << " is corrupt (MD5 mismatch)" << endl;
+        return false;
+    }
+    if(nOffset != image.GetAddress() && !g_bQuiet)
+        cerr << "Sparse image " << sFilename << " was read from 0x" << hex << image.GetAddress() << " but is being written to 0x" << nOffset << dec << endl;
+    return true;
+}
+
+void CacheImage(unsigned int nOffset, const unsigned char* pData, size_t nSize)
+{
+    for(size_t nStart = 0; nStart < nSize; nStart += ESP_FLASH_SECTOR)
+        g_flashCache.Set(nOffset + nStart, pData ? SectorMd5(pData + nStart, min((size_t)ESP_FLASH_SECTOR, nSize - nStart)) : SectorMd5(NULL, 0));
+}
+
+Md5Digest SectorMd5(const unsigned char* pData, size_t nSize)
+{
+    //A write leaves the rest of the last sector erased so digest is of the padded sector
+    Md5 md5;
+    if(pData)
+        md5.Update(pData, nSize);
+    md5.Fill(0xFF, ESP_FLASH_SECTOR - nSize);
+    return md5.Final();
+}
+
+bool ReadFlash()
+{
+    unsigned int nOffset, nSize;
+    try
+    {
+        nOffset = stoul(g_vParameters[0], 0, 0);
+        nSize = stoul(g_vParameters[1], 0, 0);
+    } catch(const std::exception& e)
+    {
+        if(!g_bQuiet)
+            cerr << "Invalid offset or size. Should be decimal, e.g. 1048576 or hexadecimal, e.g. 0x100000" << endl;
+        return false;
+    }
+    string sFilename = g_vParameters[2];
+    if(!nSize)
+    {
+        if(!g_bQuiet)
+            cerr << "Nothing to read" << endl;
+        return false;
+    }
+    if(g_bSparse && nOffset % ESP_FLASH_SECTOR)
+    {
+        if(!g_bQuiet)
+            cerr << "Sparse read must start on a sector boundary" << endl;
+        return false;
+    }
+    if(!g_pEsp->IsStub())
+    {
+        if(!g_bQuiet)
+            cerr << "Reading flash requires flasher stub (--stub)" << endl;
+        return false;
+    }
+    unsigned int nChipId = g_pEsp->ReadId();
+    if(!nChipId)
+    {
+        if(!g_bQuiet)
+            cerr << "Cannot read chip ID to check read progress" << endl;
+        return false;
+    }
+    string sProgress = sFilename + ".progress";
+    unsigned int nDone = 0;
+    bool bResume = LoadReadProgress(sProgress, nChipId, nOffset, nSize, nDone);
+    int nFd = open(sFilename.c_str(), O_RDWR | O_CREAT, 0644);
+    struct stat fileStat;
+    if(nFd < 0 || fstat(nFd, &fileStat) != 0)
+    {
+        if(!g_bQuiet)
+            cerr << "Failed to open " << sFilename << endl;
+        if(nFd >= 0)
+            close(nFd);
+        return false;
+    }
+    vector<SparseExtent> vExtents; //Regions to read, relative to nOffset
+    vector<size_t> vPositions; //Offset within file of each extent
+    size_t nFileSize = 0;
+    void* pMap = MAP_FAILED;
+    if(bResume && fileStat.st_size > 0)
+    {
+        //Continue only if file was started by the same kind of read of the same region
+        nFileSize = fileStat.st_size;
+        pMap = mmap(NULL, nFileSize, PROT_READ | PROT_WRITE, MAP_SHARED, nFd, 0);
+        SparseImage image;
+        if(pMap != MAP_FAILED && image.Attach(static_cast<unsigned char*>(pMap), nFileSize) && image.IsSparse() == g_bSparse
+            && image.GetSize() == nSize && image.GetAddress() == (g_bSparse ? nOffset : 0))
+        {
+            vExtents = image.GetExtents();
+            vPositions = g_bSparse ? SparseImage::GetDataPositions(vExtents) : vector<size_t>(1, 0);
+        }
+        else if(pMap != MAP_FAILED)
+        {
+            munmap(pMap, nFileSize);
+            pMap = MAP_FAILED;
+        }
+    }
+    if(pMap == MAP_FAILED)
+    {
+        nDone = 0;
+        if(g_bSparse)
+        {
+            chrono::steady_clock::time_point tScan = chrono::steady_clock::now();
+            if(!FindDataExtents(nOffset, nSize, vExtents))
+            {
+                close(nFd);
+                return false;
+            }
+            if(g_bVerbose)
+                cout << "Found " << vExtents.size() << " extents in " << chrono::duration<double>(chrono::steady_clock::now() - tScan).count() << "s" << endl;
+            vPositions = SparseImage::GetDataPositions(vExtents);
+            nFileSize = SparseImage::GetFileSize(vExtents);
+        }
+        else
+        {
+            vExtents.push_back({0, nSize});
+            vPositions.push_back(0);
+            nFileSize = nSize;
+        }
+        //Reserve whole file up front so a full disk fails now rather than part way through a long read
+        int nError = 0;
+        if(ftruncate(nFd, nFileSize) != 0 || (nError = posix_fallocate(nFd, 0, nFileSize)) == ENOSPC)
+        {
+            if(!g_bQuiet)
+                cerr << "Failed to allocate " << nFileSize << " bytes for " << sFilename << endl;
+            close(nFd);
+            return false;
+        }
+        pMap = mmap(NULL, nFileSize, PROT_READ | PROT_WRITE, MAP_SHARED, nFd, 0);
+        if(pMap != MAP_FAILED && g_bSparse)
+            SparseImage::WriteHeader(static_cast<unsigned char*>(pMap), nOffset, nSize, vExtents);
+    }
+    close(nFd);
+    if(pMap == MAP_FAILED)
+    {
+        if(!g_bQuiet)
+            cerr << "Failed to map " << sFilename << endl;
+        return false;
+    }
+    unsigned char* pFile = static_cast<unsigned char*>(pMap);
+    //Split extents into chunks, each read and verified by one READ_FLASH
+    vector<SparseExtent> vChunks;
+    vector<size_t> vChunkPositions;
+    size_t nData = 0; //Quantity of bytes to read
+    for(size_t nExtent = 0; nExtent < vExtents.size(); ++nExtent)
+    {
+        for(unsigned int nPos = 0; nPos < vExtents[nExtent].nSize; nPos += READ_FLASH_CHUNK)
+        {
+            vChunks.push_back({vExtents[nExtent].nOffset + nPos, min(READ_FLASH_CHUNK, vExtents[nExtent].nSize - nPos)});
+            vChunkPositions.push_back(vPositions[nExtent] + nPos);
+        }
+        nData += vExtents[nExtent].nSize;
+    }
+    size_t nChunk = 0;
+    size_t nSkipped = 0;
+    while(nChunk < vChunks.size() && nSkipped + vChunks[nChunk].nSize <= nDone)
+        nSkipped += vChunks[nChunk++].nSize;
+    if(nSkipped != nDone)
+        nChunk = nDone = 0; //Progress does not end on a chunk boundary
+    if(nChunk)
+    {
+        //Confirm last verified chunk still matches flash so a stale progress file cannot splice different content
+        const SparseExtent& last = vChunks[nChunk - 1];
+        vector<Md5Digest> vDigests;
+        if(!g_pEsp->FlashMd5(nOffset + last.nOffset, last.nSize, last.nSize, vDigests))
+        {
+            munmap(pMap, nFileSize);
+            return false;
+        }
+        if(vDigests[0] == Md5::Hash(pFile + vChunkPositions[nChunk - 1], last.nSize))
+        {
+            if(!g_bQuiet)
+                cout << "Resuming read of " << sFilename << " at 0x" << hex << nOffset + vChunks[nChunk].nOffset << dec << " (" << nDone << " of " << nData << " bytes already read)" << endl;
+        }
+        else
+        {
+            if(!g_bQuiet)
+                cerr << "Flash differs from " << sFilename << " at 0x" << hex << nOffset + last.nOffset << dec << " - restarting read" << endl;
+            nChunk = nDone = 0;
+        }
+    }
+    unsigned int nStart = nDone;
+    size_t nPage = sysconf(_SC_PAGESIZE);
+    bool bSuccess = true;
+    chrono::steady_clock::time_point tStart = chrono::steady_clock::now();
+    for(; nChunk < vChunks.size(); ++nChunk)
+    {
+        unsigned char* pData = pFile + vChunkPositions[nChunk];
+        if(!g_pEsp->ReadFlash(nOffset + vChunks[nChunk].nOffset, vChunks[nChunk].nSize, pData))
+        {
+            bSuccess = false;
+            break;
+        }
+        //Data must reach the file before progress claims it
+        size_t nSync = vChunkPositions[nChunk] / nPage * nPage;
+        msync(pFile + nSync, vChunkPositions[nChunk] + vChunks[nChunk].nSize - nSync, MS_SYNC);
+        nDone += vChunks[nChunk].nSize;
+        if(!SaveReadProgress(sProgress, nChipId, nOffset, nSize, nDone) && !g_bQuiet)
+            cerr << "Failed to save read progress to " << sProgress << endl;
+        if(g_bVerbose)
+            cout << "Read 0x" << hex << nOffset + vChunks[nChunk].nOffset + vChunks[nChunk].nSize << dec << " (" << 100ULL * nDone / nData << "%)" << endl;
+    }
+    double dSeconds = chrono::duration<double>(chrono::steady_clock::now() - tStart).count();
+    if(bSuccess && g_bSparse)
+    {
+        //Recording digest of whole region marks sparse image complete
+        SparseImage image;
+        image.Attach(pFile, nFileSize);
+        SparseImage::SetMd5(pFile, image.CalculateMd5());
+        msync(pFile, SPARSE_HEADER_SIZE, MS_SYNC);
+    }
+    munmap(pMap, nFileSize);
+    if(!bSuccess)
+    {
+        if(!g_bQuiet)
+            cerr << "Failed to read flash. " << nDone << " of " << nData << " bytes read - run again to resume." << endl;
+        return false;
+    }
+    remove(sProgress.c_str());
+    if(!g_bQuiet)
+    {
+        //Line rate is 10 bits per byte (8N1)
+        double dLineRate = g_pEsp->GetSerial()->GetActualBaud() / 10.0;
+        double dRate = (nDone - nStart) / dSeconds;
+        cout << "Read " << nDone - nStart << " bytes from 0x" << hex << nOffset << dec << " to " << sFilename << " in " << dSeconds << "s ("
+            << (unsigned int)dRate << " bytes/s, " << (unsigned int)(100 * dRate / dLineRate) << "% of " << (unsigned int)dLineRate << " bytes/s line rate)" << endl;
+        if(g_bSparse)
+        {
+            size_t nSectors = (nSize + ESP_FLASH_SECTOR - 1) / ESP_FLASH_SECTOR;
+            size_t nErased = nSectors - (nData + ESP_FLASH_SECTOR - 1) / ESP_FLASH_SECTOR;
+            cout << "Sparse " << sFilename << ": " << nErased << " of " << nSectors << " sectors erased and skipped, "
+                << nData << " bytes in " << vExtents.size() << " extents" << endl;
+        }
+    }
+    return true;
+}
+
+bool FindDataExtents(unsigned int nOffset, unsigned int nSize, vector<SparseExtent>& vExtents)
+{
+    vExtents.clear();
+    vector<Md5Digest> vDigests;
+    if(!g_pEsp->FlashMd5(nOffset, nSize, ESP_FLASH_SECTOR, vDigests))
+        return false;
+    Md5Digest erased = SectorMd5(NULL, 0);
+    for(size_t nSector = 0; nSector < vDigests.size(); ++nSector)
+    {
+        unsigned int nStart = nSector * ESP_FLASH_SECTOR;
+        unsigned int nLength = min((unsigned int)ESP_FLASH_SECTOR, nSize - nStart);
+        if(nLength < (unsigned int)ESP_FLASH_SECTOR)
+        {
+            //Stub hashes only the part of the last sector within the region
+            Md5 md5;
+            md5.Fill(0xFF, nLength);
+            erased = md5.Final();
+        }
+        if(vDigests[nSector] == erased)
+            continue;
+        //Coalesce consecutive sectors holding data into one extent
+        if(!vExtents.empty() && vExtents.back().nOffset + vExtents.back().nSize == nStart)
+            vExtents.back().nSize += nLength;
+        else
+            vExtents.push_back({nStart, nLength});
+    }
+    return true;
+}
+
+bool LoadReadProgress(string sFilename, unsigned int nChipId, unsigned int nOffset, unsigned int nSize, unsigned int& nDone)
+{
+    nDone = 0;
+    ifstream file(sFilename.c_str());
+    string sLine;
+    if(!getline(file, sLine) || sLine.compare(READ_PROGRESS_HEADER) != 0)
+        return false;
+    //Chip ID, offset, size and bytes done, all hexadecimal
+    unsigned int nFileChipId, nFileOffset, nFileSize, nFileDone;
+    if(!(file >> hex >> nFileChipId >> nFileOffset >> nFileSize >> nFileDone))
+        return false;
+    if(nFileChipId != nChipId || nFileOffset != nOffset || nFileSize != nSize || nFileDone > nSize)
+        return false;
+    nDone = nFileDone;
+    return true;
+}
+
+bool SaveReadProgress(string sFilename, unsigned int nChipId, unsigned int nOffset, unsigned int nSize, unsigned int nDone)
+{
+    //Write to temporary file then rename so an interruption never leaves a partial progress file
+    string sTemp = sFilename + "." + to_string(getpid());
+    {
+        ofstream file(sTemp.c_str(), ios::trunc);
+        char sProgress[64];
+        snprintf(sProgress, sizeof(sProgress), "%08x %x %x %x", nChipId, nOffset, nSize, nDone);
+        file << READ_PROGRESS_HEADER << "\n" << sProgress << "\n";
+        if(!file.good())
+        {
+            remove(sTemp.c_str());
+            return false;
+        }
+    }
+    if(rename(sTemp.c_str(), sFilename.c_str()) != 0)
+    {
+        remove(sTemp.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool CheckFlashCache()
+{
+    vector<unsigned int> vCheck = g_flashCache.GetOffsets();
+    shuffle(vCheck.begin(), vCheck.end(), mt19937(random_device()()));
+    vCheck.resize(min(vCheck.size(), (size_t)g_nCacheCheck));
+    for(auto it = vCheck.begin(); it != vCheck.end(); ++it)
+    {
+        vector<Md5Digest> vDevice;
+        Md5Digest cached;
+        if(!g_pEsp->FlashMd5(*it, ESP_FLASH_SECTOR, ESP_FLASH_SECTOR, vDevice))
+            return false;
+        if(g_flashCache.Get(*it, cached) && vDevice[0] == cached)
+            continue;
+        if(!g_bQuiet)
+            cerr << "Flash at 0x" << hex << *it << dec << " differs from cache - discarding cache for this device" << endl;
+        g_flashCache.Clear();
+        break;
+    }
+    if(g_bVerbose)
+        cout << "Spot-checked " << vCheck.size() << " cached sectors, cache holds " << g_flashCache.GetSize() << " sectors" << endl;
+    return true;
+}
+
+bool FindChangedRuns(unsigned int nOffset, SparseImage& image, const vector<SparseExtent>& vRegions, vector<pair<size_t, size_t> >& vRuns, size_t* pCached)
+{
+    vRuns.clear();
+    //Offset within image, size and region of each sector to compare
+    vector<size_t> vStarts;
+    vector<size_t> vLengths;
+    vector<size_t> vRegion;
+    for(size_t nRegion = 0; nRegion < vRegions.size(); ++nRegion)
+    {
+        const SparseExtent& region = vRegions[nRegion];
+        if((nOffset + region.nOffset) % ESP_FLASH_SECTOR)
+        {
+            //Writing would erase the start of the first sector so the whole region must be written
+            if(!g_bQuiet)
+                cerr << "Region at 0x" << hex << nOffset + region.nOffset << dec << " does not start on a sector boundary so is written in full" << endl;
+            vRuns.push_back(make_pair(region.nOffset, region.nSize));
+            continue;
+        }
+        for(size_t nStart = 0; nStart < region.nSize; nStart += ESP_FLASH_SECTOR)
+        {
+            vStarts.push_back(region.nOffset + nStart);
+            vLengths.push_back(min((size_t)ESP_FLASH_SECTOR, region.nSize - nStart));
+            vRegion.push_back(nRegion);
+        }
+    }
+    size_t nSectors = vStarts.size();
+    vector<Md5Digest> vFlash(nSectors);
+    vector<bool> vKnown(nSectors, false);
+    size_t nCached = 0;
+    if(g_bCache)
+    {
+        for(size_t nSector = 0; nSector < nSectors; ++nSector)
+            if((vKnown[nSector] = g_flashCache.Get(nOffset + vStarts[nSector], vFlash[nSector])))
+                ++nCached;
+        if(g_bVerbose)
+            cout << "Cache holds " << nCached << " of " << nSectors << " sectors at 0x" << hex << nOffset << dec << endl;
+    }
+    //Ask device for digests of each run of consecutive sectors not cached, which may span several regions
+    for(size_t nSector = 0; nSector < nSectors;)
+    {
+        if(vKnown[nSector])
+        {
+            ++nSector;
+            continue;
+        }
+        size_t nEnd = nSector + 1;
+        while(nEnd < nSectors && !vKnown[nEnd] && vStarts[nEnd] == vStarts[nEnd - 1] + ESP_FLASH_SECTOR)
+            ++nEnd;
+        vector<Md5Digest> vDevice;
+        if(!g_pEsp->FlashMd5(nOffset + vStarts[nSector], (nEnd - nSector) * ESP_FLASH_SECTOR, ESP_FLASH_SECTOR, vDevice))
+            return false;
+        for(size_t nIndex = 0; nIndex < vDevice.size(); ++nIndex)
+        {
+            vFlash[nSector + nIndex] = vDevice[nIndex];
+            if(g_bCache)
+                g_flashCache.Set(nOffset + vStarts[nSector + nIndex], vDevice[nIndex]);
+        }
+        nSector = nEnd;
+    }
+    size_t nLastRegion = vRegions.size();
+    for(size_t nSector = 0; nSector < nSectors; ++nSector)
+    {
+        const unsigned char* pData = image.GetData(vStarts[nSector]);
+        if(SectorMd5(pData, pData ? vLengths[nSector] : 0) == vFlash[nSector])
+            continue;
+        //Coalesce consecutive changed sectors of the same region into one erase or write
+        if(!vRuns.empty() && vRegion[nSector] == nLastRegion && vRuns.back().first + vRuns.back().second == vStarts[nSector])
+            vRuns.back().second += vLengths[nSector];
+        else
+            vRuns.push_back(make_pair(vStarts[nSector], vLengths[nSector]));
+        nLastRegion = vRegion[nSector];
+    }
+    sort(vRuns.begin(), vRuns.end());
+    if(pCached)
+        *pCached = nCached;
+    if(g_bVerbose)
+        cout << "Compared " << nSectors << " sectors at 0x" << hex << nOffset << dec << " with flash (" << nCached << " from cache), "
+            << vRuns.size() << " runs to erase or write" << endl;
+    return true;
 }
@@ -4,6 +4,12 @@
 #include <vector>
 #include <map>
 #include "esp8266.h"
+#include "espsimulator.h"
+#include "benchmark.h"
+#include "tracereplay.h"
+#include "terminal.h"
+#include "flashcache.h"
+#include "sparseimage.h"
 
 enum COMMAND
 {
@@ -17,11 +23,48 @@ enum COMMAND
     TERMINAL,
     ELF2IMAGE,
     MAC,
-    READ_FLASH
+    READ_FLASH,
+    SIMULATE,
+    BENCHMARK,
+    REPLAY
+};
+
+// Long options without a short form
+enum LONG_OPTION
+{
+    OPTION_LOW_LATENCY = 256,
+    OPTION_CALIBRATE,
+    OPTION_SIM_BAUD,
+    OPTION_SIM_LATENCY,
+    OPTION_SIM_ERRORS,
+    OPTION_SIM_SEED,
+    OPTION_SIM_FLASH_SIZE,
+    OPTION_DEPTH,
+    OPTION_BENCH_SIZE,
+    OPTION_BENCH_BAUD,
+    OPTION_BENCH_BLOCK,
+    OPTION_BENCH_DEPTH,
+    OPTION_BENCH_COMPRESS,
+    OPTION_BENCH_SLIP,
+    OPTION_BENCH_CHECKSUM,
+    OPTION_BENCH_WRITE,
+    OPTION_BENCH_LOW_LATENCY,
+    OPTION_BENCH_REGS,
+    OPTION_BENCH_SIM_LATENCY,
+    OPTION_STATS,
+    OPTION_TRACE,
+    OPTION_CAPTURE,
+    OPTION_DIFF,
+    OPTION_CACHE,
+    OPTION_CACHE_CHECK,
+    OPTION_SPARSE
 };
 
 using namespace std;
 
+const static unsigned int READ_FLASH_CHUNK = 0x10000; //Bytes read and verified by each READ_FLASH before progress is recorded
+const static char READ_PROGRESS_HEADER[] = "# ribanEspTool read_flash progress v1"; //First line of read progress file
+
 /** @brief  Parse the command line
 *   @param  argc Quantity of command line parameters
 *   @param  argv Pointer to each command line argument
@@ -50,27 +93,147 @@ void Reset(bool bflash = false);
 */
 bool Elf2Image(string sElf, string sImage);
 
-/** @brief  Write a firmware image to ESP8266
-*   @param  nOffset Address to write firmware
-*   @param  sFilename Filename of the firmware image
+/** @brief  Write each firmware image in g_mFirmwareMap to ESP8266
 *   @retval bool True on success
+*   @note   Images are compressed on a worker thread ahead of sending if g_bCompress is set
+*   @note   Only sectors that differ from flash are written if g_bDiff is set. The content cache is updated if g_bCache is set.
+*   @note   Sparse images (see SparseImage) are detected by content. Only their extents are sent. Erased regions are erased on the device only where flash is not already erased.
+*/
+bool WriteFlash();
+
+/** @brief  Check a sparse image may be written
+*   @param  nOffset Flash address to which image is to be written
+*   @param  sFilename Name of image file (for messages)
+*   @param  image Sparse image
+*   @retval bool True if flasher stub is running, offset is on a sector boundary and image is complete and matches its MD5
+*/
+bool CheckSparseImage(unsigned int nOffset, string sFilename, SparseImage& image);
+
+/** @brief  Read a region of flash to a file, resuming an interrupted read of the same region
+*   @retval bool True on success
+*   @note   Command parameters are offset, size and filename. Requires flasher stub.
+*   @note   Output file is preallocated and memory mapped so data is decoded straight into it. Progress is recorded in <filename>.progress after each READ_FLASH_CHUNK is verified by MD5.
+*   @note   If g_bSparse is set, erased sectors are found with FindDataExtents and skipped, and the file is written as a sparse image (see SparseImage)
+*/
+bool ReadFlash();
+
+/** @brief  Find the regions of flash that are not erased
+*   @param  nOffset Flash address of region, on a sector boundary
+*   @param  nSize Quantity of bytes in region
+*   @param  vExtents Vector to populate with offset within region and size of each run of sectors that are not erased
+*   @retval bool True on success
+*   @note   Compares the MD5 calculated by the flasher stub for each ESP_FLASH_SECTOR with the MD5 of erased flash so erased sectors are found without reading them
+*/
+bool FindDataExtents(unsigned int nOffset, unsigned int nSize, vector<SparseExtent>& vExtents);
+
+/** @brief  Load progress of an interrupted read
+*   @param  sFilename Name of progress file
+*   @param  nChipId Chip ID of device being read
+*   @param  nOffset Flash address of region being read
+*   @param  nSize Quantity of bytes in region
+*   @param  nDone Populated with quantity of bytes already read and verified
+*   @retval bool True if progress file exists and describes the same device and region
+*/
+bool LoadReadProgress(string sFilename, unsigned int nChipId, unsigned int nOffset, unsigned int nSize, unsigned int& nDone);
+
+/** @brief  Save progress of a read
+*   @param  sFilename Name of progress file, replaced atomically
+*   @param  nChipId Chip ID of device being read
+*   @param  nOffset Flash address of region being read
+*   @param  nSize Quantity of bytes in region
+*   @param  nDone Quantity of bytes read and verified
+*   @retval bool True on success
+*/
+bool SaveReadProgress(string sFilename, unsigned int nChipId, unsigned int nOffset, unsigned int nSize, unsigned int nDone);
+
+/** @brief  Find the sectors of regions of an image that differ from flash content
+*   @param  nOffset Flash address of image
+*   @param  image Image, compared with erased flash where it has no data
+*   @param  vRegions Offset within image and size of each region to compare, in ascending order
+*   @param  vRuns Vector to populate with offset within image and size of each run of consecutive changed sectors within a region, in ascending order
+*   @param  pCached Pointer to populate with quantity of sectors found in cache (Default: NULL)
+*   @retval bool True on success
+*   @note   Compares host MD5 of each ESP_FLASH_SECTOR with the digest calculated by the flasher stub, asking once for each run of consecutive uncached sectors across all regions. Regions not starting on a sector boundary are written in full.
+*   @note   If g_bCache is set, digests in g_flashCache are used instead of asking the device. Call CheckFlashCache first.
+*/
+bool FindChangedRuns(unsigned int nOffset, SparseImage& image, const vector<SparseExtent>& vRegions, vector<pair<size_t, size_t> >& vRuns, size_t* pCached = NULL);
+
+/** @brief  Spot-check g_nCacheCheck random sectors of g_flashCache against the device, clearing the cache on any mismatch
+*   @retval bool True on success (including when cache is cleared), false if device could not be read
+*   @note   Detects flash changed by other tools. Call once before any FindChangedRuns.
+*/
+bool CheckFlashCache();
+
+/** @brief  Get MD5 of a sector as it is after writing data to it
+*   @param  pData Pointer to data or NULL for an erased sector
+*   @param  nSize Quantity of bytes, up to ESP_FLASH_SECTOR
+*   @retval Md5Digest Digest of data padded with erased value (0xFF) to a whole sector
+*/
+Md5Digest SectorMd5(const unsigned char* pData, size_t nSize);
+
+/** @brief  Record digests of data written to flash in g_flashCache
+*   @param  nOffset Flash address of data, at start of a sector
+*   @param  pData Pointer to data or NULL for erased sectors
+*   @param  nSize Quantity of bytes
+*/
+void CacheImage(unsigned int nOffset, const unsigned char* pData, size_t nSize);
+
+/** @brief  Memory map a file for reading
+*   @param  sFilename Name of file
+*   @param  nSize Populated with size of file
+*   @retval const unsigned char* Pointer to file content or NULL on failure. Release with munmap.
+*/
+const unsigned char* MapFile(string sFilename, size_t& nSize);
+
+/** @brief  Run ESP8266 simulator on a pseudo terminal until interrupted
+*   @retval bool True on success
+*   @note   Prints pseudo terminal device name to pass to --port. Loads flash from and saves flash to first command parameter if provided.
+*/
+bool Simulate();
+
+/** @brief  Run protocol throughput benchmark against the simulator
+*   @retval bool True if every configuration succeeded
+*   @note   Prints a table unless quiet. Writes JSON to first command parameter if provided ("-" for stdout).
+*/
+bool RunBenchmark();
+
+/** @brief  Parse a comma separated list of unsigned integers
+*   @param  sList List, e.g. "1024,4096" (values may be hexadecimal with 0x prefix)
+*   @retval vector<unsigned int> Values
+*   @note   Throws std::exception on invalid value
+*/
+vector<unsigned int> ParseList(string sList);
+
+/** @brief  Replay a serial trace through the protocol stack
+*   @retval bool True if trace was loaded and retransmitted data matched the recording
+*   @note   Trace filename is first command parameter. Optional second parameter is quantity of loops.
+*/
+bool Replay();
+
+/** @brief  Show per-operation protocol statistics if requested on command line
+*   @note   Prints table to stdout unless quiet. Writes JSON to g_sStatsFile if set ("-" for stdout).
+*/
+void ReportStats();
+
+/** @brief  Upload and run flasher stub if one was requested on command line, then switch to fast baud if requested
+*   @retval bool True if no stub requested or stub is running
 */
-bool WriteFlash(unsigned int nOffset, string sFilename);
+bool LoadStub();
 
 /** @todo Implement functions:
 *   load_ram
 *   dump_mem
 *   read_mem
 *   write_mem
-*   write_flash
+*   write_flash - done
 *   run
 *   image_info
 *   make_image
 *   elf2image
-*   read_mac
-*   chip_id
+*   read_mac - done
+*   chip_id - done
 *   flash_id
-*   read_flash
+*   read_flash - done
 *   verify_flash
 *   erase_flash
 *   version - done
@@ -79,8 +242,30 @@ bool WriteFlash(unsigned int nOffset, string sFilename);
 //Global variables
 bool g_bVerbose = false; //True for verbose output
 bool g_bQuiet = false; //True to suppress all output
+bool g_bCompress = false; //True to compress images before sending to ESP8266
+bool g_bDiff = false; //True to write only sectors whose content differs from flash
+bool g_bSparse = false; //True to skip erased sectors when reading flash, writing a sparse image
+bool g_bCache = false; //True to use host-side cache of flash sector digests with diff flashing
+unsigned int g_nCacheCheck = 2; //Quantity of cached sectors to verify with the device before trusting the cache
+FlashCache g_flashCache; //Flash sector digests of connected device
+bool g_bLowLatency = false; //True to tune serial port for low request / response latency
+bool g_bStats = false; //True to record and report per-operation protocol statistics
+string g_sStatsFile; //Filename to write statistics as JSON (empty for none)
+string g_sTraceFile; //Filename to record serial trace (empty for none)
+string g_sCaptureFile; //Filename to capture terminal output with timestamps (empty for none)
 unsigned int g_nBaud = 115200; //Baud rate
+int g_nFastBaud = -1; //Baud to switch to after connecting (0 for fastest that works, -1 to stay at g_nBaud)
 string g_sPort = "/dev/ttyUSB0"; //Serial port device
+unsigned int g_nPipelineDepth = 0; //Quantity of flash write blocks in flight (0 for default)
+unsigned int g_nSimBaud = 0; //Simulator line rate (0 for unlimited)
+unsigned int g_nSimLatency = 0; //Simulator response latency in microseconds
+double g_dSimErrors = 0; //Simulator probability of corrupting each byte
+unsigned int g_nSimSeed = 1; //Simulator random seed
+size_t g_nSimFlashSize = SIM_FLASH_SIZE; //Simulator flash size in bytes
+Benchmark g_benchmark; //Protocol benchmark configured from command line
+string g_sReset = "classic"; //Hardware reset sequence name or custom sequence
+bool g_bCalibrate = false; //True to find shortest holds for reset sequence instead of resetting
+string g_sStub; //Filename of flasher stub image to upload to RAM (empty to use ROM loader)
 string g_sAppName; //Application name
 vector<string>g_vParameters; //Vector of command line parameters after command
 map<unsigned int,string>g_mFirmwareMap; //Map of flash offset to firmware filenames
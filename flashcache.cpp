@@ -0,0 +1,157 @@
+#include "flashcache.h"
+#include "esp8266.h"
+#include <fstream>
+#include <sstream>
+#include <cstdio> //provides rename, snprintf
+#include <cstdlib> //provides getenv
+#include <sys/stat.h> //provides mkdir
+#include <unistd.h> //provides getpid
+#include <errno.h> //provides errno
+
+const static char FLASH_CACHE_HEADER[] = "# ribanEspTool flash cache v1"; //First line of each cache file
+
+FlashCache::FlashCache() :
+    m_bDirty(false)
+{
+}
+
+FlashCache::~FlashCache()
+{
+}
+
+void FlashCache::SetDirectory(string sDirectory)
+{
+    m_sDirectory = sDirectory;
+}
+
+string FlashCache::GetDefaultDirectory()
+{
+    const char* sXdg = getenv("XDG_CACHE_HOME");
+    if(sXdg && *sXdg)
+        return string(sXdg) + "/ribanEspTool";
+    const char* sHome = getenv("HOME");
+    return string(sHome ? sHome : ".") + "/.cache/ribanEspTool";
+}
+
+bool FlashCache::Load(unsigned int nChipId)
+{
+    if(m_sDirectory.empty())
+        m_sDirectory = GetDefaultDirectory();
+    char sName[16];
+    snprintf(sName, sizeof(sName), "%08x", nChipId);
+    m_sFilename = m_sDirectory + "/" + sName + ".md5";
+    m_mDigests.clear();
+    m_bDirty = false;
+    ifstream file(m_sFilename.c_str());
+    string sLine;
+    if(!getline(file, sLine) || sLine.compare(FLASH_CACHE_HEADER) != 0)
+        return false;
+    while(getline(file, sLine))
+    {
+        //Each line: <offset> <digest>
+        istringstream ssLine(sLine);
+        unsigned int nOffset;
+        string sDigest;
+        if(!(ssLine >> hex >> nOffset >> sDigest) || sDigest.size() != 2 * MD5_SIZE)
+            continue;
+        Md5Digest digest;
+        bool bValid = true;
+        for(size_t nByte = 0; bValid && nByte < MD5_SIZE; ++nByte)
+        {
+            try
+            {
+                digest[nByte] = stoul(sDigest.substr(nByte * 2, 2), 0, 16);
+            } catch(const std::exception& e)
+            {
+                bValid = false;
+            }
+        }
+        if(bValid)
+            m_mDigests[nOffset] = digest;
+    }
+    return true;
+}
+
+bool FlashCache::Save()
+{
+    if(!m_bDirty || m_sFilename.empty())
+        return true;
+    if(!MakeDirectory(m_sDirectory))
+        return false;
+    //Write to temporary file then rename so readers never see a partial file
+    string sTemp = m_sFilename + "." + to_string(getpid());
+    {
+        ofstream file(sTemp.c_str(), ios::trunc);
+        file << FLASH_CACHE_HEADER << "\n";
+        char sOffset[16];
+        for(auto it = m_mDigests.begin(); it != m_mDigests.end(); ++it)
+        {
+            snprintf(sOffset, sizeof(sOffset), "%06x ", it->first);
+            file << sOffset << Md5::ToString(it->second) << "\n";
+        }
+        if(!file.good())
+        {
+            remove(sTemp.c_str());
+            return false;
+        }
+    }
+    if(rename(sTemp.c_str(), m_sFilename.c_str()) != 0)
+    {
+        remove(sTemp.c_str());
+        return false;
+    }
+    m_bDirty = false;
+    return true;
+}
+
+bool FlashCache::Get(unsigned int nOffset, Md5Digest& digest)
+{
+    auto it = m_mDigests.find(nOffset);
+    if(it == m_mDigests.end())
+        return false;
+    digest = it->second;
+    return true;
+}
+
+void FlashCache::Set(unsigned int nOffset, const Md5Digest& digest)
+{
+    m_mDigests[nOffset] = digest;
+    m_bDirty = true;
+}
+
+void FlashCache::Remove(unsigned int nOffset, unsigned int nSize)
+{
+    unsigned int nStart = nOffset / ESP_FLASH_SECTOR * ESP_FLASH_SECTOR;
+    auto itEnd = m_mDigests.lower_bound(nOffset + nSize);
+    for(auto it = m_mDigests.lower_bound(nStart); it != itEnd;)
+    {
+        it = m_mDigests.erase(it);
+        m_bDirty = true;
+    }
+}
+
+void FlashCache::Clear()
+{
+    if(!m_mDigests.empty())
+        m_bDirty = true;
+    m_mDigests.clear();
+}
+
+vector<unsigned int> FlashCache::GetOffsets()
+{
+    vector<unsigned int> vOffsets;
+    for(auto it = m_mDigests.begin(); it != m_mDigests.end(); ++it)
+        vOffsets.push_back(it->first);
+    return vOffsets;
+}
+
+bool FlashCache::MakeDirectory(string sPath)
+{
+    struct stat info;
+    if(stat(sPath.c_str(), &info) == 0)
+        return S_ISDIR(info.st_mode);
+    size_t nSlash = sPath.find_last_of('/');
+    if(nSlash != string::npos && nSlash > 0 && !MakeDirectory(sPath.substr(0, nSlash)))
+        return false;
+    return mkdir(sPath.c_str(), 0755) == 0 || errno == EEXIST;
+}
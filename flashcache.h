@@ -0,0 +1,83 @@
+/** Host-side flash content cache
+*   Author: agent
+*   Date: 2026-10-17
+*   License: LGPL
+*/
+
+#pragma once
+#include "md5.h"
+#include <string>
+#include <map>
+#include <vector>
+
+using namespace std;
+
+/** MD5 of each flash sector per device, held in a text file per chip ID with a line per sector, replaced atomically when saved */
+class FlashCache
+{
+    public:
+        FlashCache();
+        virtual ~FlashCache();
+
+        /** @brief  Set directory holding cache files
+        *   @param  sDirectory Path to directory, created when first saved. Empty for default (GetDefaultDirectory).
+        */
+        void SetDirectory(string sDirectory);
+
+        /** @brief  Load cached digests for a device
+        *   @param  nChipId Chip ID of device (see ESP8266::ReadId)
+        *   @retval bool True if cache file was loaded. False if device has no cache yet (cache is then empty).
+        */
+        bool Load(unsigned int nChipId);
+
+        /** @brief  Save digests for current device if changed
+        *   @retval bool True on success
+        */
+        bool Save();
+
+        /** @brief  Get cached digest of a sector
+        *   @param  nOffset Flash address of sector
+        *   @param  digest Populated with digest if cached
+        *   @retval bool True if sector is cached
+        */
+        bool Get(unsigned int nOffset, Md5Digest& digest);
+
+        /** @brief  Record digest of a sector
+        *   @param  nOffset Flash address of sector
+        *   @param  digest Digest of sector content
+        */
+        void Set(unsigned int nOffset, const Md5Digest& digest);
+
+        /** @brief  Forget sectors whose content is unknown, e.g. during a write
+        *   @param  nOffset Flash address of first sector
+        *   @param  nSize Quantity of bytes (whole sectors covering region are forgotten)
+        */
+        void Remove(unsigned int nOffset, unsigned int nSize);
+
+        /** @brief  Forget all sectors of current device, e.g. if flash was changed by another tool
+        */
+        void Clear();
+
+        /** @brief  Get quantity of cached sectors
+        *   @retval size_t Quantity of sectors
+        */
+        size_t GetSize() {return m_mDigests.size();};
+
+        /** @brief  Get flash address of each cached sector
+        *   @retval vector<unsigned int> Addresses in ascending order
+        */
+        vector<unsigned int> GetOffsets();
+
+        /** @brief  Get default cache directory
+        *   @retval string $XDG_CACHE_HOME/ribanEspTool or ~/.cache/ribanEspTool
+        */
+        static string GetDefaultDirectory();
+
+    private:
+        bool MakeDirectory(string sPath); // Create directory and any missing parents. Returns true if directory exists
+
+        string m_sDirectory; //Cache directory
+        string m_sFilename; //Cache file of current device
+        map<unsigned int, Md5Digest> m_mDigests; //Digest of each cached sector indexed by flash address
+        bool m_bDirty; //True if digests changed since loaded
+};
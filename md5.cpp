@@ -0,0 +1,152 @@
+#include "md5.h"
+#include <cstring> //provides memcpy, memset
+
+// Per-round shift amounts
+static const unsigned int MD5_SHIFT[64] = {
+    7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+    5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20,
+    4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+    6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21};
+
+// Per-round constants, floor(abs(sin(i + 1)) * 2^32)
+static const uint32_t MD5_K[64] = {
+    0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+    0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+    0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+    0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+    0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+    0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+    0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+    0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391};
+
+Md5::Md5()
+{
+    Reset();
+}
+
+Md5::~Md5()
+{
+}
+
+void Md5::Reset()
+{
+    m_aState[0] = 0x67452301;
+    m_aState[1] = 0xefcdab89;
+    m_aState[2] = 0x98badcfe;
+    m_aState[3] = 0x10325476;
+    m_nLength = 0;
+}
+
+void Md5::Update(const unsigned char* pData, size_t nSize)
+{
+    size_t nBuffered = m_nLength % MD5_BLOCK;
+    m_nLength += nSize;
+    if(nBuffered)
+    {
+        //Complete partial block first
+        size_t nCopy = MD5_BLOCK - nBuffered;
+        if(nCopy > nSize)
+            nCopy = nSize;
+        memcpy(m_aBuffer + nBuffered, pData, nCopy);
+        pData += nCopy;
+        nSize -= nCopy;
+        if(nBuffered + nCopy < MD5_BLOCK)
+            return;
+        Transform(m_aBuffer);
+    }
+    //Whole blocks are processed in place
+    for(; nSize >= MD5_BLOCK; pData += MD5_BLOCK, nSize -= MD5_BLOCK)
+        Transform(pData);
+    memcpy(m_aBuffer, pData, nSize);
+}
+
+void Md5::Fill(unsigned char nValue, size_t nSize)
+{
+    unsigned char aBlock[MD5_BLOCK];
+    memset(aBlock, nValue, sizeof(aBlock));
+    for(; nSize >= MD5_BLOCK; nSize -= MD5_BLOCK)
+        Update(aBlock, MD5_BLOCK);
+    Update(aBlock, nSize);
+}
+
+Md5Digest Md5::Final()
+{
+    //Pad with 0x80 then zeros to 56 bytes in block, followed by length in bits
+    uint64_t nBits = m_nLength * 8;
+    unsigned char aPad[MD5_BLOCK + 8] = {0x80};
+    size_t nBuffered = m_nLength % MD5_BLOCK;
+    size_t nPad = (nBuffered < 56) ? 56 - nBuffered : 120 - nBuffered;
+    for(int nByte = 0; nByte < 8; ++nByte)
+        aPad[nPad + nByte] = (nBits >> (8 * nByte)) & 0xFF;
+    Update(aPad, nPad + 8);
+    Md5Digest digest;
+    for(int nWord = 0; nWord < 4; ++nWord)
+        for(int nByte = 0; nByte < 4; ++nByte)
+            digest[nWord * 4 + nByte] = (m_aState[nWord] >> (8 * nByte)) & 0xFF;
+    return digest;
+}
+
+Md5Digest Md5::Hash(const unsigned char* pData, size_t nSize)
+{
+    Md5 md5;
+    md5.Update(pData, nSize);
+    return md5.Final();
+}
+
+string Md5::ToString(const Md5Digest& digest)
+{
+    const char* sHex = "0123456789abcdef";
+    string sDigest;
+    for(size_t nByte = 0; nByte < MD5_SIZE; ++nByte)
+    {
+        sDigest += sHex[digest[nByte] >> 4];
+        sDigest += sHex[digest[nByte] & 0x0F];
+    }
+    return sDigest;
+}
+
+void Md5::Transform(const unsigned char* pBlock)
+{
+    uint32_t aWords[16];
+    for(int nWord = 0; nWord < 16; ++nWord)
+        aWords[nWord] = pBlock[nWord * 4] | (pBlock[nWord * 4 + 1] << 8) | (pBlock[nWord * 4 + 2] << 16) | ((uint32_t)pBlock[nWord * 4 + 3] << 24);
+    uint32_t a = m_aState[0];
+    uint32_t b = m_aState[1];
+    uint32_t c = m_aState[2];
+    uint32_t d = m_aState[3];
+    for(int nRound = 0; nRound < 64; ++nRound)
+    {
+        uint32_t f;
+        int nWord;
+        if(nRound < 16)
+        {
+            f = (b & c) | (~b & d);
+            nWord = nRound;
+        }
+        else if(nRound < 32)
+        {
+            f = (d & b) | (~d & c);
+            nWord = (5 * nRound + 1) % 16;
+        }
+        else if(nRound < 48)
+        {
+            f = b ^ c ^ d;
+            nWord = (3 * nRound + 5) % 16;
+        }
+        else
+        {
+            f = c ^ (b | ~d);
+            nWord = (7 * nRound) % 16;
+        }
+        uint32_t nTemp = d;
+        d = c;
+        c = b;
+        uint32_t x = a + f + MD5_K[nRound] + aWords[nWord];
+        b = b + ((x << MD5_SHIFT[nRound]) | (x >> (32 - MD5_SHIFT[nRound])));
+        a = nTemp;
+    }
+    m_aState[0] += a;
+    m_aState[1] += b;
+    m_aState[2] += c;
+    m_aState[3] += d;
+}
@@ -0,0 +1,67 @@
+/** MD5 message digest
+*   Author: agent
+*   Date: 2026-10-17
+*   License: LGPL
+*/
+
+#pragma once
+#include <array>
+#include <string>
+#include <stdint.h> //provides fixed width integers
+#include <cstddef> //provides size_t
+
+using namespace std;
+
+const static size_t MD5_SIZE = 16; //Size of digest in bytes
+const static size_t MD5_BLOCK = 64; //Size of block processed by each transform
+
+typedef array<unsigned char, MD5_SIZE> Md5Digest;
+
+class Md5
+{
+    public:
+        Md5();
+        virtual ~Md5();
+
+        /** @brief  Start a new digest
+        */
+        void Reset();
+
+        /** @brief  Add data to digest
+        *   @param  pData Pointer to data
+        *   @param  nSize Quantity of bytes
+        */
+        void Update(const unsigned char* pData, size_t nSize);
+
+        /** @brief  Add repeated bytes to digest, e.g. erased flash padding
+        *   @param  nValue Value of each byte
+        *   @param  nSize Quantity of bytes
+        */
+        void Fill(unsigned char nValue, size_t nSize);
+
+        /** @brief  Finish digest
+        *   @retval Md5Digest Digest of all data added since Reset()
+        *   @note   Call Reset() before adding more data
+        */
+        Md5Digest Final();
+
+        /** @brief  Calculate digest of a block of data
+        *   @param  pData Pointer to data
+        *   @param  nSize Quantity of bytes
+        *   @retval Md5Digest Digest
+        */
+        static Md5Digest Hash(const unsigned char* pData, size_t nSize);
+
+        /** @brief  Format digest as lower case hexadecimal
+        *   @param  digest Digest
+        *   @retval string 32 character hexadecimal representation
+        */
+        static string ToString(const Md5Digest& digest);
+
+    private:
+        void Transform(const unsigned char* pBlock); // Process one MD5_BLOCK of data
+
+        uint32_t m_aState[4]; //Digest state A, B, C, D
+        uint64_t m_nLength; //Total quantity of bytes added
+        unsigned char m_aBuffer[MD5_BLOCK]; //Partial block awaiting more data
+};
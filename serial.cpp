@@ -1,25 +1,61 @@
 #include "serial.h"
+#include "serialbaud.h"
 #include <iostream> //provides std out for error logging (cerr)
 #include <string.h> //provides error messages
 #include <fcntl.h> //provides tty control
 #include <sys/ioctl.h> //provides low-level control of serial port
 #include <unistd.h> //provides open() (eventually)
+#include <errno.h> //provides errno
+#include <poll.h> //provides poll() to wait for port readiness
+#include <sys/uio.h> //provides writev() for scatter / gather writes
+#include <chrono> //provides steady clock for read deadlines
+#include <algorithm> //provides min
+#include <fstream> //provides access to sysfs attributes
+#include <stdlib.h> //provides realpath
+#include <libgen.h> //provides basename
+#include <stdint.h> //provides fixed width integers
+#if defined(__linux__)
+#include <linux/serial.h> //provides serial_struct and ASYNC_LOW_LATENCY
+#endif // __linux__
+
+const static int SERIAL_LATENCY_TIMER = 1; //FTDI latency timer (ms) in low latency mode. Driver default is 16ms.
 
 Serial::Serial() :
     m_bVerbose(false),
+    m_bLowLatency(false),
+    m_nSerialFlags(-1),
+    m_nLatencyTimer(-1),
+    m_bDrain(false),
+    m_nWriteCalls(0),
+    m_nBytesWritten(0),
+    m_nReadCalls(0),
+    m_nPollCalls(0),
     m_nFd(-1),
     m_nBaud(115200),
+    m_nActualBaud(0),
+    m_bCustomBaud(false),
     m_nWordLength(8),
     m_sPort("/dev/ttyUSB0"),
     m_sParity("n"),
-    m_nStopBits(1)
+    m_nStopBits(1),
+    m_vRing(SERIAL_RING_SIZE),
+    m_nRingHead(0),
+    m_nRingTail(0),
+    m_nTraceFd(-1),
+    m_pReplayRx(NULL),
+    m_nReplayRxSize(0),
+    m_nReplayRxPos(0),
+    m_pReplayTx(NULL),
+    m_nReplayTxSize(0),
+    m_nReplayTxPos(0),
+    m_nReplayMismatches(0)
 {
     PopulateBaud();
 }
 
 Serial::~Serial()
 {
-
+    SetTrace("");
 }
 
 bool Serial::Open(string sPort, unsigned int nBaud, string sParity, unsigned int nBits, unsigned int nStop)
@@ -39,7 +75,7 @@ bool Serial::Open(string sPort, unsigned int nBaud, string sParity, unsigned int
         //Error - cannot close port
         return false;
     }
-    m_nFd = open(m_sPort.c_str(), O_RDWR | O_NOCTTY | O_SYNC);
+    m_nFd = open(m_sPort.c_str(), O_RDWR | O_NOCTTY); //O_SYNC replaced by optional drain mode (see SetDrain)
     if(m_nFd < 0)
     {
         if(m_bVerbose)
@@ -65,15 +101,31 @@ bool Serial::Open(string sPort, unsigned int nBaud, string sParity, unsigned int
     m_tty.c_oflag &= ~OPOST;
 
     // Set low values for timing to recieve data straight away
+    // Reads are only issued once poll() reports data so return whatever is ready without inter-byte delay
     m_tty.c_cc[VMIN] = 1;
-    m_tty.c_cc[VTIME] = 1;
+    m_tty.c_cc[VTIME] = 0;
+    if(m_bLowLatency)
+    {
+        // Never block in read() - a response may be split across USB packets and poll() already provides the wait
+        m_tty.c_cc[VMIN] = 0;
+        if(m_bVerbose)
+            cout << "Serial port " << m_sPort << " VMIN=0 VTIME=0" << endl;
+        ApplyLowLatency();
+    }
 
+    ResetCounters();
+    m_nActualBaud = 0;
     SetBaud(m_nBaud);
     SetWord(m_nWordLength);
     SetParity(m_sParity);
     SetStopBits(m_nStopBits);
     if(SetAttributes())
+    {
+        m_nActualBaud = ReadBaud();
+        if(m_bVerbose && m_nActualBaud && m_nActualBaud != m_nBaud)
+            cerr << "Requested baud " << m_nBaud << " but port configured for " << m_nActualBaud << endl;
         return true;
+    }
 
     //Something isn't right so fail gracefully
     Close();
@@ -86,8 +138,11 @@ bool Serial::Close()
 {
     if(m_nFd <0)
         return true; //Aready closed
+    RestoreLatency();
+    TraceFlush();
     close(m_nFd); //!@todo Does close provide return value?
     m_nFd = -1;
+    m_nRingHead = m_nRingTail = 0;
     return true;
 }
 
@@ -98,19 +153,66 @@ void Serial::SetPort(string sPort)
 
 bool Serial::SetBaud(unsigned int nBaud)
 {
-    if(m_nFd < 0)
-        return false;
-    auto it = m_mBaud.find(nBaud);
-    if(it == m_mBaud.end())
+    if(!IsBaudSupported(nBaud))
     {
         if(m_bVerbose) cerr << "Invalid baud " << nBaud << endl;
         return false;
     }
-    cfsetospeed(&m_tty, it->second);
-    cfsetispeed(&m_tty, it->second);
+    m_nBaud = nBaud;
+    if(m_nFd < 0)
+        return true; //Applied when port is opened
+    if(!ApplyBaud())
+        return false;
+    m_nActualBaud = ReadBaud();
+    if(m_nTraceFd >= 0)
+    {
+        unsigned char aBaud[4] = {(unsigned char)m_nBaud, (unsigned char)(m_nBaud >> 8), (unsigned char)(m_nBaud >> 16), (unsigned char)(m_nBaud >> 24)};
+        Trace(SERIAL_TRACE_BAUD, aBaud, sizeof(aBaud));
+    }
+    return true;
+}
+
+bool Serial::IsBaudSupported(unsigned int nBaud)
+{
+    if(m_mBaud.find(nBaud) != m_mBaud.end())
+        return true;
+    return (nBaud != 0 && SerialCustomBaudAvailable());
+}
+
+bool Serial::ApplyBaud()
+{
+    auto it = m_mBaud.find(m_nBaud);
+    m_bCustomBaud = (it == m_mBaud.end());
+    if(m_bCustomBaud)
+    {
+        //No Bxxx value so leave a standard rate in m_tty and override it with BOTHER after each tcsetattr (see SetAttributes)
+        cfsetospeed(&m_tty, B38400);
+        cfsetispeed(&m_tty, B38400);
+    }
+    else
+    {
+        cfsetospeed(&m_tty, it->second);
+        cfsetispeed(&m_tty, it->second);
+    }
     return SetAttributes();
 }
 
+unsigned int Serial::ReadBaud()
+{
+    unsigned int nBaud = SerialGetActualBaud(m_nFd);
+    if(nBaud)
+        return nBaud;
+    //Fall back to reverse lookup of Bxxx value
+    termios tty;
+    if(m_nFd < 0 || tcgetattr(m_nFd, &tty) < 0)
+        return 0;
+    speed_t nSpeed = cfgetospeed(&tty);
+    for(auto it = m_mBaud.begin(); it != m_mBaud.end(); ++it)
+        if(it->second == nSpeed)
+            return it->first;
+    return 0;
+}
+
 bool Serial::SetWord(unsigned int nBits)
 {
     if(m_nFd < 0)
@@ -187,22 +289,34 @@ bool Serial::SetStopBits(unsigned int nBits)
 
 }
 
-int Serial::Read(unsigned char *pBuffer, unsigned int nSize)
+int Serial::Read(unsigned char *pBuffer, unsigned int nSize, int nTimeout)
 {
     if(m_nFd < 0 || nSize == 0)
         return 0;
-    return read(m_nFd, pBuffer, nSize);
+    if(Available() == 0)
+    {
+        int nResult = Fill(nTimeout);
+        if(nResult <= 0)
+            return nResult;
+    }
+    return RingGet(pBuffer, nSize);
 }
 
-int Serial::Read(vector<unsigned char>& vBuffer, unsigned int nSize)
+int Serial::Read(vector<unsigned char>& vBuffer, unsigned int nSize, int nTimeout)
 {
     if(!IsOpen())
-        return 0; //!@todo Should we return -1 if port closed?
-    unsigned char c;
-    if(nSize == 0)
-        while(read(m_nFd, &c, 1) == 1)
-            vBuffer.push_back(c);
-    return vBuffer.size();
+        return -1;
+    //Wait for first data then take everything that is ready
+    if(Available() == 0 && Fill(nTimeout) < 0)
+        return -1;
+    if(Fill(0) < 0)
+        return -1;
+    size_t nCount = Available();
+    if(nSize != 0 && nSize < nCount)
+        nCount = nSize;
+    size_t nStart = vBuffer.size();
+    vBuffer.resize(nStart + nCount);
+    return RingGet(vBuffer.data() + nStart, nCount);
 }
 
 int Serial::Read(string *pString)
@@ -215,16 +329,100 @@ bool Serial::Write(const char *pBuffer, unsigned int nSize)
 {
     if(m_nFd < 0 || nSize == 0)
         return 0;
-    return (write(m_nFd, pBuffer, nSize) > 0);
+    return Write(reinterpret_cast<const unsigned char*>(pBuffer), (size_t)nSize);
 }
 
 bool Serial::Write(vector<unsigned char>& vBuffer)
 {
-    for(vector<unsigned char>::iterator it = vBuffer.begin(); it != vBuffer.end(); ++it)
+    return Write(vBuffer.data(), vBuffer.size());
+}
+
+bool Serial::Write(const unsigned char* pBuffer, size_t nSize)
+{
+    if(m_pReplayRx)
+    {
+        ReplayWrite(pBuffer, nSize);
+        return true;
+    }
+    if(m_nFd < 0)
+        return false;
+    if(m_nTraceFd >= 0)
+        Trace(SERIAL_TRACE_TX, pBuffer, nSize);
+    while(nSize > 0)
+    {
+        ssize_t nWritten = write(m_nFd, pBuffer, nSize);
+        ++m_nWriteCalls;
+        if(nWritten < 0)
+        {
+            if(errno == EINTR || ((errno == EAGAIN || errno == EWOULDBLOCK) && WaitWritable()))
+                continue;
+            if(m_bVerbose) cerr << "Failed to write to serial port - " << strerror(errno) << endl;
+            return false;
+        }
+        //Partial write - carry on from where the driver stopped
+        m_nBytesWritten += nWritten;
+        pBuffer += nWritten;
+        nSize -= nWritten;
+    }
+    if(m_bDrain)
+        tcdrain(m_nFd);
+    return true;
+}
+
+bool Serial::Write(const unsigned char* pHeader, size_t nHeaderSize, const unsigned char* pPayload, size_t nPayloadSize)
+{
+    if(m_pReplayRx)
     {
-        unsigned char c = *it;
-        write(m_nFd, &c, 1);
+        ReplayWrite(pHeader, nHeaderSize);
+        ReplayWrite(pPayload, nPayloadSize);
+        return true;
+    }
+    if(m_nFd < 0)
+        return false;
+    if(m_nTraceFd >= 0)
+        Trace(SERIAL_TRACE_TX, pHeader, nHeaderSize, pPayload, nPayloadSize);
+    iovec aVector[2];
+    aVector[0].iov_base = const_cast<unsigned char*>(pHeader);
+    aVector[0].iov_len = nHeaderSize;
+    aVector[1].iov_base = const_cast<unsigned char*>(pPayload);
+    aVector[1].iov_len = nPayloadSize;
+    iovec* pVector = aVector;
+    int nVectors = 2;
+    while(nVectors > 0)
+    {
+        //Skip any part that has been completely written
+        if(pVector->iov_len == 0)
+        {
+            ++pVector;
+            --nVectors;
+            continue;
+        }
+        ssize_t nWritten = writev(m_nFd, pVector, nVectors);
+        ++m_nWriteCalls;
+        if(nWritten < 0)
+        {
+            if(errno == EINTR || ((errno == EAGAIN || errno == EWOULDBLOCK) && WaitWritable()))
+                continue;
+            if(m_bVerbose) cerr << "Failed to write to serial port - " << strerror(errno) << endl;
+            return false;
+        }
+        m_nBytesWritten += nWritten;
+        //Partial write - advance through the vectors by the quantity written
+        while(nWritten > 0)
+        {
+            size_t nPart = ((size_t)nWritten < pVector->iov_len) ? nWritten : pVector->iov_len;
+            pVector->iov_base = static_cast<unsigned char*>(pVector->iov_base) + nPart;
+            pVector->iov_len -= nPart;
+            nWritten -= nPart;
+            if(pVector->iov_len == 0 && nWritten > 0)
+            {
+                ++pVector;
+                --nVectors;
+            }
+        }
     }
+    if(m_bDrain)
+        tcdrain(m_nFd);
     return true;
 }
 
@@ -244,6 +442,8 @@ void Serial::SetRts(bool bValue)
         return;
     int nFlag = TIOCM_RTS;
     ioctl(m_nFd, bValue?TIOCMBIS:TIOCMBIC, &nFlag);
+    if(m_nTraceFd >= 0)
+        TraceModem();
 }
 
 void Serial::SetDtr(bool bValue)
@@ -252,6 +452,127 @@ void Serial::SetDtr(bool bValue)
         return;
     int nFlag = TIOCM_DTR;
     ioctl(m_nFd, bValue?TIOCMBIS:TIOCMBIC, &nFlag);
+    if(m_nTraceFd >= 0)
+        TraceModem();
+}
+
+bool Serial::SetModemLines(bool bDtr, bool bRts)
+{
+    if(m_nFd < 0)
+        return false;
+    int nLines;
+    if(ioctl(m_nFd, TIOCMGET, &nLines) < 0)
+    {
+        if(m_bVerbose) cerr << "Failed to get modem lines - " << strerror(errno) << endl;
+        return false;
+    }
+    nLines &= ~(TIOCM_DTR | TIOCM_RTS);
+    if(bDtr)
+        nLines |= TIOCM_DTR;
+    if(bRts)
+        nLines |= TIOCM_RTS;
+    if(ioctl(m_nFd, TIOCMSET, &nLines) < 0)
+    {
+        if(m_bVerbose) cerr << "Failed to set modem lines - " << strerror(errno) << endl;
+        return false;
+    }
+    if(m_nTraceFd >= 0)
+        TraceModem();
+    return true;
+}
+
+void Serial::SetLowLatency(bool bLowLatency)
+{
+    m_bLowLatency = bLowLatency;
+}
+
+void Serial::ApplyLowLatency()
+{
+#if defined(__linux__) && defined(ASYNC_LOW_LATENCY)
+    serial_struct serialInfo;
+    if(ioctl(m_nFd, TIOCGSERIAL, &serialInfo) == 0)
+    {
+        if(!(serialInfo.flags & ASYNC_LOW_LATENCY))
+        {
+            int nFlags = serialInfo.flags;
+            serialInfo.flags |= ASYNC_LOW_LATENCY;
+            if(ioctl(m_nFd, TIOCSSERIAL, &serialInfo) == 0)
+            {
+                m_nSerialFlags = nFlags;
+                if(m_bVerbose)
+                    cout << "Serial port " << m_sPort << " set ASYNC_LOW_LATENCY" << endl;
+            }
+            else if(m_bVerbose)
+                cerr << "Failed to set ASYNC_LOW_LATENCY - " << strerror(errno) << endl;
+        }
+    }
+    else if(m_bVerbose)
+        cerr << "Serial driver does not support TIOCGSERIAL - " << strerror(errno) << endl;
+#endif // __linux__
+
+    //FTDI adapters buffer received data for up to latency_timer ms before sending a USB packet
+    m_sLatencyTimer.clear();
+    char* pPath = realpath(m_sPort.c_str(), NULL); //Resolve /dev/serial/by-id/... links to the tty name
+    if(!pPath)
+        return;
+    m_sLatencyTimer = string("/sys/class/tty/") + basename(pPath) + "/device/latency_timer";
+    free(pPath);
+    ifstream fileTimer(m_sLatencyTimer);
+    int nTimer = -1;
+    if(!(fileTimer >> nTimer) || nTimer <= SERIAL_LATENCY_TIMER)
+        return; //Not an FTDI adapter or already low
+    fileTimer.close();
+    ofstream fileSet(m_sLatencyTimer);
+    if(fileSet << SERIAL_LATENCY_TIMER << endl)
+    {
+        m_nLatencyTimer = nTimer;
+        if(m_bVerbose)
+            cout << "Serial port " << m_sPort << " latency timer " << nTimer << "ms -> " << SERIAL_LATENCY_TIMER << "ms" << endl;
+    }
+    else if(m_bVerbose)
+        cerr << "Cannot write " << m_sLatencyTimer << " (latency timer remains " << nTimer << "ms) - check permissions" << endl;
+}
+
+void Serial::RestoreLatency()
+{
+#if defined(__linux__) && defined(ASYNC_LOW_LATENCY)
+    serial_struct serialInfo;
+    if(m_nSerialFlags >= 0 && ioctl(m_nFd, TIOCGSERIAL, &serialInfo) == 0)
+    {
+        serialInfo.flags = m_nSerialFlags;
+        ioctl(m_nFd, TIOCSSERIAL, &serialInfo);
+    }
+#endif // __linux__
+    m_nSerialFlags = -1;
+    if(m_nLatencyTimer >= 0)
+    {
+        ofstream fileSet(m_sLatencyTimer);
+        fileSet << m_nLatencyTimer << endl;
+    }
+    m_nLatencyTimer = -1;
+}
+
+long Serial::GetOverruns()
+{
+#if defined(__linux__) && defined(TIOCGICOUNT)
+    serial_icounter_struct counters;
+    if(m_nFd >= 0 && ioctl(m_nFd, TIOCGICOUNT, &counters) == 0)
+        return counters.overrun + counters.buf_overrun;
+#endif // __linux__
+    return -1;
+}
+
+void Serial::SetDrain(bool bDrain)
+{
+    m_bDrain = bDrain;
+}
+
+void Serial::ResetCounters()
+{
+    m_nWriteCalls = 0;
+    m_nBytesWritten = 0;
+    m_nReadCalls = 0;
+    m_nPollCalls = 0;
 }
 
 void Serial::SetVerbose(bool bVerbose)
@@ -261,13 +582,17 @@ void Serial::SetVerbose(bool bVerbose)
 
 bool Serial::IsOpen()
 {
-    return (m_nFd >= 0);
+    return (m_nFd >= 0 || m_pReplayRx);
 }
 
 void Serial::Flush(unsigned int nDirection)
 {
     if(!IsOpen())
         return;
+    if(nDirection & SERIAL_INPUT)
+        m_nRingTail = m_nRingHead; //Discard data already pulled into receive ring
+    if(m_pReplayRx)
+        return; //Recorded data that had not arrived when flushed is still replayed
     switch(nDirection)
     {
     case SERIAL_INPUT:
@@ -282,6 +607,241 @@ void Serial::Flush(unsigned int nDirection)
     }
 }
 
+int Serial::Peek(const unsigned char** ppData, int nTimeout)
+{
+    if(m_nFd < 0 && !m_pReplayRx)
+        return -1;
+    if(Available() == 0)
+    {
+        int nResult = Fill(nTimeout);
+        if(nResult <= 0)
+            return nResult;
+    }
+    size_t nTail = m_nRingTail & (SERIAL_RING_SIZE - 1);
+    *ppData = m_vRing.data() + nTail;
+    return min(Available(), SERIAL_RING_SIZE - nTail);
+}
+
+void Serial::Consume(size_t nSize)
+{
+    m_nRingTail += min(nSize, Available());
+}
+
+size_t Serial::Available()
+{
+    return m_nRingHead - m_nRingTail;
+}
+
+int Serial::Fill(int nTimeout)
+{
+    if(m_pReplayRx)
+        return ReplayFill();
+    if(m_nFd < 0)
+        return -1;
+    size_t nFree = SERIAL_RING_SIZE - Available();
+    if(nFree == 0)
+        return 0;
+    chrono::steady_clock::time_point tDeadline = chrono::steady_clock::now() + chrono::milliseconds(nTimeout);
+    pollfd fdPoll;
+    fdPoll.fd = m_nFd;
+    fdPoll.events = POLLIN;
+    while(true)
+    {
+        int nWait = nTimeout;
+        if(nTimeout > 0)
+        {
+            nWait = chrono::duration_cast<chrono::milliseconds>(tDeadline - chrono::steady_clock::now()).count();
+            if(nWait < 0)
+                nWait = 0;
+        }
+        ++m_nPollCalls;
+        int nResult = poll(&fdPoll, 1, nWait);
+        if(nResult < 0 && errno == EINTR)
+            continue;
+        if(nResult < 0 || (fdPoll.revents & (POLLERR | POLLNVAL)))
+        {
+            if(m_bVerbose) cerr << "Failed to wait for serial data - " << strerror(errno) << endl;
+            return -1;
+        }
+        if(nResult == 0)
+            return 0; //Deadline reached without data
+        break;
+    }
+    //Read into the free space of the ring which may wrap so use up to two vectors
+    size_t nHead = m_nRingHead & (SERIAL_RING_SIZE - 1);
+    iovec aVector[2];
+    aVector[0].iov_base = m_vRing.data() + nHead;
+    aVector[0].iov_len = min(nFree, SERIAL_RING_SIZE - nHead);
+    aVector[1].iov_base = m_vRing.data();
+    aVector[1].iov_len = nFree - aVector[0].iov_len;
+    ssize_t nRead;
+    ++m_nReadCalls;
+    do
+        nRead = readv(m_nFd, aVector, aVector[1].iov_len ? 2 : 1);
+    while(nRead < 0 && errno == EINTR);
+    if(nRead < 0)
+    {
+        if(errno == EAGAIN || errno == EWOULDBLOCK)
+            return 0;
+        if(m_bVerbose) cerr << "Failed to read from serial port - " << strerror(errno) << endl;
+        return -1;
+    }
+    if(nRead == 0 && (fdPoll.revents & POLLHUP))
+        return -1; //Device has gone away
+    if(m_nTraceFd >= 0 && nRead > 0)
+    {
+        size_t nFirst = min((size_t)nRead, aVector[0].iov_len);
+        Trace(SERIAL_TRACE_RX, m_vRing.data() + nHead, nFirst, m_vRing.data(), nRead - nFirst);
+    }
+    m_nRingHead += nRead;
+    return nRead;
+}
+
+int Serial::ReplayFill()
+{
+    //Deliver as much recorded data as the ring accepts. Timing is not reproduced so replay runs as fast as possible.
+    size_t nCount = min(SERIAL_RING_SIZE - Available(), m_nReplayRxSize - m_nReplayRxPos);
+    size_t nHead = m_nRingHead & (SERIAL_RING_SIZE - 1);
+    size_t nFirst = min(nCount, SERIAL_RING_SIZE - nHead);
+    const unsigned char* pData = m_pReplayRx + m_nReplayRxPos;
+    copy(pData, pData + nFirst, m_vRing.data() + nHead);
+    copy(pData + nFirst, pData + nCount, m_vRing.data());
+    m_nReplayRxPos += nCount;
+    m_nRingHead += nCount;
+    return nCount;
+}
+
+void Serial::ReplayWrite(const unsigned char* pData, size_t nSize)
+{
+    m_nBytesWritten += nSize;
+    if(!m_pReplayTx)
+        return;
+    size_t nCount = min(nSize, m_nReplayTxSize - m_nReplayTxPos);
+    const unsigned char* pExpected = m_pReplayTx + m_nReplayTxPos;
+    for(size_t nPos = 0; nPos < nCount; ++nPos)
+        if(pData[nPos] != pExpected[nPos])
+            ++m_nReplayMismatches;
+    m_nReplayMismatches += nSize - nCount;
+    m_nReplayTxPos += nCount;
+}
+
+void Serial::SetReplay(const unsigned char* pRx, size_t nRxSize, const unsigned char* pTx, size_t nTxSize)
+{
+    m_pReplayRx = pRx;
+    m_nReplayRxSize = pRx ? nRxSize : 0;
+    m_nReplayRxPos = 0;
+    m_pReplayTx = pTx;
+    m_nReplayTxSize = pTx ? nTxSize : 0;
+    m_nReplayTxPos = 0;
+    m_nReplayMismatches = 0;
+    m_nRingHead = m_nRingTail = 0;
+}
+
+bool Serial::SetTrace(string sFilename)
+{
+    if(m_nTraceFd >= 0)
+    {
+        TraceFlush();
+        close(m_nTraceFd);
+        m_nTraceFd = -1;
+        vector<unsigned char>().swap(m_vTrace);
+    }
+    if(sFilename.empty())
+        return true;
+    m_nTraceFd = open(sFilename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(m_nTraceFd < 0)
+    {
+        if(m_bVerbose) cerr << "Failed to create trace file " << sFilename << " - " << strerror(errno) << endl;
+        return false;
+    }
+    m_vTrace.reserve(SERIAL_TRACE_BUFFER + SERIAL_TRACE_HEADER);
+    m_vTrace.assign(SERIAL_TRACE_MAGIC, SERIAL_TRACE_MAGIC + sizeof(SERIAL_TRACE_MAGIC));
+    m_tTrace = chrono::steady_clock::now();
+    if(m_nFd >= 0)
+    {
+        //Record initial state so the trace is self-contained
+        unsigned char aBaud[4] = {(unsigned char)m_nBaud, (unsigned char)(m_nBaud >> 8), (unsigned char)(m_nBaud >> 16), (unsigned char)(m_nBaud >> 24)};
+        Trace(SERIAL_TRACE_BAUD, aBaud, sizeof(aBaud));
+    }
+    return true;
+}
+
+void Serial::Trace(unsigned char nType, const unsigned char* pData, size_t nSize, const unsigned char* pData2, size_t nSize2)
+{
+    chrono::steady_clock::time_point tNow = chrono::steady_clock::now();
+    uint64_t nDelta = chrono::duration_cast<chrono::microseconds>(tNow - m_tTrace).count();
+    m_tTrace = tNow;
+    if(nDelta > 0xFFFFFFFF)
+        nDelta = 0xFFFFFFFF; //Idle for over an hour
+    size_t nLength = nSize + nSize2;
+    unsigned char aHeader[SERIAL_TRACE_HEADER] = {nType,
+        (unsigned char)nDelta, (unsigned char)(nDelta >> 8), (unsigned char)(nDelta >> 16), (unsigned char)(nDelta >> 24),
+        (unsigned char)nLength, (unsigned char)(nLength >> 8), (unsigned char)(nLength >> 16), (unsigned char)(nLength >> 24)};
+    m_vTrace.insert(m_vTrace.end(), aHeader, aHeader + SERIAL_TRACE_HEADER);
+    m_vTrace.insert(m_vTrace.end(), pData, pData + nSize);
+    if(nSize2)
+        m_vTrace.insert(m_vTrace.end(), pData2, pData2 + nSize2);
+    if(m_vTrace.size() >= SERIAL_TRACE_BUFFER)
+        TraceFlush();
+}
+
+void Serial::TraceModem()
+{
+    int nLines;
+    if(ioctl(m_nFd, TIOCMGET, &nLines) < 0)
+        return;
+    unsigned char nState = ((nLines & TIOCM_DTR) ? 1 : 0) | ((nLines & TIOCM_RTS) ? 2 : 0);
+    Trace(SERIAL_TRACE_MODEM, &nState, 1);
+}
+
+bool Serial::TraceFlush()
+{
+    if(m_nTraceFd < 0)
+        return true;
+    const unsigned char* pData = m_vTrace.data();
+    size_t nSize = m_vTrace.size();
+    while(nSize > 0)
+    {
+        ssize_t nWritten = write(m_nTraceFd, pData, nSize);
+        if(nWritten < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            if(m_bVerbose) cerr << "Failed to write trace file - " << strerror(errno) << endl;
+            m_vTrace.clear();
+            return false;
+        }
+        pData += nWritten;
+        nSize -= nWritten;
+    }
+    m_vTrace.clear();
+    return true;
+}
+
+size_t Serial::RingGet(unsigned char* pBuffer, size_t nSize)
+{
+    size_t nCount = min(nSize, Available());
+    size_t nTail = m_nRingTail & (SERIAL_RING_SIZE - 1);
+    size_t nFirst = min(nCount, SERIAL_RING_SIZE - nTail);
+    copy(m_vRing.data() + nTail, m_vRing.data() + nTail + nFirst, pBuffer);
+    copy(m_vRing.data(), m_vRing.data() + nCount - nFirst, pBuffer + nFirst);
+    m_nRingTail += nCount;
+    return nCount;
+}
+
+bool Serial::WaitWritable()
+{
+    pollfd fdPoll;
+    fdPoll.fd = m_nFd;
+    fdPoll.events = POLLOUT;
+    int nResult;
+    ++m_nPollCalls;
+    do
+        nResult = poll(&fdPoll, 1, -1);
+    while(nResult < 0 && errno == EINTR);
+    return (nResult > 0 && !(fdPoll.revents & (POLLERR | POLLHUP | POLLNVAL)));
+}
+
 bool Serial::GetAttributes()
 {
     if(m_nFd < 0 || tcgetattr(m_nFd, &m_tty) < 0)
@@ -299,6 +859,11 @@ bool Serial::SetAttributes()
         if(m_bVerbose) cerr << "Failed to set port attributes - " << strerror(errno) << endl;
         return false;
     }
+    if(m_bCustomBaud && !SerialSetCustomBaud(m_nFd, m_nBaud))
+    {
+        if(m_bVerbose) cerr << "Failed to set baud " << m_nBaud << " - " << strerror(errno) << endl;
+        return false;
+    }
     return true;
 }
 
@@ -367,7 +932,7 @@ void Serial::PopulateBaud()
     #ifdef B460800
     m_mBaud[460800] = B460800;
     #endif // 460800
-    #ifdef B9600
+    #ifdef B500000
     m_mBaud[500000] = B500000;
     #endif // 500000
     #ifdef B576000
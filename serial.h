@@ -9,9 +9,28 @@
 #include <map> //provides std::map
 #include <sys/termios.h> //provides terminal constants
 #include <vector>
+#include <chrono> //provides steady clock for trace timestamps
+#include <cstddef> //provides size_t
 
 const static unsigned int SERIAL_INPUT = 1;
 const static unsigned int SERIAL_OUTPUT = 2;
+const static size_t SERIAL_RING_SIZE = 0x10000; //Size of receive ring buffer (must be power of 2)
+const static int SERIAL_WAIT_FOREVER = -1; //Read timeout to block until data arrives
+
+/*  Trace file format
+    File starts with SERIAL_TRACE_MAGIC (8 bytes) followed by records, each with a 9 byte header:
+        byte    record type (SERIAL_TRACE_RX|TX|BAUD|MODEM)
+        uint32  microseconds since previous record (little-endian, monotonic clock)
+        uint32  quantity of data bytes that follow (little-endian)
+    RX / TX records hold the bytes read / written. BAUD holds the uint32 baud. MODEM holds one byte: bit 0 DTR, bit 1 RTS.
+*/
+const static char SERIAL_TRACE_MAGIC[8] = {'E', 'S', 'P', 'T', 'R', 'C', '0', '1'};
+const static size_t SERIAL_TRACE_HEADER = 9; //Size of trace record header
+const static size_t SERIAL_TRACE_BUFFER = 0x10000; //Trace data buffered before writing to file
+const static unsigned char SERIAL_TRACE_RX = 0; //Data read from port
+const static unsigned char SERIAL_TRACE_TX = 1; //Data written to port
+const static unsigned char SERIAL_TRACE_BAUD = 2; //Baud changed
+const static unsigned char SERIAL_TRACE_MODEM = 3; //Modem control lines changed
 
 using namespace std;
 
@@ -46,9 +65,29 @@ class Serial
         /** @brief  Set the baud
         *   @param  nBaud Baud rate
         *   @retval bool True on success
+        *   @note   May be called before port is opened
+        *   @note   Rates without a Bxxx constant are configured with termios2 / BOTHER where the platform supports it
         */
         bool SetBaud(speed_t nBaud);
 
+        /** @brief  Check whether a baud can be configured
+        *   @param  nBaud Baud rate
+        *   @retval bool True if baud is supported
+        *   @note   Any non-zero rate is accepted where arbitrary rates are available. The adapter may still not achieve it.
+        */
+        bool IsBaudSupported(unsigned int nBaud);
+
+        /** @brief  Get the baud
+        *   @retval unsigned int Requested baud rate
+        */
+        unsigned int GetBaud() {return m_nBaud;};
+
+        /** @brief  Get the baud actually configured by the driver
+        *   @retval unsigned int Baud rate read back from port or requested rate if it cannot be read
+        *   @note   Use for throughput calculations. Driver may round the rate to the nearest achievable divisor.
+        */
+        unsigned int GetActualBaud() {return m_nActualBaud ? m_nActualBaud : m_nBaud;};
+
         /** @brief  Set the word length
         *   @param  nBits Quantity of bits in each word
         *   @retval bool True on success
@@ -70,17 +109,20 @@ class Serial
         /** @brief  Read data from the serial port
         *   @param  pBuffer Pointer to a buffer to populate with data
         *   @param  nSize Maximum quantity of characters / bytes to read from port (Default: 1)
-        *   @retval int Quantity of characters / bytes actually read from port
+        *   @param  nTimeout Maximum time to wait for data in milliseconds (Default: SERIAL_WAIT_FOREVER)
+        *   @retval int Quantity of characters / bytes actually read from port, zero on timeout or -1 on error
         *   @note   Can use Read(&myChar) to read a single char
+        *   @note   Returns whatever is ready as soon as any data is available
         */
-        int Read(unsigned char *pBuffer, unsigned int nSize = 1);
+        int Read(unsigned char *pBuffer, unsigned int nSize = 1, int nTimeout = SERIAL_WAIT_FOREVER);
 
-        /** @brief  REad data from serial port
+        /** @brief  Read data from serial port, appending to a vector
         *   @param  vBuffer Vector to hold data
-        *   @param nSize Maximum quantity of characters / bytes to read from port. Zero to read all available data (Default: 0)
-        *   @retval int Quantity of characters / bytes read
+        *   @param  nSize Maximum quantity of characters / bytes to read from port. Zero to read all available data (Default: 0)
+        *   @param  nTimeout Maximum time to wait for data in milliseconds (Default: 0 - do not wait)
+        *   @retval int Quantity of characters / bytes appended to vector or -1 on error
         */
-        int Read(vector<unsigned char>& vBuffer, unsigned int nSize = 0);
+        int Read(vector<unsigned char>& vBuffer, unsigned int nSize = 0, int nTimeout = 0);
 
         /** @brief  Read string from serial port
         *   @param  pString Pointer to a string to populate
@@ -102,6 +144,24 @@ class Serial
         */
         bool Write(vector<unsigned char>& vBuffer);
 
+        /** @brief  Write a whole block of data to the serial port
+        *   @param  pBuffer Pointer to data to write
+        *   @param  nSize Quantity of bytes to write
+        *   @retval bool True if all data was written
+        *   @note   Issues as few write() calls as the driver allows, resuming after partial writes
+        */
+        bool Write(const unsigned char* pBuffer, size_t nSize);
+
+        /** @brief  Write a header and payload to the serial port without concatenating them
+        *   @param  pHeader Pointer to header data
+        *   @param  nHeaderSize Quantity of bytes in header
+        *   @param  pPayload Pointer to payload data
+        *   @param  nPayloadSize Quantity of bytes in payload
+        *   @retval bool True if all data was written
+        *   @note   Uses writev() so both parts normally leave in a single system call
+        */
+        bool Write(const unsigned char* pHeader, size_t nHeaderSize, const unsigned char* pPayload, size_t nPayloadSize);
+
         /** @brief  Write a string to the serial port
         *   @param  sData
         *   @retval bool True on success
@@ -124,6 +184,73 @@ class Serial
         */
         void SetDtr(bool bValue);
 
+        /** @brief  Set DTR and RTS lines together
+        *   @param  bDtr Set true to assert DTR
+        *   @param  bRts Set true to assert RTS
+        *   @retval bool True on success
+        *   @note   Both lines change in a single TIOCMSET so there is no intermediate state
+        */
+        bool SetModemLines(bool bDtr, bool bRts);
+
+        /** @brief  Set low latency mode
+        *   @param  bLowLatency True to minimise request / response latency (Default: true)
+        *   @note   Off by default. Applied when port is opened and undone when port is closed - a process killed with the port open leaves the driver tuned.
+        *   @note   Sets ASYNC_LOW_LATENCY on the driver, reduces the FTDI latency_timer to 1ms (if sysfs attribute is writable) and makes reads return without waiting for further bytes
+        */
+        void SetLowLatency(bool bLowLatency = true);
+
+        /** @brief  Set drain mode
+        *   @param  bDrain True to wait for each write to be transmitted before returning (Default: false)
+        *   @note   Replaces opening the port with O_SYNC. Only required when timing depends on data having left the UART.
+        */
+        void SetDrain(bool bDrain = true);
+
+        /** @brief  Get quantity of write system calls since port opened or counters reset
+        *   @retval unsigned long Quantity of write() / writev() calls
+        */
+        unsigned long GetWriteCalls() {return m_nWriteCalls;};
+
+        /** @brief  Get quantity of bytes written since port opened or counters reset
+        *   @retval unsigned long Quantity of bytes written
+        */
+        unsigned long GetBytesWritten() {return m_nBytesWritten;};
+
+        /** @brief  Get quantity of read system calls since port opened or counters reset
+        *   @retval unsigned long Quantity of readv() calls
+        */
+        unsigned long GetReadCalls() {return m_nReadCalls;};
+
+        /** @brief  Get quantity of poll system calls since port opened or counters reset
+        *   @retval unsigned long Quantity of poll() calls
+        */
+        unsigned long GetPollCalls() {return m_nPollCalls;};
+
+        /** @brief  Reset system call counters
+        */
+        void ResetCounters();
+
+        /** @brief  Record all data read and written with timestamps to a binary trace file
+        *   @param  sFilename Name of trace file or empty string to stop tracing
+        *   @retval bool True on success
+        *   @note   See SERIAL_TRACE_MAGIC for file format. Data is buffered and written when the buffer fills, tracing stops or the port closes.
+        */
+        bool SetTrace(string sFilename);
+
+        /** @brief  Replay recorded data instead of using a port
+        *   @param  pRx Pointer to data to return from reads (must remain valid during replay)
+        *   @param  nRxSize Quantity of bytes to read
+        *   @param  pTx Pointer to data expected to be written or NULL to accept any data
+        *   @param  nTxSize Quantity of bytes expected to be written
+        *   @note   Reads return recorded data immediately and time out at once when it is exhausted. Writes are discarded after comparison with pTx.
+        *   @note   Port must not be open. Call with pRx NULL to end replay.
+        */
+        void SetReplay(const unsigned char* pRx, size_t nRxSize, const unsigned char* pTx = NULL, size_t nTxSize = 0);
+
+        /** @brief  Get quantity of bytes written during replay that differ from the recorded data
+        *   @retval unsigned long Quantity of mismatched bytes, including bytes beyond the end of the recording
+        */
+        unsigned long GetReplayMismatches() {return m_nReplayMismatches;};
+
         /** @brief  Set verbosity of output
         *   @param  bVerbose True to output info. False for silent operation
         */
@@ -134,6 +261,35 @@ class Serial
         */
         bool IsOpen();
 
+        /** @brief  Get the file descriptor of the open port
+        *   @retval int File descriptor or -1 if closed
+        *   @note   Allows waiting on the port alongside other descriptors, e.g. with poll(). Read data with Peek() / Read() so the receive buffer stays consistent.
+        */
+        int GetFd() {return m_nFd;};
+
+        /** @brief  Get quantity of characters lost by the driver or UART
+        *   @retval long Total of hardware FIFO and driver buffer overruns since boot or -1 if not supported, e.g. pseudo terminal
+        */
+        long GetOverruns();
+
+        /** @brief  Get direct access to received data without copying
+        *   @param  ppData Pointer to a pointer which is set to the first unread byte
+        *   @param  nTimeout Maximum time to wait for data in milliseconds (Default: 0 - do not wait)
+        *   @retval int Quantity of contiguous bytes available at *ppData, zero on timeout or -1 on error
+        *   @note   Data remains in receive buffer until released with Consume()
+        */
+        int Peek(const unsigned char** ppData, int nTimeout = 0);
+
+        /** @brief  Release data from receive buffer after Peek()
+        *   @param  nSize Quantity of bytes to release
+        */
+        void Consume(size_t nSize);
+
+        /** @brief  Get quantity of received data waiting in receive buffer
+        *   @retval size_t Quantity of bytes that may be read without waiting
+        */
+        size_t Available();
+
         /** @brief  Empty the recieve buffer
         *   @param  nDirection Which buffer to flush (default: SERIAL_INPUT | SERIAL_OUTPUT)
         */
@@ -145,13 +301,49 @@ class Serial
         bool GetAttributes(); // Populate m_tty with port attibutes. Returns true on succes
         bool SetAttributes(); // Sets port attibutes from m_tty. Returns true on succes
         void PopulateBaud(); // Populates map of valid baud rates
+        bool ApplyBaud(); // Configures m_nBaud on open port, using BOTHER if no Bxxx value exists. Returns true on success
+        unsigned int ReadBaud(); // Reads configured baud back from port. Returns zero if unknown
+        void ApplyLowLatency(); // Configures driver for low latency, recording previous settings
+        void RestoreLatency(); // Restores driver latency settings changed by ApplyLowLatency
+        bool WaitWritable(); // Blocks until port can accept more data. Returns false on error
+        int Fill(int nTimeout); // Fills receive ring from port, waiting up to nTimeout ms for data. Returns quantity of bytes added or -1 on error
+        size_t RingGet(unsigned char* pBuffer, size_t nSize); // Moves up to nSize bytes from receive ring to pBuffer. Returns quantity moved
+        int ReplayFill(); // Fills receive ring from replay data. Returns quantity of bytes added
+        void ReplayWrite(const unsigned char* pData, size_t nSize); // Compares written data with replay data
+        void Trace(unsigned char nType, const unsigned char* pData, size_t nSize, const unsigned char* pData2 = NULL, size_t nSize2 = 0); // Adds record to trace
+        void TraceModem(); // Adds current modem lines to trace
+        bool TraceFlush(); // Writes buffered trace records to file. Returns false on error
         bool m_bVerbose; //True for verbose output
+        bool m_bLowLatency; //True to configure port for low latency
+        int m_nSerialFlags; //Driver serial flags before ASYNC_LOW_LATENCY was set or -1 if unchanged
+        int m_nLatencyTimer; //FTDI latency timer (ms) before it was reduced or -1 if unchanged
+        string m_sLatencyTimer; //Path to FTDI latency_timer sysfs attribute
+        bool m_bDrain; //True to wait for output to be transmitted after each write
+        unsigned long m_nWriteCalls; //Quantity of write system calls
+        unsigned long m_nBytesWritten; //Quantity of bytes written
+        unsigned long m_nReadCalls; //Quantity of read system calls
+        unsigned long m_nPollCalls; //Quantity of poll system calls
         int m_nFd; //File descriptor for serial port
         speed_t m_nBaud; //Baud rate
+        unsigned int m_nActualBaud; //Baud rate read back from port (zero if unknown)
+        bool m_bCustomBaud; //True if m_nBaud is configured with BOTHER rather than a Bxxx value
         unsigned int m_nWordLength; //Word length
         string m_sPort; //Name of serial port
         string m_sParity; //Parity
         unsigned int m_nStopBits; //Quantity of stop bits
         termios m_tty; //Port attributes
         map<unsigned int,speed_t> m_mBaud; //Map of real baud to tty baud value
+        vector<unsigned char> m_vRing; //Receive ring buffer
+        size_t m_nRingHead; //Ring write position (free running, masked on access)
+        size_t m_nRingTail; //Ring read position (free running, masked on access)
+        int m_nTraceFd; //File descriptor of trace file or -1 if not tracing
+        vector<unsigned char> m_vTrace; //Trace records awaiting write to file
+        chrono::steady_clock::time_point m_tTrace; //Time of last trace record
+        const unsigned char* m_pReplayRx; //Replay data to read or NULL if not replaying
+        size_t m_nReplayRxSize; //Quantity of bytes of replay data to read
+        size_t m_nReplayRxPos; //Position of next replay byte to read
+        const unsigned char* m_pReplayTx; //Replay data expected to be written or NULL to accept any
+        size_t m_nReplayTxSize; //Quantity of bytes expected to be written
+        size_t m_nReplayTxPos; //Position of next byte expected to be written
+        unsigned long m_nReplayMismatches; //Quantity of written bytes that differ from expected replay data
 };
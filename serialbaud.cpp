@@ -0,0 +1,54 @@
+#include "serialbaud.h"
+#if defined(__linux__)
+#include <asm/termbits.h> //provides termios2 and BOTHER - must not be mixed with <termios.h>
+#include <sys/ioctl.h> //provides ioctl()
+#endif // __linux__
+
+#if defined(__linux__) && defined(TCGETS2) && defined(BOTHER)
+
+bool SerialCustomBaudAvailable()
+{
+    return true;
+}
+
+bool SerialSetCustomBaud(int nFd, unsigned int nBaud)
+{
+    struct termios2 tty;
+    if(nFd < 0 || nBaud == 0 || ioctl(nFd, TCGETS2, &tty) < 0)
+        return false;
+    tty.c_cflag &= ~CBAUD;
+    tty.c_cflag |= BOTHER;
+    tty.c_ospeed = nBaud;
+#ifdef IBSHIFT
+    tty.c_cflag &= ~(CBAUD << IBSHIFT); //Input rate follows output rate
+#endif // IBSHIFT
+    tty.c_ispeed = nBaud;
+    return ioctl(nFd, TCSETS2, &tty) == 0;
+}
+
+unsigned int SerialGetActualBaud(int nFd)
+{
+    struct termios2 tty;
+    if(nFd < 0 || ioctl(nFd, TCGETS2, &tty) < 0)
+        return 0;
+    return tty.c_ospeed;
+}
+
+#else
+
+bool SerialCustomBaudAvailable()
+{
+    return false;
+}
+
+bool SerialSetCustomBaud(int nFd, unsigned int nBaud)
+{
+    return false;
+}
+
+unsigned int SerialGetActualBaud(int nFd)
+{
+    return 0;
+}
+
+#endif // __linux__
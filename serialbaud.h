@@ -0,0 +1,27 @@
+/** Arbitrary baud rate support for serial ports
+*   Author: agent
+*   Date: 2026-10-17
+*   License: LGPL
+*/
+
+#pragma once
+
+/** @brief  Check whether arbitrary baud rates are supported on this platform
+*   @retval bool True if SerialSetCustomBaud may be used
+*/
+bool SerialCustomBaudAvailable();
+
+/** @brief  Configure an arbitrary baud rate on an open serial port
+*   @param  nFd File descriptor of serial port
+*   @param  nBaud Baud rate
+*   @retval bool True on success
+*   @note   Other port attributes are left unchanged. Must be reapplied after any tcsetattr() which resets the rate.
+*/
+bool SerialSetCustomBaud(int nFd, unsigned int nBaud);
+
+/** @brief  Read back the output baud rate configured by the driver
+*   @param  nFd File descriptor of serial port
+*   @retval unsigned int Baud rate or zero if it cannot be read
+*   @note   Driver may round the requested rate to the nearest achievable divisor
+*/
+unsigned int SerialGetActualBaud(int nFd);
@@ -0,0 +1,230 @@
+#include "slip.h"
+#include <string.h> //provides memchr, memcpy
+#include <stdint.h> //provides fixed width integers
+#if defined(__SSE2__)
+#include <emmintrin.h> //provides SSE2 intrinsics
+#endif // __SSE2__
+
+const static size_t SLIP_DENSE_RUN = 16; //A run of plain bytes shorter than this switches to a byte loop for the rest of the frame or chunk because scanning costs more than it saves
+
+#if !defined(__SSE2__)
+/*  Test whether any byte within a word matches a value
+    See "Determine if a word has a byte equal to n" from Bit Twiddling Hacks
+*/
+static inline bool HasByte(uint64_t nWord, unsigned char cValue)
+{
+    uint64_t nTest = nWord ^ (0x0101010101010101ULL * cValue);
+    return ((nTest - 0x0101010101010101ULL) & ~nTest & 0x8080808080808080ULL) != 0;
+}
+#endif // __SSE2__
+
+const unsigned char* SlipScan(const unsigned char* pData, const unsigned char* pEnd)
+{
+#if defined(__SSE2__)
+    const __m128i vEnd = _mm_set1_epi8((char)SLIP_END);
+    const __m128i vEsc = _mm_set1_epi8((char)SLIP_ESC);
+    while(pEnd - pData >= 16)
+    {
+        __m128i vData = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pData));
+        int nMask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(vData, vEnd), _mm_cmpeq_epi8(vData, vEsc)));
+        if(nMask)
+            return pData + __builtin_ctz(nMask);
+        pData += 16;
+    }
+#else
+    while(pEnd - pData >= 8)
+    {
+        uint64_t nWord;
+        memcpy(&nWord, pData, 8);
+        if(HasByte(nWord, SLIP_END) || HasByte(nWord, SLIP_ESC))
+            break; //Find exact position below
+        pData += 8;
+    }
+#endif // __SSE2__
+    while(pData < pEnd && *pData != SLIP_END && *pData != SLIP_ESC)
+        ++pData;
+    return pData;
+}
+
+size_t SlipEncode(const unsigned char* pData, size_t nSize, unsigned char* pOutput)
+{
+    const unsigned char* pEnd = pData + nSize;
+    unsigned char* pOut = pOutput;
+    while(pData < pEnd)
+    {
+        //Copy run of bytes that do not need escaping
+        const unsigned char* pSpecial = SlipScan(pData, pEnd);
+        size_t nRun = pSpecial - pData;
+        memcpy(pOut, pData, nRun);
+        pOut += nRun;
+        pData = pSpecial;
+        if(pData == pEnd)
+            break;
+        *pOut++ = SLIP_ESC;
+        *pOut++ = (*pData++ == SLIP_END) ? SLIP_ESC_END : SLIP_ESC_ESC;
+        if(nRun < SLIP_DENSE_RUN)
+            break; //Specials are close together so encode the rest byte by byte
+    }
+    for(; pData < pEnd; ++pData)
+    {
+        unsigned char cData = *pData;
+        if(cData == SLIP_END)
+        {
+            *pOut++ = SLIP_ESC;
+            *pOut++ = SLIP_ESC_END;
+        }
+        else if(cData == SLIP_ESC)
+        {
+            *pOut++ = SLIP_ESC;
+            *pOut++ = SLIP_ESC_ESC;
+        }
+        else
+            *pOut++ = cData;
+    }
+    return pOut - pOutput;
+}
+
+SlipDecoder::SlipDecoder() :
+    m_pBuffer(NULL),
+    m_nCapacity(0),
+    m_nSize(0),
+    m_nState(SLIP_STATE_IDLE),
+    m_nDiscarded(0),
+    m_nErrors(0),
+    m_nEscapes(0)
+{
+}
+
+void SlipDecoder::SetBuffer(unsigned char* pBuffer, size_t nSize)
+{
+    m_pBuffer = pBuffer;
+    m_nCapacity = nSize;
+    Restart();
+}
+
+void SlipDecoder::Restart()
+{
+    m_nSize = 0;
+    m_nState = SLIP_STATE_IDLE;
+}
+
+void SlipDecoder::Drop()
+{
+    ++m_nErrors;
+    m_nSize = 0;
+    m_nState = SLIP_STATE_DROP;
+}
+
+size_t SlipDecoder::Decode(const unsigned char* pData, size_t nSize)
+{
+    const unsigned char* pPos = pData;
+    const unsigned char* pEnd = pData + nSize;
+    while(pPos < pEnd && m_nState != SLIP_STATE_COMPLETE)
+    {
+        switch(m_nState)
+        {
+            case SLIP_STATE_IDLE:
+            case SLIP_STATE_DROP:
+            {
+                //Skip to the next delimiter which starts a new frame
+                const unsigned char* pDelimiter = static_cast<const unsigned char*>(memchr(pPos, SLIP_END, pEnd - pPos));
+                if(!pDelimiter)
+                    pDelimiter = pEnd;
+                m_nDiscarded += pDelimiter - pPos;
+                pPos = pDelimiter;
+                if(pPos < pEnd)
+                {
+                    ++pPos;
+                    m_nSize = 0;
+                    m_nState = SLIP_STATE_FRAME;
+                }
+                break;
+            }
+            case SLIP_STATE_FRAME:
+            {
+                const unsigned char* pSpecial = SlipScan(pPos, pEnd);
+                size_t nRun = pSpecial - pPos;
+                if(m_nSize + nRun > m_nCapacity)
+                {
+                    Drop(); //Frame too large for buffer
+                    pPos = pSpecial;
+                    break;
+                }
+                memcpy(m_pBuffer + m_nSize, pPos, nRun);
+                m_nSize += nRun;
+                pPos = pSpecial;
+                if(pPos == pEnd)
+                    break;
+                if(*pPos == SLIP_ESC && nRun < SLIP_DENSE_RUN && m_nSize < m_nCapacity)
+                    pPos = DecodeDense(pPos, pEnd);
+                else if(*pPos++ == SLIP_ESC)
+                    m_nState = SLIP_STATE_ESCAPE;
+                else if(m_nSize)
+                    m_nState = SLIP_STATE_COMPLETE;
+                //else consecutive delimiters so treat second as start of frame
+                break;
+            }
+            case SLIP_STATE_ESCAPE:
+            {
+                unsigned char cData = *pPos++;
+                if(cData == SLIP_ESC_END)
+                    cData = SLIP_END;
+                else if(cData == SLIP_ESC_ESC)
+                    cData = SLIP_ESC;
+                else
+                {
+                    Drop(); //Invalid escape sequence
+                    if(cData == SLIP_END)
+                        m_nState = SLIP_STATE_FRAME;
+                    break;
+                }
+                if(m_nSize >= m_nCapacity)
+                {
+                    Drop();
+                    break;
+                }
+                m_pBuffer[m_nSize++] = cData;
+                ++m_nEscapes;
+                m_nState = SLIP_STATE_FRAME;
+                break;
+            }
+            case SLIP_STATE_COMPLETE:
+                break;
+        }
+    }
+    return pPos - pData;
+}
+
+const unsigned char* SlipDecoder::DecodeDense(const unsigned char* pPos, const unsigned char* pEnd)
+{
+    //Each byte decodes to at most one byte so limit input to remaining capacity, leaving overflow to frame and escape states
+    if((size_t)(pEnd - pPos) > m_nCapacity - m_nSize)
+        pEnd = pPos + (m_nCapacity - m_nSize);
+    //Local copies stay in registers whereas members would be reloaded after every store to the buffer
+    unsigned char* pOut = m_pBuffer + m_nSize;
+    unsigned long nEscapes = 0;
+    for(; pPos < pEnd; ++pPos)
+    {
+        unsigned char cData = *pPos;
+        if(cData == SLIP_ESC)
+        {
+            //Decode escape sequence in one step
+            if(pEnd - pPos < 2 || (pPos[1] != SLIP_ESC_END && pPos[1] != SLIP_ESC_ESC))
+            {
+                //Leave incomplete or invalid escape sequence to escape state
+                ++pPos;
+                m_nState = SLIP_STATE_ESCAPE;
+                break;
+            }
+            *pOut++ = (*++pPos == SLIP_ESC_END) ? SLIP_END : SLIP_ESC;
+            ++nEscapes;
+        }
+        else if(cData == SLIP_END)
+            break; //Leave delimiter to frame state
+        else
+            *pOut++ = cData;
+    }
+    m_nSize = pOut - m_pBuffer;
+    m_nEscapes += nEscapes;
+    return pPos;
+}
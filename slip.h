@@ -0,0 +1,103 @@
+/** SLIP (RFC 1055) encoder and decoder
+*   Author: agent
+*   Date: 2026-10-17
+*   License: LGPL
+*/
+
+#pragma once
+#include <cstddef> //provides size_t
+
+const static unsigned char SLIP_END     = 0xc0; //Frame delimiter
+const static unsigned char SLIP_ESC     = 0xdb; //Start of escape sequence
+const static unsigned char SLIP_ESC_END = 0xdc; //Escaped frame delimiter
+const static unsigned char SLIP_ESC_ESC = 0xdd; //Escaped escape
+
+/** @brief  Find the next SLIP special byte (SLIP_END or SLIP_ESC)
+*   @param  pData Pointer to first byte to check
+*   @param  pEnd Pointer to byte after last byte to check
+*   @retval const unsigned char* Pointer to first special byte or pEnd if none found
+*   @note   Checks 16 bytes per step with SSE2 where available, otherwise a word at a time
+*/
+const unsigned char* SlipScan(const unsigned char* pData, const unsigned char* pEnd);
+
+/** @brief  SLIP escape a block of data
+*   @param  pData Pointer to data to encode
+*   @param  nSize Quantity of bytes to encode
+*   @param  pOutput Pointer to buffer to hold encoded data - must hold at least 2 x nSize bytes
+*   @retval size_t Quantity of bytes written to pOutput
+*   @note   Does not add frame delimiters
+*   @note   Copies runs found by SlipScan until special bytes are close together, then uses a byte loop for the rest of the data
+*/
+size_t SlipEncode(const unsigned char* pData, size_t nSize, unsigned char* pOutput);
+
+/** Incremental SLIP decoder
+*   Accepts data in chunks of any size and decodes frames into a caller provided buffer without allocating
+*/
+class SlipDecoder
+{
+    public:
+        SlipDecoder();
+
+        /** @brief  Set the buffer to receive the next decoded frame and restart decoding
+        *   @param  pBuffer Pointer to buffer
+        *   @param  nSize Size of buffer
+        *   @note   Frames larger than the buffer are discarded and counted as errors
+        */
+        void SetBuffer(unsigned char* pBuffer, size_t nSize);
+
+        /** @brief  Decode a chunk of received data
+        *   @param  pData Pointer to received data
+        *   @param  nSize Quantity of bytes in pData
+        *   @retval size_t Quantity of bytes consumed
+        *   @note   Stops after the end of a complete frame. Check IsComplete() then call SetBuffer() or Restart() before passing remaining data.
+        */
+        size_t Decode(const unsigned char* pData, size_t nSize);
+
+        /** @brief  Restart decoding into the current buffer, waiting for the start of a new frame
+        */
+        void Restart();
+
+        /** @brief  Check whether a complete frame has been decoded
+        *   @retval bool True if buffer holds a complete frame
+        */
+        bool IsComplete() {return m_nState == SLIP_STATE_COMPLETE;};
+
+        /** @brief  Get the quantity of bytes decoded into the buffer
+        *   @retval size_t Size of decoded data
+        */
+        size_t GetSize() {return m_nSize;};
+
+        /** @brief  Get quantity of bytes discarded outside of frames
+        *   @retval unsigned long Quantity of junk bytes
+        */
+        unsigned long GetDiscarded() {return m_nDiscarded;};
+
+        /** @brief  Get quantity of frames dropped due to invalid escape sequence or overflow
+        *   @retval unsigned long Quantity of errors
+        */
+        unsigned long GetErrors() {return m_nErrors;};
+
+        /** @brief  Get quantity of escape sequences decoded
+        *   @retval unsigned long Quantity of escape sequences (each cost one extra byte on the wire)
+        */
+        unsigned long GetEscapes() {return m_nEscapes;};
+
+    private:
+        enum SLIP_STATE
+        {
+            SLIP_STATE_IDLE, //Waiting for start of frame
+            SLIP_STATE_FRAME, //Within a frame
+            SLIP_STATE_ESCAPE, //Within a frame after an escape byte
+            SLIP_STATE_DROP, //Discarding an invalid frame until next delimiter
+            SLIP_STATE_COMPLETE //Frame complete
+        };
+        void Drop(); // Abandon current frame and wait for next delimiter
+        const unsigned char* DecodeDense(const unsigned char* pPos, const unsigned char* pEnd); // Decode byte by byte from an escape to the end of the frame or chunk, returning position reached
+        unsigned char* m_pBuffer; //Destination buffer
+        size_t m_nCapacity; //Size of destination buffer
+        size_t m_nSize; //Quantity of bytes decoded
+        SLIP_STATE m_nState; //Decoder state
+        unsigned long m_nDiscarded; //Quantity of bytes received outside frames
+        unsigned long m_nErrors; //Quantity of frames dropped
+        unsigned long m_nEscapes; //Quantity of escape sequences decoded
+};
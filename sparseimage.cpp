@@ -0,0 +1,158 @@
+#include "sparseimage.h"
+#include "esp8266.h" //provides GetLe32, PutLe32
+#include <cstring> //provides memcmp, memcpy, memset
+#include <algorithm> //provides copy
+
+// Header fields
+const static size_t SPARSE_HEADER_VERSION = 8; //uint32 Format version
+const static size_t SPARSE_HEADER_ADDRESS = 12; //uint32 Flash address of region
+const static size_t SPARSE_HEADER_SIZE_FIELD = 16; //uint32 Size of region
+const static size_t SPARSE_HEADER_EXTENTS = 20; //uint32 Quantity of extents
+const static size_t SPARSE_HEADER_MD5 = 24; //MD5 of region
+
+SparseImage::SparseImage() :
+    m_pFile(NULL),
+    m_bSparse(false),
+    m_nAddress(0),
+    m_nSize(0)
+{
+    m_md5.fill(0);
+}
+
+SparseImage::~SparseImage()
+{
+}
+
+bool SparseImage::Attach(const unsigned char* pFile, size_t nFileSize)
+{
+    m_pFile = pFile;
+    m_vExtents.clear();
+    m_vPositions.clear();
+    m_md5.fill(0);
+    m_nAddress = 0;
+    m_bSparse = nFileSize >= sizeof(SPARSE_MAGIC) && memcmp(pFile, SPARSE_MAGIC, sizeof(SPARSE_MAGIC)) == 0;
+    if(!m_bSparse)
+    {
+        m_nSize = nFileSize;
+        m_vExtents.push_back({0, (uint32_t)nFileSize});
+        m_vPositions.push_back(0);
+        return true;
+    }
+    if(nFileSize < SPARSE_HEADER_SIZE || GetLe32(pFile + SPARSE_HEADER_VERSION) != SPARSE_VERSION)
+        return false;
+    m_nAddress = GetLe32(pFile + SPARSE_HEADER_ADDRESS);
+    m_nSize = GetLe32(pFile + SPARSE_HEADER_SIZE_FIELD);
+    size_t nExtents = GetLe32(pFile + SPARSE_HEADER_EXTENTS);
+    copy(pFile + SPARSE_HEADER_MD5, pFile + SPARSE_HEADER_MD5 + MD5_SIZE, m_md5.begin());
+    if(nExtents > (nFileSize - SPARSE_HEADER_SIZE) / SPARSE_EXTENT_SIZE)
+        return false;
+    //Extents must be in order, within region and exactly fill the data area
+    size_t nEnd = 0;
+    for(size_t nExtent = 0; nExtent < nExtents; ++nExtent)
+    {
+        const unsigned char* pEntry = pFile + SPARSE_HEADER_SIZE + nExtent * SPARSE_EXTENT_SIZE;
+        SparseExtent extent = {GetLe32(pEntry), GetLe32(pEntry + 4)};
+        if(extent.nOffset < nEnd || extent.nSize == 0 || (size_t)extent.nOffset + extent.nSize > m_nSize)
+            return false;
+        nEnd = extent.nOffset + extent.nSize;
+        m_vExtents.push_back(extent);
+    }
+    m_vPositions = GetDataPositions(m_vExtents);
+    return GetFileSize(m_vExtents) == nFileSize;
+}
+
+bool SparseImage::IsComplete()
+{
+    if(!m_bSparse)
+        return true;
+    for(size_t nByte = 0; nByte < MD5_SIZE; ++nByte)
+        if(m_md5[nByte])
+            return true;
+    return false;
+}
+
+vector<SparseExtent> SparseImage::GetHoles()
+{
+    vector<SparseExtent> vHoles;
+    uint32_t nEnd = 0;
+    for(auto it = m_vExtents.begin(); it != m_vExtents.end(); ++it)
+    {
+        if(it->nOffset > nEnd)
+            vHoles.push_back({nEnd, it->nOffset - nEnd});
+        nEnd = it->nOffset + it->nSize;
+    }
+    if(nEnd < m_nSize)
+        vHoles.push_back({nEnd, (uint32_t)(m_nSize - nEnd)});
+    return vHoles;
+}
+
+size_t SparseImage::GetDataSize()
+{
+    size_t nSize = 0;
+    for(auto it = m_vExtents.begin(); it != m_vExtents.end(); ++it)
+        nSize += it->nSize;
+    return nSize;
+}
+
+const unsigned char* SparseImage::GetData(size_t nOffset)
+{
+    for(size_t nExtent = 0; nExtent < m_vExtents.size() && m_vExtents[nExtent].nOffset <= nOffset; ++nExtent)
+        if(nOffset < (size_t)m_vExtents[nExtent].nOffset + m_vExtents[nExtent].nSize)
+            return m_pFile + m_vPositions[nExtent] + nOffset - m_vExtents[nExtent].nOffset;
+    return NULL; //Erased
+}
+
+Md5Digest SparseImage::CalculateMd5()
+{
+    Md5 md5;
+    size_t nEnd = 0;
+    for(size_t nExtent = 0; nExtent < m_vExtents.size(); ++nExtent)
+    {
+        md5.Fill(0xFF, m_vExtents[nExtent].nOffset - nEnd);
+        md5.Update(m_pFile + m_vPositions[nExtent], m_vExtents[nExtent].nSize);
+        nEnd = m_vExtents[nExtent].nOffset + m_vExtents[nExtent].nSize;
+    }
+    md5.Fill(0xFF, m_nSize - nEnd);
+    return md5.Final();
+}
+
+size_t SparseImage::GetFileSize(const vector<SparseExtent>& vExtents)
+{
+    size_t nSize = SPARSE_HEADER_SIZE + vExtents.size() * SPARSE_EXTENT_SIZE;
+    for(auto it = vExtents.begin(); it != vExtents.end(); ++it)
+        nSize += it->nSize;
+    return nSize;
+}
+
+vector<size_t> SparseImage::GetDataPositions(const vector<SparseExtent>& vExtents)
+{
+    vector<size_t> vPositions;
+    size_t nPosition = SPARSE_HEADER_SIZE + vExtents.size() * SPARSE_EXTENT_SIZE;
+    for(auto it = vExtents.begin(); it != vExtents.end(); ++it)
+    {
+        vPositions.push_back(nPosition);
+        nPosition += it->nSize;
+    }
+    return vPositions;
+}
+
+void SparseImage::WriteHeader(unsigned char* pFile, uint32_t nAddress, uint32_t nSize, const vector<SparseExtent>& vExtents)
+{
+    memcpy(pFile, SPARSE_MAGIC, sizeof(SPARSE_MAGIC));
+    PutLe32(pFile + SPARSE_HEADER_VERSION, SPARSE_VERSION);
+    PutLe32(pFile + SPARSE_HEADER_ADDRESS, nAddress);
+    PutLe32(pFile + SPARSE_HEADER_SIZE_FIELD, nSize);
+    PutLe32(pFile + SPARSE_HEADER_EXTENTS, vExtents.size());
+    memset(pFile + SPARSE_HEADER_MD5, 0, SPARSE_HEADER_SIZE - SPARSE_HEADER_MD5);
+    unsigned char* pEntry = pFile + SPARSE_HEADER_SIZE;
+    for(auto it = vExtents.begin(); it != vExtents.end(); ++it, pEntry += SPARSE_EXTENT_SIZE)
+    {
+        PutLe32(pEntry, it->nOffset);
+        PutLe32(pEntry + 4, it->nSize);
+    }
+}
+
+void SparseImage::SetMd5(unsigned char* pFile, const Md5Digest& digest)
+{
+    copy(digest.begin(), digest.end(), pFile + SPARSE_HEADER_MD5);
+}
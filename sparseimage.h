@@ -0,0 +1,128 @@
+/** Sparse flash image
+*   Author: agent
+*   Date: 2026-10-17
+*   License: LGPL
+*/
+
+#pragma once
+#include "md5.h"
+#include <vector>
+#include <stdint.h> //provides fixed width integers
+#include <cstddef> //provides size_t
+
+using namespace std;
+
+// Layout (little-endian): header, extent table of offset / size pairs in ascending order, then data of each extent. Anything between extents is erased.
+const static unsigned char SPARSE_MAGIC[8] = {'E', 'S', 'P', 'S', 'P', 'A', 'R', 'S'}; //First bytes of sparse image
+const static uint32_t SPARSE_VERSION = 1; //Format version
+const static size_t SPARSE_HEADER_SIZE = 40; //Size of header
+const static size_t SPARSE_EXTENT_SIZE = 8; //Size of each extent table entry
+
+/** Region of an image holding data */
+struct SparseExtent
+{
+    uint32_t nOffset; //Offset within image
+    uint32_t nSize; //Quantity of bytes
+};
+
+class SparseImage
+{
+    public:
+        SparseImage();
+        virtual ~SparseImage();
+
+        /** @brief  Attach to the content of an image file
+        *   @param  pFile Pointer to file content, e.g. mapped with MapFile. Must remain valid whilst attached.
+        *   @param  nFileSize Quantity of bytes in file
+        *   @retval bool True if file is a valid sparse image or a plain image. False if file has sparse magic but is invalid.
+        *   @note   A plain image is presented as one extent covering the whole file
+        */
+        bool Attach(const unsigned char* pFile, size_t nFileSize);
+
+        /** @brief  Check whether attached file is a sparse image
+        *   @retval bool True if sparse, false if plain
+        */
+        bool IsSparse() {return m_bSparse;};
+
+        /** @brief  Check whether a sparse image was completed by read_flash
+        *   @retval bool True if MD5 of region has been recorded (always true for plain images)
+        */
+        bool IsComplete();
+
+        /** @brief  Get flash address recorded when image was read
+        *   @retval uint32_t Flash address (zero for plain images)
+        */
+        uint32_t GetAddress() {return m_nAddress;};
+
+        /** @brief  Get size of flash region described by image
+        *   @retval size_t Quantity of bytes including erased regions
+        */
+        size_t GetSize() {return m_nSize;};
+
+        /** @brief  Get regions holding data
+        *   @retval const vector<SparseExtent>& Extents in ascending order
+        */
+        const vector<SparseExtent>& GetExtents() {return m_vExtents;};
+
+        /** @brief  Get erased regions between extents
+        *   @retval vector<SparseExtent> Holes in ascending order
+        */
+        vector<SparseExtent> GetHoles();
+
+        /** @brief  Get quantity of bytes of data held in extents
+        *   @retval size_t Quantity of bytes
+        */
+        size_t GetDataSize();
+
+        /** @brief  Get pointer to data at an offset within the image
+        *   @param  nOffset Offset within image
+        *   @retval const unsigned char* Pointer to data, valid to end of the containing extent, or NULL if offset is in an erased region
+        */
+        const unsigned char* GetData(size_t nOffset);
+
+        /** @brief  Get MD5 of whole region recorded in sparse image
+        *   @retval Md5Digest Digest, all zero if incomplete
+        */
+        Md5Digest GetMd5() {return m_md5;};
+
+        /** @brief  Calculate MD5 of whole region from extents, treating holes as erased
+        *   @retval Md5Digest Digest
+        */
+        Md5Digest CalculateMd5();
+
+        /** @brief  Get quantity of bytes in a sparse image file
+        *   @param  vExtents Extents of image
+        *   @retval size_t Size of header, extent table and data
+        */
+        static size_t GetFileSize(const vector<SparseExtent>& vExtents);
+
+        /** @brief  Get position of data of each extent within a sparse image file
+        *   @param  vExtents Extents of image
+        *   @retval vector<size_t> Offset within file of data of each extent
+        */
+        static vector<size_t> GetDataPositions(const vector<SparseExtent>& vExtents);
+
+        /** @brief  Populate header and extent table of a new sparse image file
+        *   @param  pFile Pointer to file content, at least GetFileSize() bytes
+        *   @param  nAddress Flash address of region
+        *   @param  nSize Quantity of bytes in region
+        *   @param  vExtents Extents of image
+        *   @note   MD5 is zero, marking image incomplete until SetMd5 is called
+        */
+        static void WriteHeader(unsigned char* pFile, uint32_t nAddress, uint32_t nSize, const vector<SparseExtent>& vExtents);
+
+        /** @brief  Record MD5 of whole region in a sparse image file, marking it complete
+        *   @param  pFile Pointer to file content
+        *   @param  digest MD5 of region (see CalculateMd5)
+        */
+        static void SetMd5(unsigned char* pFile, const Md5Digest& digest);
+
+    private:
+        const unsigned char* m_pFile; //Attached file content
+        bool m_bSparse; //True if attached file is a sparse image
+        uint32_t m_nAddress; //Flash address recorded in image
+        size_t m_nSize; //Size of region
+        vector<SparseExtent> m_vExtents; //Regions holding data
+        vector<size_t> m_vPositions; //Offset within file of data of each extent
+        Md5Digest m_md5; //Recorded MD5 of region
+};
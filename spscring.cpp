@@ -0,0 +1,105 @@
+#include "spscring.h"
+#include <cstring> //provides memcpy
+#include <algorithm> //provides min
+
+SpscRing::SpscRing(size_t nSize) :
+    m_nHead(0),
+    m_nTailCache(0),
+    m_nTail(0),
+    m_nHeadCache(0)
+{
+    size_t nCapacity = 1;
+    while(nCapacity < nSize)
+        nCapacity <<= 1;
+    m_vBuffer.resize(nCapacity);
+    m_nMask = nCapacity - 1;
+}
+
+SpscRing::~SpscRing()
+{
+}
+
+size_t SpscRing::GetFree()
+{
+    size_t nHead = m_nHead.load(memory_order_relaxed);
+    m_nTailCache = m_nTail.load(memory_order_acquire);
+    return m_vBuffer.size() - (nHead - m_nTailCache);
+}
+
+size_t SpscRing::Write(const unsigned char* pData, size_t nSize)
+{
+    size_t nHead = m_nHead.load(memory_order_relaxed);
+    if(m_vBuffer.size() - (nHead - m_nTailCache) < nSize)
+        m_nTailCache = m_nTail.load(memory_order_acquire); //Only touch consumer's index when ring appears full
+    nSize = min(nSize, m_vBuffer.size() - (nHead - m_nTailCache));
+    if(nSize == 0)
+        return 0;
+    Copy(nHead, pData, nSize);
+    m_nHead.store(nHead + nSize, memory_order_release);
+    return nSize;
+}
+
+bool SpscRing::Write(const unsigned char* pHeader, size_t nHeaderSize, const unsigned char* pPayload, size_t nPayloadSize)
+{
+    size_t nHead = m_nHead.load(memory_order_relaxed);
+    size_t nSize = nHeaderSize + nPayloadSize;
+    if(m_vBuffer.size() - (nHead - m_nTailCache) < nSize)
+    {
+        m_nTailCache = m_nTail.load(memory_order_acquire);
+        if(m_vBuffer.size() - (nHead - m_nTailCache) < nSize)
+            return false;
+    }
+    Copy(nHead, pHeader, nHeaderSize);
+    Copy(nHead + nHeaderSize, pPayload, nPayloadSize);
+    m_nHead.store(nHead + nSize, memory_order_release);
+    return true;
+}
+
+size_t SpscRing::Available()
+{
+    size_t nTail = m_nTail.load(memory_order_relaxed);
+    if(m_nHeadCache == nTail)
+        m_nHeadCache = m_nHead.load(memory_order_acquire); //Only touch producer's index when ring appears empty
+    return m_nHeadCache - nTail;
+}
+
+size_t SpscRing::Read(unsigned char* pBuffer, size_t nSize)
+{
+    size_t nRead = 0;
+    while(nRead < nSize)
+    {
+        const unsigned char* pData;
+        size_t nChunk = min(Peek(&pData), nSize - nRead);
+        if(nChunk == 0)
+            break;
+        memcpy(pBuffer + nRead, pData, nChunk);
+        Consume(nChunk);
+        nRead += nChunk;
+    }
+    return nRead;
+}
+
+size_t SpscRing::Peek(const unsigned char** ppData)
+{
+    size_t nAvailable = Available();
+    size_t nTail = m_nTail.load(memory_order_relaxed) & m_nMask;
+    *ppData = m_vBuffer.data() + nTail;
+    return min(nAvailable, m_vBuffer.size() - nTail);
+}
+
+void SpscRing::Consume(size_t nSize)
+{
+    size_t nTail = m_nTail.load(memory_order_relaxed);
+    nSize = min(nSize, m_nHeadCache - nTail);
+    m_nTail.store(nTail + nSize, memory_order_release);
+}
+
+void SpscRing::Copy(size_t nPos, const unsigned char* pData, size_t nSize)
+{
+    if(nSize == 0)
+        return;
+    nPos &= m_nMask;
+    size_t nFirst = min(nSize, m_vBuffer.size() - nPos);
+    memcpy(m_vBuffer.data() + nPos, pData, nFirst);
+    memcpy(m_vBuffer.data(), pData + nFirst, nSize - nFirst);
+}
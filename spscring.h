@@ -0,0 +1,87 @@
+/** Lock-free single producer / single consumer byte ring
+*   Author: agent
+*   Date: 2026-10-17
+*   License: LGPL
+*/
+
+#pragma once
+#include <vector>
+#include <atomic>
+#include <cstddef> //provides size_t
+
+using namespace std;
+
+const static size_t SPSC_CACHE_LINE = 64; //Alignment separating producer and consumer indices to avoid false sharing
+
+/** Lock-free byte ring between exactly one producer thread and one consumer thread */
+class SpscRing
+{
+    public:
+        /** @brief  Instantiate a ring
+        *   @param  nSize Capacity in bytes, rounded up to a power of 2
+        */
+        SpscRing(size_t nSize);
+        virtual ~SpscRing();
+
+        /** @brief  Get capacity of ring
+        *   @retval size_t Quantity of bytes ring can hold
+        */
+        size_t GetSize() {return m_vBuffer.size();};
+
+        /** @brief  Get free space (producer)
+        *   @retval size_t Quantity of bytes that may be written
+        *   @note   Free space can only grow until the producer writes so a subsequent Write of up to this size succeeds in full
+        */
+        size_t GetFree();
+
+        /** @brief  Append data (producer)
+        *   @param  pData Pointer to data
+        *   @param  nSize Quantity of bytes to write
+        *   @retval size_t Quantity of bytes written which is less than nSize if the ring is full
+        */
+        size_t Write(const unsigned char* pData, size_t nSize);
+
+        /** @brief  Append a header and payload as one unit (producer)
+        *   @param  pHeader Pointer to header
+        *   @param  nHeaderSize Quantity of bytes in header
+        *   @param  pPayload Pointer to payload
+        *   @param  nPayloadSize Quantity of bytes in payload
+        *   @retval bool True on success. False, writing nothing, if there is insufficient space for both.
+        *   @note   Consumer sees both parts together so may read header then payload without waiting
+        */
+        bool Write(const unsigned char* pHeader, size_t nHeaderSize, const unsigned char* pPayload, size_t nPayloadSize);
+
+        /** @brief  Get quantity of data waiting (consumer)
+        *   @retval size_t Quantity of bytes that may be read
+        */
+        size_t Available();
+
+        /** @brief  Copy and remove data (consumer)
+        *   @param  pBuffer Pointer to buffer to populate
+        *   @param  nSize Maximum quantity of bytes to read
+        *   @retval size_t Quantity of bytes read
+        */
+        size_t Read(unsigned char* pBuffer, size_t nSize);
+
+        /** @brief  Get direct access to data without copying (consumer)
+        *   @param  ppData Pointer to a pointer which is set to the first unread byte
+        *   @retval size_t Quantity of contiguous bytes available at *ppData, which may be less than Available() where data wraps
+        *   @note   Data remains in ring until released with Consume()
+        */
+        size_t Peek(const unsigned char** ppData);
+
+        /** @brief  Release data after Peek() (consumer)
+        *   @param  nSize Quantity of bytes to release
+        */
+        void Consume(size_t nSize);
+
+    private:
+        void Copy(size_t nPos, const unsigned char* pData, size_t nSize); // Copy data into ring at position nPos, wrapping if required
+
+        vector<unsigned char> m_vBuffer; //Ring storage
+        size_t m_nMask; //Size - 1 to wrap indices
+        alignas(SPSC_CACHE_LINE) atomic<size_t> m_nHead; //Total bytes written. Written by producer.
+        size_t m_nTailCache; //Producer's copy of m_nTail
+        alignas(SPSC_CACHE_LINE) atomic<size_t> m_nTail; //Total bytes read. Written by consumer.
+        size_t m_nHeadCache; //Consumer's copy of m_nHead
+};
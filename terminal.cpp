@@ -0,0 +1,390 @@
+#include "terminal.h"
+#include <iostream>
+#include <poll.h> //provides poll() to wait on serial port and stdin together
+#include <unistd.h> //provides read, write, isatty
+#include <errno.h> //provides errno
+#include <fcntl.h> //provides O_NONBLOCK for wake pipe
+#include <cstring> //provides memchr
+#include <cstdio> //provides snprintf
+
+volatile sig_atomic_t Terminal::s_bStop = 0;
+
+Terminal::Terminal(ESP8266* pEsp) :
+    m_pEsp(pEsp),
+    m_pSerial(pEsp->GetSerial()),
+    m_bRaw(false),
+    m_bMenu(false),
+    m_bKeyboard(true),
+    m_bRun(true),
+    m_ring(TERMINAL_RING_SIZE),
+    m_bWriterIdle(false),
+    m_bReaderDone(false),
+    m_nReceived(0),
+    m_nDropped(0),
+    m_nPendingDrop(0),
+    m_nHighWater(0),
+    m_bLineStart(true),
+    m_bStdout(true)
+{
+    m_aWake[0] = m_aWake[1] = -1;
+}
+
+Terminal::~Terminal()
+{
+}
+
+bool Terminal::SetCapture(string sFilename)
+{
+    m_fileCapture.open(sFilename.c_str(), ios::binary | ios::trunc);
+    if(!m_fileCapture.is_open())
+        return false;
+    m_vCapture.reserve(TERMINAL_CAPTURE_BUFFER + 64);
+    return true;
+}
+
+bool Terminal::Run()
+{
+    //Create wake pipe before changing keyboard mode so failure leaves the tty untouched
+    if(pipe2(m_aWake, O_NONBLOCK | O_CLOEXEC) != 0)
+    {
+        Status("Cannot create writer thread");
+        return false;
+    }
+    if(isatty(STDIN_FILENO) && tcgetattr(STDIN_FILENO, &m_ttyStdin) == 0)
+    {
+        //Raw keyboard so each key is sent immediately and control keys reach the device
+        termios tty = m_ttyStdin;
+        cfmakeraw(&tty);
+        tty.c_oflag |= OPOST; //Keep newline translation for status messages
+        m_bRaw = (tcsetattr(STDIN_FILENO, TCSANOW, &tty) == 0);
+    }
+    long nOverruns = m_pSerial->GetOverruns();
+    m_tStart = chrono::steady_clock::now();
+    m_bReaderDone = false;
+    m_threadWriter = thread(&Terminal::Writer, this);
+    Status("Terminal on " + to_string(m_pSerial->GetBaud()) + " baud. Ctrl+] to exit, Ctrl+T H for help");
+    bool bSuccess = true;
+    s_bStop = 0;
+    m_bRun = true;
+    while(m_bRun && !s_bStop)
+    {
+        //Drain anything already in the receive ring before blocking
+        if(m_pSerial->Available() && !FromSerial())
+        {
+            bSuccess = false;
+            break;
+        }
+        pollfd aPoll[2];
+        aPoll[0].fd = m_pSerial->GetFd();
+        aPoll[0].events = POLLIN;
+        aPoll[1].fd = m_bKeyboard ? STDIN_FILENO : -1; //Negative descriptor is ignored by poll
+        aPoll[1].events = POLLIN;
+        int nResult = poll(aPoll, 2, -1);
+        if(nResult < 0)
+        {
+            if(errno == EINTR)
+                continue; //Signal, possibly Stop()
+            bSuccess = false;
+            break;
+        }
+        if(aPoll[0].revents & (POLLERR | POLLNVAL))
+        {
+            Status("Serial port failed");
+            bSuccess = false;
+            break;
+        }
+        if((aPoll[0].revents & (POLLIN | POLLHUP)) && !FromSerial())
+        {
+            bSuccess = false;
+            break;
+        }
+        if(aPoll[1].revents & (POLLIN | POLLHUP | POLLERR))
+            FromKeyboard();
+    }
+    //Let writer empty the ring then stop
+    m_bReaderDone = true;
+    WakeWriter();
+    m_threadWriter.join();
+    close(m_aWake[0]);
+    close(m_aWake[1]);
+    m_aWake[0] = m_aWake[1] = -1;
+    if(m_bRaw)
+        tcsetattr(STDIN_FILENO, TCSANOW, &m_ttyStdin);
+    m_bRaw = false;
+    string sSummary = "Received " + to_string(m_nReceived) + " bytes, dropped " + to_string(m_nDropped)
+        + ", buffer high water " + to_string(m_nHighWater) + " of " + to_string(m_ring.GetSize());
+    if(nOverruns >= 0 && m_pSerial->GetOverruns() >= nOverruns)
+        sSummary += ", port overruns " + to_string(m_pSerial->GetOverruns() - nOverruns);
+    Status(sSummary);
+    return bSuccess;
+}
+
+bool Terminal::FromSerial()
+{
+    const unsigned char* pData;
+    int nSize = m_pSerial->Peek(&pData, 0);
+    if(nSize < 0)
+    {
+        Status("Serial port closed");
+        return false;
+    }
+    if(nSize == 0)
+        return true;
+    m_nReceived += nSize;
+    //Never wait for the writer - keep as much as fits and count the rest as dropped so the port is always drained
+    Record record;
+    record.nTime = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - m_tStart).count();
+    size_t nFree = m_ring.GetFree();
+    size_t nKeep = (nFree > sizeof(record)) ? min((size_t)nSize, nFree - sizeof(record)) : 0;
+    if(nKeep)
+    {
+        record.nSize = nKeep;
+        record.nDropped = m_nPendingDrop;
+        m_ring.Write((const unsigned char*)&record, sizeof(record), pData, nKeep);
+        m_nPendingDrop = 0;
+        WakeWriter();
+    }
+    m_nDropped += nSize - nKeep;
+    m_nPendingDrop += nSize - nKeep;
+    m_nHighWater = max(m_nHighWater, m_ring.GetSize() - m_ring.GetFree());
+    m_pSerial->Consume(nSize);
+    return true;
+}
+
+void Terminal::FromKeyboard()
+{
+    unsigned char aBuffer[TERMINAL_CHUNK];
+    ssize_t nRead = read(STDIN_FILENO, aBuffer, sizeof(aBuffer));
+    if(nRead < 0 && (errno == EINTR || errno == EAGAIN))
+        return;
+    if(nRead <= 0)
+    {
+        m_bKeyboard = false; //End of input (e.g. piped file) so keep showing serial data until stopped
+        return;
+    }
+    //Forward runs of ordinary keys in one write, stopping at hotkeys
+    unsigned char* pStart = aBuffer;
+    unsigned char* pEnd = aBuffer + nRead;
+    for(unsigned char* pPos = aBuffer; pPos < pEnd; ++pPos)
+    {
+        if(!m_bMenu && *pPos != TERMINAL_MENU_KEY && *pPos != TERMINAL_EXIT_KEY)
+            continue;
+        if(pPos > pStart)
+            m_pSerial->Write(pStart, pPos - pStart);
+        pStart = pPos + 1;
+        if(m_bMenu)
+        {
+            m_bMenu = false;
+            Hotkey(*pPos);
+        }
+        else if(*pPos == TERMINAL_MENU_KEY)
+            m_bMenu = true;
+        else
+            m_bRun = false;
+        if(!m_bRun)
+            return;
+    }
+    if(pEnd > pStart)
+        m_pSerial->Write(pStart, pEnd - pStart);
+}
+
+void Terminal::Hotkey(unsigned char cKey)
+{
+    switch(cKey)
+    {
+        case 'r':
+        case 'R':
+            m_pEsp->Reset(false);
+            m_pSerial->Flush(SERIAL_INPUT);
+            Status("Reset to run mode");
+            break;
+        case 'f':
+        case 'F':
+            m_pEsp->Reset(true);
+            m_pSerial->Flush(SERIAL_INPUT);
+            Status("Reset to flash mode");
+            break;
+        case '+':
+        case '=':
+            ChangeBaud(1);
+            break;
+        case '-':
+        case '_':
+            ChangeBaud(-1);
+            break;
+        case 'q':
+        case 'Q':
+            m_bRun = false;
+            break;
+        case TERMINAL_MENU_KEY:
+        {
+            //Send menu key itself
+            unsigned char cData = TERMINAL_MENU_KEY;
+            m_pSerial->Write(&cData, 1);
+            break;
+        }
+        default:
+            Status("Ctrl+T then: R reset, F reset to flash mode, + / - change baud, Q or Ctrl+] exit, Ctrl+T send Ctrl+T");
+    }
+}
+
+void Terminal::ChangeBaud(int nStep)
+{
+    const int nCount = sizeof(TERMINAL_BAUDS) / sizeof(TERMINAL_BAUDS[0]);
+    unsigned int nBaud = m_pSerial->GetBaud();
+    //Find position of current rate (which may not be in the list)
+    int nIndex = 0;
+    while(nIndex < nCount && TERMINAL_BAUDS[nIndex] < nBaud)
+        ++nIndex;
+    if(nStep > 0 && nIndex < nCount && TERMINAL_BAUDS[nIndex] == nBaud)
+        ++nIndex;
+    else if(nStep < 0)
+        --nIndex;
+    if(nIndex < 0 || nIndex >= nCount)
+    {
+        Status("No " + string(nStep > 0 ? "faster" : "slower") + " baud");
+        return;
+    }
+    //Skip rates the port cannot be configured for
+    while(nIndex >= 0 && nIndex < nCount && !m_pSerial->IsBaudSupported(TERMINAL_BAUDS[nIndex]))
+        nIndex += nStep;
+    if(nIndex < 0 || nIndex >= nCount || !m_pSerial->SetBaud(TERMINAL_BAUDS[nIndex]))
+    {
+        Status("Cannot change baud");
+        return;
+    }
+    Status("Baud " + to_string(m_pSerial->GetBaud()));
+}
+
+void Terminal::Status(string sMessage)
+{
+    cerr << "\r\n--- " << sMessage << " ---\r\n" << flush;
+}
+
+bool Terminal::WriteAll(int nFd, const unsigned char* pData, size_t nSize)
+{
+    while(nSize > 0)
+    {
+        ssize_t nWritten = write(nFd, pData, nSize);
+        if(nWritten < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            return false;
+        }
+        pData += nWritten;
+        nSize -= nWritten;
+    }
+    return true;
+}
+
+void Terminal::WakeWriter()
+{
+    //Full barrier pairs with WaitForData so either writer sees new data or reader sees writer idle
+    atomic_thread_fence(memory_order_seq_cst);
+    if(!m_bWriterIdle.load(memory_order_relaxed) || !m_bWriterIdle.exchange(false))
+        return;
+    unsigned char cWake = 0;
+    while(write(m_aWake[1], &cWake, 1) < 0 && errno == EINTR);
+}
+
+void Terminal::WaitForData()
+{
+    m_bWriterIdle = true;
+    atomic_thread_fence(memory_order_seq_cst);
+    if(m_ring.Available() || m_bReaderDone)
+    {
+        m_bWriterIdle = false;
+        return;
+    }
+    pollfd fdPoll;
+    fdPoll.fd = m_aWake[0];
+    fdPoll.events = POLLIN;
+    poll(&fdPoll, 1, -1);
+    unsigned char aWake[64];
+    while(read(m_aWake[0], aWake, sizeof(aWake)) > 0); //Empty pipe
+}
+
+void Terminal::Writer()
+{
+    while(true)
+    {
+        bool bDone = m_bReaderDone;
+        if(m_ring.Available() == 0)
+        {
+            if(bDone)
+                break;
+            FlushCapture(); //Write capture whilst idle so the file is current
+            WaitForData();
+            continue;
+        }
+        //Records are written whole so header and data are available together
+        Record record;
+        m_ring.Read((unsigned char*)&record, sizeof(record));
+        if(record.nDropped && m_fileCapture.is_open())
+            CaptureDropped(record.nDropped, record.nTime);
+        for(size_t nRemaining = record.nSize; nRemaining;)
+        {
+            const unsigned char* pData;
+            size_t nChunk = min(m_ring.Peek(&pData), nRemaining);
+            if(m_bStdout && !WriteAll(STDOUT_FILENO, pData, nChunk))
+                m_bStdout = false; //stdout gone, e.g. closed pipe, so only capture
+            if(m_fileCapture.is_open())
+                Capture(pData, nChunk, record.nTime);
+            m_ring.Consume(nChunk);
+            nRemaining -= nChunk;
+        }
+    }
+    if(m_nPendingDrop && m_fileCapture.is_open())
+    {
+        //Loss after the last record has no record to carry it. Reader has finished so its count is stable.
+        uint64_t nTime = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - m_tStart).count();
+        CaptureDropped(m_nPendingDrop, nTime);
+    }
+    FlushCapture();
+}
+
+void Terminal::CaptureDropped(unsigned long nDropped, uint64_t nTime)
+{
+    //Mark loss on its own line
+    string sDropped = "--- " + to_string(nDropped) + " bytes dropped ---\n";
+    if(!m_bLineStart)
+        m_vCapture.push_back('\n');
+    CaptureTime(nTime);
+    m_vCapture.insert(m_vCapture.end(), sDropped.begin(), sDropped.end());
+    m_bLineStart = true;
+}
+
+void Terminal::Capture(const unsigned char* pData, size_t nSize, uint64_t nTime)
+{
+    const unsigned char* pEnd = pData + nSize;
+    while(pData < pEnd)
+    {
+        if(m_bLineStart)
+            CaptureTime(nTime);
+        const unsigned char* pNewline = (const unsigned char*)memchr(pData, '\n', pEnd - pData);
+        const unsigned char* pNext = pNewline ? pNewline + 1 : pEnd;
+        m_vCapture.insert(m_vCapture.end(), pData, pNext);
+        m_bLineStart = (pNewline != NULL);
+        pData = pNext;
+        if(m_vCapture.size() >= TERMINAL_CAPTURE_BUFFER)
+            FlushCapture();
+    }
+}
+
+void Terminal::CaptureTime(uint64_t nTime)
+{
+    char sTime[32];
+    int nLength = snprintf(sTime, sizeof(sTime), "[%6lu.%06lu] ", (unsigned long)(nTime / 1000000), (unsigned long)(nTime % 1000000));
+    m_vCapture.insert(m_vCapture.end(), sTime, sTime + nLength);
+    m_bLineStart = false;
+}
+
+void Terminal::FlushCapture()
+{
+    if(m_vCapture.empty())
+        return;
+    m_fileCapture.write(m_vCapture.data(), m_vCapture.size());
+    m_fileCapture.flush();
+    m_vCapture.clear();
+}
@@ -0,0 +1,99 @@
+/** Serial terminal
+*   Author: agent
+*   Date: 2026-10-17
+*   License: LGPL
+*/
+
+#pragma once
+#include "esp8266.h"
+#include "spscring.h"
+#include <termios.h>
+#include <csignal> //provides sig_atomic_t
+#include <thread>
+#include <atomic>
+#include <fstream>
+#include <chrono>
+#include <stdint.h> //provides fixed width integers
+
+using namespace std;
+
+const static unsigned char TERMINAL_EXIT_KEY = 0x1d; //Ctrl+] leaves terminal
+const static unsigned char TERMINAL_MENU_KEY = 0x14; //Ctrl+T prefixes hotkeys
+const static size_t TERMINAL_CHUNK = 0x1000; //Maximum quantity of bytes read from stdin at a time
+const static size_t TERMINAL_RING_SIZE = 0x400000; //Received data buffered for writer (4MB, over 15s at 2Mbaud)
+const static size_t TERMINAL_CAPTURE_BUFFER = 0x10000; //Capture data buffered before writing to file
+const static unsigned int TERMINAL_BAUDS[] = {9600, 19200, 38400, 57600, 74880, 115200, 230400, 460800, 921600, 1500000, 2000000, 3000000}; //Rates selected by baud hotkeys
+
+class Terminal
+{
+    public:
+        /** @brief  Instantiate a terminal
+        *   @param  pEsp Pointer to ESP8266 whose serial port and reset sequences are used. Port must be open.
+        */
+        Terminal(ESP8266* pEsp);
+        virtual ~Terminal();
+
+        /** @brief  Capture received data to a file with timestamps
+        *   @param  sFilename Name of file to create
+        *   @retval bool True on success
+        *   @note   Each line is prefixed with seconds since the terminal started, taken when the data was read from the port. Dropped data is marked.
+        */
+        bool SetCapture(string sFilename);
+
+        /** @brief  Run terminal until exit key, signal or port failure
+        *   @retval bool True if stopped by user or signal, false on port failure
+        *   @note   Puts stdin in raw mode if it is a terminal, restoring it on return. Ctrl+C is passed to the device.
+        */
+        bool Run();
+
+        /** @brief  Request Run() to return
+        *   @note   Safe to call from a signal handler
+        */
+        static void Stop() {s_bStop = 1;};
+
+    private:
+        /*  Each read from the port is passed to the writer as one record: this header followed by the data */
+        struct Record
+        {
+            uint64_t nTime; //Microseconds since start when data was read
+            uint32_t nSize; //Quantity of data bytes following header
+            uint32_t nDropped; //Quantity of bytes dropped before this record because ring was full
+        };
+
+        bool FromSerial(); // Pass received data to writer. Returns false on port failure
+        void FromKeyboard(); // Forward keyboard input to serial port, handling hotkeys
+        void Hotkey(unsigned char cKey); // Act on key following TERMINAL_MENU_KEY
+        void ChangeBaud(int nStep); // Step baud up or down through TERMINAL_BAUDS
+        void Status(string sMessage); // Show status message on stderr
+        bool WriteAll(int nFd, const unsigned char* pData, size_t nSize); // Write whole buffer to file descriptor. Returns false on error
+        void WakeWriter(); // Wake writer thread if it is waiting for data
+        void Writer(); // Writer thread copying ring to stdout and capture file
+        void WaitForData(); // Block writer until ring has data or reader is done
+        void Capture(const unsigned char* pData, size_t nSize, uint64_t nTime); // Add received data to capture buffer, timestamping each line
+        void CaptureTime(uint64_t nTime); // Add timestamp to capture buffer
+        void CaptureDropped(unsigned long nDropped, uint64_t nTime); // Add line marking lost data to capture buffer
+        void FlushCapture(); // Write capture buffer to file
+
+        ESP8266* m_pEsp; //ESP8266 providing serial port and reset
+        Serial* m_pSerial; //Serial port
+        bool m_bRaw; //True if stdin was put in raw mode
+        termios m_ttyStdin; //Original stdin attributes
+        bool m_bMenu; //True if last key was TERMINAL_MENU_KEY
+        bool m_bKeyboard; //True whilst stdin is open
+        bool m_bRun; //False to leave Run loop
+        chrono::steady_clock::time_point m_tStart; //Time terminal started
+        SpscRing m_ring; //Received data passed from reader to writer
+        thread m_threadWriter; //Writer thread
+        int m_aWake[2]; //Pipe used to wake writer
+        atomic<bool> m_bWriterIdle; //True whilst writer waits for data
+        atomic<bool> m_bReaderDone; //True when reader will add no more data
+        unsigned long m_nReceived; //Quantity of bytes read from port (reader)
+        unsigned long m_nDropped; //Quantity of bytes dropped because ring was full (reader)
+        uint32_t m_nPendingDrop; //Quantity of bytes dropped since last record (reader, then writer once reader is done)
+        size_t m_nHighWater; //Most data held in ring (reader)
+        ofstream m_fileCapture; //Capture file (writer)
+        vector<char> m_vCapture; //Capture buffer (writer)
+        bool m_bLineStart; //True if next captured byte starts a line (writer)
+        bool m_bStdout; //False if stdout has failed (writer)
+        static volatile sig_atomic_t s_bStop; //Set by Stop()
+};
@@ -0,0 +1,127 @@
+#include "tracereplay.h"
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <algorithm>
+
+TraceReplay::TraceReplay() :
+    m_nRecords(0),
+    m_nBaudChanges(0),
+    m_nModemChanges(0),
+    m_nDuration(0),
+    m_nLoops(0),
+    m_nCommands(0),
+    m_nMatched(0),
+    m_nInvalid(0),
+    m_nMismatches(0),
+    m_dSeconds(0)
+{
+}
+
+TraceReplay::~TraceReplay()
+{
+}
+
+bool TraceReplay::Load(string sFilename)
+{
+    ifstream fileTrace(sFilename.c_str(), ios::binary);
+    vector<unsigned char> vTrace((istreambuf_iterator<char>(fileTrace)), istreambuf_iterator<char>());
+    if(vTrace.size() < sizeof(SERIAL_TRACE_MAGIC) || !equal(SERIAL_TRACE_MAGIC, SERIAL_TRACE_MAGIC + sizeof(SERIAL_TRACE_MAGIC), vTrace.begin()))
+    {
+        cerr << sFilename << " is not a serial trace file" << endl;
+        return false;
+    }
+    m_vRx.clear();
+    m_vTx.clear();
+    m_nRecords = m_nBaudChanges = m_nModemChanges = 0;
+    m_nDuration = 0;
+    size_t nPos = sizeof(SERIAL_TRACE_MAGIC);
+    while(nPos + SERIAL_TRACE_HEADER <= vTrace.size())
+    {
+        const unsigned char* pHeader = vTrace.data() + nPos;
+        size_t nLength = GetLe32(pHeader + 5);
+        nPos += SERIAL_TRACE_HEADER;
+        if(nPos + nLength > vTrace.size())
+            break; //Truncated record, e.g. recording was interrupted
+        const unsigned char* pData = vTrace.data() + nPos;
+        nPos += nLength;
+        ++m_nRecords;
+        m_nDuration += GetLe32(pHeader + 1);
+        switch(pHeader[0])
+        {
+            case SERIAL_TRACE_RX:
+                m_vRx.insert(m_vRx.end(), pData, pData + nLength);
+                break;
+            case SERIAL_TRACE_TX:
+                m_vTx.insert(m_vTx.end(), pData, pData + nLength);
+                break;
+            case SERIAL_TRACE_BAUD:
+                ++m_nBaudChanges;
+                break;
+            case SERIAL_TRACE_MODEM:
+                ++m_nModemChanges;
+                break;
+        }
+    }
+    if(nPos != vTrace.size())
+        cerr << "Trace " << sFilename << " is truncated - replaying " << m_nRecords << " complete records" << endl;
+    return true;
+}
+
+bool TraceReplay::Run(ESP8266* pEsp, unsigned int nLoops)
+{
+    Serial* pSerial = pEsp->GetSerial();
+    //Transmitted frames are decoded once so replay only measures the receive path and response matching
+    vector<pair<size_t, size_t> > vFrames; //Offset and size of each decoded command frame in vCommands
+    vector<unsigned char> vCommands;
+    vector<unsigned char> vFrame(m_vTx.size());
+    SlipDecoder decoder;
+    decoder.SetBuffer(vFrame.data(), vFrame.size());
+    m_nInvalid = 0;
+    for(size_t nPos = 0; nPos < m_vTx.size();)
+    {
+        nPos += decoder.Decode(m_vTx.data() + nPos, m_vTx.size() - nPos);
+        if(!decoder.IsComplete())
+            break;
+        size_t nSize = decoder.GetSize();
+        if(nSize < ESP_HEADER_SIZE || vFrame[ESP_HEADER_MSG_TYPE] != ESP_MSGTYPE_COMMAND)
+            ++m_nInvalid;
+        else
+        {
+            vFrames.push_back(make_pair(vCommands.size(), nSize));
+            vCommands.insert(vCommands.end(), vFrame.begin(), vFrame.begin() + nSize);
+        }
+        decoder.Restart();
+    }
+    m_nLoops = nLoops;
+    m_nCommands = m_nMatched = m_nMismatches = 0;
+    chrono::steady_clock::time_point tStart = chrono::steady_clock::now();
+    for(unsigned int nLoop = 0; nLoop < nLoops; ++nLoop)
+    {
+        pSerial->SetReplay(m_vRx.data(), m_vRx.size(), m_vTx.data(), m_vTx.size());
+        for(auto it = vFrames.begin(); it != vFrames.end(); ++it)
+        {
+            const unsigned char* pFrame = vCommands.data() + it->first;
+            ++m_nCommands;
+            if(pEsp->SendCommand(pFrame[ESP_HEADER_OP], pFrame + ESP_HEADER_SIZE, it->second - ESP_HEADER_SIZE, GetLe32(pFrame + ESP_HEADER_CHECKSUM)))
+                ++m_nMatched;
+        }
+        m_nMismatches += pSerial->GetReplayMismatches();
+    }
+    m_dSeconds = chrono::duration<double>(chrono::steady_clock::now() - tStart).count();
+    pSerial->SetReplay(NULL, 0);
+    return m_nMismatches == 0;
+}
+
+void TraceReplay::ShowResults()
+{
+    cout << "Trace: " << m_nRecords << " records over " << m_nDuration / 1000 << "ms, " << m_vTx.size() << " bytes sent, "
+        << m_vRx.size() << " bytes received, " << m_nBaudChanges << " baud changes, " << m_nModemChanges << " modem line changes" << endl;
+    if(!m_nLoops)
+        return;
+    cout << "Replayed " << m_nCommands << " commands in " << m_nLoops << " loops: " << m_nMatched << " answered, "
+        << m_nCommands - m_nMatched << " unanswered, " << m_nInvalid << " invalid frames, " << m_nMismatches << " bytes retransmitted differently" << endl;
+    if(m_dSeconds > 0)
+        cout << "Replay took " << m_dSeconds * 1000 << "ms (" << (unsigned long)(m_nCommands / m_dSeconds) << " commands/s, "
+            << (unsigned long)(m_vRx.size() * m_nLoops / m_dSeconds) << " received bytes/s)" << endl;
+}
@@ -0,0 +1,52 @@
+/** Serial trace replay
+*   Author: agent
+*   Date: 2026-10-17
+*   License: LGPL
+*/
+
+#pragma once
+#include "esp8266.h"
+#include <string>
+#include <vector>
+#include <stdint.h> //provides fixed width integers
+
+using namespace std;
+
+class TraceReplay
+{
+    public:
+        TraceReplay();
+        virtual ~TraceReplay();
+
+        /** @brief  Load a trace file
+        *   @param  sFilename Name of trace file
+        *   @retval bool True if file is a valid trace
+        */
+        bool Load(string sFilename);
+
+        /** @brief  Replay loaded trace
+        *   @param  pEsp Pointer to ESP8266 to drive. Its serial port is switched to replay mode for the duration.
+        *   @param  nLoops Quantity of times to replay the trace (Default: 1)
+        *   @retval bool True if retransmitted frames matched the recording
+        *   @note   Some commands are legitimately unanswered in a recording, e.g. sync frames sent before the ROM was ready, so unanswered commands are reported but do not fail replay
+        */
+        bool Run(ESP8266* pEsp, unsigned int nLoops = 1);
+
+        /** @brief  Print summary of trace and replay results to stdout
+        */
+        void ShowResults();
+
+    private:
+        vector<unsigned char> m_vRx; //Concatenated received data
+        vector<unsigned char> m_vTx; //Concatenated transmitted data
+        unsigned long m_nRecords; //Quantity of records in trace
+        unsigned long m_nBaudChanges; //Quantity of baud records
+        unsigned long m_nModemChanges; //Quantity of modem line records
+        uint64_t m_nDuration; //Time spanned by trace in microseconds
+        unsigned int m_nLoops; //Quantity of replay loops run
+        unsigned long m_nCommands; //Quantity of command frames replayed
+        unsigned long m_nMatched; //Quantity of commands with matching response
+        unsigned long m_nInvalid; //Quantity of transmitted frames too short to be commands
+        unsigned long m_nMismatches; //Quantity of retransmitted bytes differing from recording
+        double m_dSeconds; //Duration of replay
+};